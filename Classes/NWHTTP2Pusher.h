@@ -0,0 +1,82 @@
+//
+//  NWHTTP2Pusher.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import "NWHub.h"
+#import <Foundation/Foundation.h>
+
+@class NWNotification;
+
+/** Pushes notifications using the HTTP/2 provider API of the APNs.
+
+ Where `NWPusher` writes binary frames over a TLS socket, this class sends every notification as a separate HTTP/2 request. All requests are multiplexed over a single connection, each as its own stream. The server responds to every request, successful or not, and a failed notification does not affect the others or close the connection.
+
+ The connection is managed by `NSURLSession`, which negotiates HTTP/2, compresses headers and keeps the number of open streams within the server's limit. The number of requests in flight is also bounded on the client side by `maxConcurrentRequests`, beyond which requests are queued. Pushing never blocks, so it is safe to push from a completion handler or the delegate.
+
+ Failed notifications are reported to the delegate, with the HTTP status as reason code in the error. The delegate is called on a background queue. Requests in flight keep the pusher alive until they complete, otherwise it is released as usual; there is no need to disconnect first.
+
+ Requires OS X 10.11 or iOS 9.
+ */
+NS_CLASS_AVAILABLE(10_11, 9_0)
+@interface NWHTTP2Pusher : NSObject
+
+/** @name Properties */
+
+/** Assign a delegate to get notified when a notification fails. */
+@property (nonatomic, weak) id<NWHubDelegate> delegate;
+
+/** The topic (bundle identifier) of every notification. Can be `nil` if the certificate only covers one topic. */
+@property (nonatomic, strong) NSString *topic;
+
+/** The maximum number of requests in flight, defaults to 1000. Set before connecting. */
+@property (nonatomic, assign) NSUInteger maxConcurrentRequests;
+
+/** Certificates (`SecCertificateRef`) to trust as roots instead of the system ones, for testing against a server with a self-signed certificate. Defaults to `nil`, which uses the system roots. Set before connecting. */
+@property (nonatomic, copy) NSArray *anchorCertificates;
+
+/** @name Initialization */
+
+/** Create and return an instance with delegate assigned. */
+- (instancetype)initWithDelegate:(id<NWHubDelegate>)delegate;
+
+/** Create, connect and return an instance with delegate and identity. */
++ (instancetype)connectWithDelegate:(id<NWHubDelegate>)delegate identity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Create, connect and return an instance with delegate and PKCS #12 data. */
++ (instancetype)connectWithDelegate:(id<NWHubDelegate>)delegate PKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** @name Connecting */
+
+/** Prepare a session using the identity for client authentication. The connection is opened with the first request. */
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Prepare a session using the identity from PKCS #12 data. */
+- (BOOL)connectWithPKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Prepare a session with a server other than the APNs, like the stand-in in Tests, using the identity for client authentication. */
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity host:(NSString *)host port:(NSUInteger)port error:(NSError **)error;
+
+/** Cancel all requests in flight and close the connection. Queued requests fail with `kNWErrorPushNotConnected`. */
+- (void)disconnect;
+
+/** @name Pushing */
+
+/** Push a notification, the completion (optional) is called with `nil` on success or the error. Queued until a request completes if `maxConcurrentRequests` requests are in flight. */
+- (void)pushNotification:(NWNotification *)notification completion:(void(^)(NSError *error))completion;
+
+/** Push multiple notifications, failures are reported to the delegate. */
+- (void)pushNotifications:(NSArray *)notifications;
+
+/** Wait until all requests in flight and queued have completed, returns `NO` on timeout. Do not call this from a completion handler or the delegate, as it would wait for itself. */
+- (BOOL)waitWithTimeout:(NSTimeInterval)timeout;
+
+/** @name Helpers */
+
+/** Returns the error code for the reason in the response of the server. */
++ (NWError)errorCodeWithReason:(NSString *)reason;
+
+@end
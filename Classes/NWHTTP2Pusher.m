@@ -0,0 +1,279 @@
+//
+//  NWHTTP2Pusher.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWHTTP2Pusher.h"
+#import "NWNotification.h"
+#import "NWSecTools.h"
+
+
+static NSString * const NWSandboxPushHost = @"api.sandbox.push.apple.com";
+static NSString * const NWPushHost = @"api.push.apple.com";
+static NSUInteger const NWPushPort = 443;
+static NSUInteger const NWHTTP2MaxConcurrentRequests = 1000;
+
+// The session keeps a strong reference to its delegate until it is invalidated, a separate delegate lets the pusher go when it is no longer used.
+@interface NWHTTP2SessionDelegate : NSObject <NSURLSessionDelegate>
+@property (nonatomic, strong) NWIdentityRef identity;
+@property (nonatomic, copy) NSArray *anchorCertificates;
+@end
+
+@implementation NWHTTP2Pusher {
+    NSURL *_baseURL;
+    NSURLSession *_session;
+    NSLock *_lock;
+    NSMutableArray *_queued;
+    NSUInteger _running;
+    dispatch_group_t _group;
+}
+
+- (instancetype)init
+{
+    return [self initWithDelegate:nil];
+}
+
+- (instancetype)initWithDelegate:(id<NWHubDelegate>)delegate
+{
+    self = [super init];
+    if (self) {
+        _delegate = delegate;
+        _maxConcurrentRequests = NWHTTP2MaxConcurrentRequests;
+        _lock = [[NSLock alloc] init];
+        _queued = @[].mutableCopy;
+        _group = dispatch_group_create();
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [_session invalidateAndCancel];
+}
+
+#pragma mark - Connecting
+
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    if (environment == NWEnvironmentAuto) environment = [NWSecTools environmentForIdentity:identity];
+    NSString *host = (environment == NWEnvironmentSandbox) ? NWSandboxPushHost : NWPushHost;
+    return [self connectWithIdentity:identity host:host port:NWPushPort error:error];
+}
+
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity host:(NSString *)host port:(NSUInteger)port error:(NSError *__autoreleasing *)error
+{
+    [self disconnect];
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration ephemeralSessionConfiguration];
+    configuration.HTTPMaximumConnectionsPerHost = 1;
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    queue.maxConcurrentOperationCount = 1;
+    NWHTTP2SessionDelegate *delegate = [[NWHTTP2SessionDelegate alloc] init];
+    delegate.identity = identity;
+    delegate.anchorCertificates = _anchorCertificates;
+    _baseURL = [NSURL URLWithString:[NSString stringWithFormat:@"https://%@:%lu/3/device/", host, (unsigned long)port]];
+    NSURLSession *session = [NSURLSession sessionWithConfiguration:configuration delegate:delegate delegateQueue:queue];
+    [_lock lock];
+    _session = session;
+    [_lock unlock];
+    return YES;
+}
+
+- (BOOL)connectWithPKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWIdentityRef identity = [NWSecTools identityWithPKCS12Data:data password:password error:error];
+    if (!identity) {
+        return NO;
+    }
+    return [self connectWithIdentity:identity environment:environment error:error];
+}
+
+- (void)disconnect
+{
+    [_lock lock];
+    NSURLSession *session = _session;
+    _session = nil;
+    NSArray *queued = _queued.copy;
+    [_queued removeAllObjects];
+    [_lock unlock];
+    [session invalidateAndCancel];
+    for (void(^send)(NSURLSession *) in queued) {
+        send(nil);
+    }
+}
+
++ (instancetype)connectWithDelegate:(id<NWHubDelegate>)delegate identity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWHTTP2Pusher *pusher = [[NWHTTP2Pusher alloc] initWithDelegate:delegate];
+    return identity && [pusher connectWithIdentity:identity environment:environment error:error] ? pusher : nil;
+}
+
++ (instancetype)connectWithDelegate:(id<NWHubDelegate>)delegate PKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWHTTP2Pusher *pusher = [[NWHTTP2Pusher alloc] initWithDelegate:delegate];
+    return data && [pusher connectWithPKCS12Data:data password:password environment:environment error:error] ? pusher : nil;
+}
+
+#pragma mark - Pushing
+
+- (void)pushNotification:(NWNotification *)notification completion:(void(^)(NSError *error))completion
+{
+    if (!notification.tokenData.length) {
+        NSError *error = nil;
+        [NWErrorUtil noWithErrorCode:kNWErrorAPNMissingDeviceToken error:&error];
+        [self notification:notification didFailWithError:error completion:completion];
+        return;
+    }
+    NSURL *url = [_baseURL URLByAppendingPathComponent:[NWNotification hexFromData:notification.tokenData]];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+    request.HTTPMethod = @"POST";
+    request.HTTPBody = notification.payloadData;
+    if (_topic) [request setValue:_topic forHTTPHeaderField:@"apns-topic"];
+    if (notification.addExpiration) [request setValue:@(notification.expirationStamp).stringValue forHTTPHeaderField:@"apns-expiration"];
+    if (notification.priority) [request setValue:@(notification.priority).stringValue forHTTPHeaderField:@"apns-priority"];
+    dispatch_group_t group = _group;
+    dispatch_group_enter(group);
+    // called with the session to send on once a slot is free, or nil if disconnected before that
+    void(^send)(NSURLSession *) = ^(NSURLSession *session) {
+        if (!session) {
+            NSError *error = nil;
+            [NWErrorUtil noWithErrorCode:kNWErrorPushNotConnected error:&error];
+            [self notification:notification didFailWithError:error completion:completion];
+            dispatch_group_leave(group);
+            return;
+        }
+        NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *e) {
+            NSError *error = e ?: [NWHTTP2Pusher errorWithResponse:(NSHTTPURLResponse *)response data:data];
+            if (error) {
+                [self notification:notification didFailWithError:error completion:completion];
+            } else if (completion) {
+                completion(nil);
+            }
+            [self sendNext];
+            dispatch_group_leave(group);
+        }];
+        [task resume];
+    };
+    [_lock lock];
+    NSURLSession *session = _session;
+    BOOL start = session && _running < MAX(_maxConcurrentRequests, 1);
+    if (start) {
+        _running++;
+    } else if (session) {
+        [_queued addObject:send];
+    }
+    [_lock unlock];
+    if (start || !session) send(session);
+}
+
+// Hands the slot of a completed request to the first queued one.
+- (void)sendNext
+{
+    [_lock lock];
+    NSURLSession *session = _session;
+    void(^next)(NSURLSession *) = session ? _queued.firstObject : nil;
+    if (next) {
+        [_queued removeObjectAtIndex:0];
+    } else if (_running) {
+        _running--;
+    }
+    [_lock unlock];
+    if (next) next(session);
+}
+
+- (void)pushNotifications:(NSArray *)notifications
+{
+    for (NWNotification *notification in notifications) {
+        [self pushNotification:notification completion:nil];
+    }
+}
+
+- (BOOL)waitWithTimeout:(NSTimeInterval)timeout
+{
+    return !dispatch_group_wait(_group, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)));
+}
+
+- (void)notification:(NWNotification *)notification didFailWithError:(NSError *)error completion:(void(^)(NSError *error))completion
+{
+    id<NWHubDelegate> delegate = _delegate;
+    if ([delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+        [delegate notification:notification didFailWithError:error];
+    }
+    if (completion) completion(error);
+}
+
+#pragma mark - Response
+
++ (NSError *)errorWithResponse:(NSHTTPURLResponse *)response data:(NSData *)data
+{
+    NSInteger status = response.statusCode;
+    if (status == 200) {
+        return nil;
+    }
+    NSDictionary *json = data.length ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    NSString *reason = [json isKindOfClass:NSDictionary.class] ? json[@"reason"] : nil;
+    NSError *error = nil;
+    [NWErrorUtil noWithErrorCode:[self errorCodeWithReason:reason] reason:status error:&error];
+    return error;
+}
+
++ (NWError)errorCodeWithReason:(NSString *)reason
+{
+    static NSDictionary *codes = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        codes = @{
+            @"BadDeviceToken": @(kNWErrorAPNInvalidTokenContent),
+            @"MissingDeviceToken": @(kNWErrorAPNMissingDeviceToken),
+            @"MissingTopic": @(kNWErrorAPNMissingTopic),
+            @"PayloadEmpty": @(kNWErrorAPNMissingPayload),
+            @"PayloadTooLarge": @(kNWErrorAPNInvalidPayloadSize),
+            @"Unregistered": @(kNWErrorAPNUnregistered),
+            @"BadTopic": @(kNWErrorAPNBadTopic),
+            @"TopicDisallowed": @(kNWErrorAPNBadTopic),
+            @"DeviceTokenNotForTopic": @(kNWErrorAPNBadTopic),
+            @"BadCertificate": @(kNWErrorAPNBadCertificate),
+            @"BadCertificateEnvironment": @(kNWErrorAPNBadCertificate),
+            @"Forbidden": @(kNWErrorAPNBadCertificate),
+            @"TooManyRequests": @(kNWErrorAPNTooManyRequests),
+            @"InternalServerError": @(kNWErrorAPNProcessing),
+            @"ServiceUnavailable": @(kNWErrorAPNShutdown),
+            @"Shutdown": @(kNWErrorAPNShutdown),
+        };
+    });
+    NSNumber *code = reason ? codes[reason] : nil;
+    return code ? code.integerValue : kNWErrorAPNUnknownReason;
+}
+
+@end
+
+
+@implementation NWHTTP2SessionDelegate
+
+#pragma mark - NSURLSessionDelegate
+
+- (void)URLSession:(NSURLSession *)session didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(NSURLSessionAuthChallengeDisposition, NSURLCredential *))completionHandler
+{
+    if ([challenge.protectionSpace.authenticationMethod isEqualToString:NSURLAuthenticationMethodClientCertificate] && _identity) {
+        NSURLCredential *credential = [NSURLCredential credentialWithIdentity:(__bridge SecIdentityRef)_identity certificates:nil persistence:NSURLCredentialPersistenceForSession];
+        completionHandler(NSURLSessionAuthChallengeUseCredential, credential);
+        return;
+    }
+    if ([challenge.protectionSpace.authenticationMethod isEqualToString:NSURLAuthenticationMethodServerTrust] && _anchorCertificates) {
+        SecTrustRef trust = challenge.protectionSpace.serverTrust;
+        SecTrustResultType result = kSecTrustResultInvalid;
+        BOOL trusted = SecTrustSetAnchorCertificates(trust, (__bridge CFArrayRef)_anchorCertificates) == errSecSuccess
+            && SecTrustEvaluate(trust, &result) == errSecSuccess
+            && (result == kSecTrustResultUnspecified || result == kSecTrustResultProceed);
+        if (trusted) {
+            completionHandler(NSURLSessionAuthChallengeUseCredential, [NSURLCredential credentialForTrust:trust]);
+        } else {
+            completionHandler(NSURLSessionAuthChallengeCancelAuthenticationChallenge, nil);
+        }
+        return;
+    }
+    completionHandler(NSURLSessionAuthChallengePerformDefaultHandling, nil);
+}
+
+@end
@@ -8,7 +8,7 @@
 #import "NWType.h"
 #import <Foundation/Foundation.h>
 
-@class NWNotification, NWPusher;
+@class NWJournal, NWNotification, NWPusher, NWTracker;
 
 /** Allows callback on errors while pushing to and reading from server. 
  
@@ -23,7 +23,7 @@
  
  This class provides a more convenient way of pushing notifications to the APNs. It deals with the trouble of assigning a unique identifier to every notification and the handling of error responses from the server. It hides the latency that comes with transmitting the pushes, allowing you to simply push your notifications and getting notified of errors through the delegate. If this feels over-abstracted, then definitely check out the `NWPusher` class, which will give you full control.
  
- There are two set of methods for pushing notifications: the easy and the pros. The former will just do the pushing and reconnect if the connection breaks. This is your low-worry solution, provided that you call `readFailed` every so often (seconds) to handle error data from the server. The latter will give you a little more control and a little more responsibility.
+ There are two set of methods for pushing notifications: the easy and the pros. The former will just do the pushing and reconnect if the connection breaks. This is your low-worry solution, provided that you call `readFailed` every so often (seconds), or `startReading` once, to handle error data from the server. The latter will give you a little more control and a little more responsibility.
  */
 @interface NWHub : NSObject
 
@@ -41,9 +41,36 @@
 /** The timespan we'll hold on to a notification after pushing, allowing the server to respond. */
 @property (nonatomic, assign) NSTimeInterval feedbackSpan;
 
-/** The index incremented on every notification push, used as notification identifier. */
+/** The index incremented on every notification push, used as notification identifier. It is never 0 and is taken atomically, so `NWPushQueue` can reserve identifiers from any thread. */
 @property (nonatomic, assign) NSUInteger index;
 
+/** Resend the notifications pushed after a failed one, after auto-reconnecting. Defaults to `NO`.
+ 
+ The server drops the connection after responding with an error, so all notifications pushed after the failed one are silently lost. With replay enabled, `readFailed:autoReconnect:error:` resends these, in order, once it has reconnected.
+ */
+@property (nonatomic, assign) BOOL replay;
+
+/** Keeps the notifications pushed in the past `feedbackSpan`, for lookup by identifier. Replace it to track more (or fewer) notifications. */
+@property (nonatomic, strong) NWTracker *tracker;
+
+/** Records every notification written in a memory-mapped file, so a broadcast can resume after the process dies. Defaults to `nil`.
+ 
+ Frames are confirmed in the journal when the server reports an error on a later notification, or when they are older than `feedbackSpan` while trimming. With `replay` enabled, the journal is the source of notifications to resend after reconnecting. Assigning a journal moves `index` past its last identifier.
+
+ A notification that does not fit in the journal is still pushed, but reported to the delegate with `kNWErrorJournalFull` because it cannot be replayed. Replayed frames stay in the journal until confirmed. Changes to the journal are scheduled to be written to disk while trimming and after replaying, without waiting for the disk, and written to disk on disconnect.
+ 
+ @see replayJournal
+ */
+@property (nonatomic, strong) NWJournal *journal;
+
+/** Whether error responses are being read in the background.
+ @see startReading
+ */
+@property (nonatomic, readonly) BOOL reading;
+
+/** The number of error responses read from the server, both by `readFailed` and while reading in the background. */
+@property (nonatomic, readonly) NSUInteger rejected;
+
 /** @name Initialization */
 
 /** Create and return a hub object with a delegate object assigned. */
@@ -101,6 +128,14 @@
  */
 - (NSUInteger)pushNotifications:(NSArray *)notifications;
 
+/** Push multiple notifications with as few writes as possible, see `writeBufferSize` of `NWPusher`.
+
+ Like `pushNotifications:`, this assigns identifiers where none was set, reports failures to the delegate and reconnects if the connection breaks, after which the rest of the notifications is pushed on the new connection. Returns the number of notifications that failed.
+
+ @see pushNotifications:
+ */
+- (NSUInteger)pushBatch:(NSArray *)notifications;
+
 /** Read the response from the server to see if any pushes have failed.
  
  Due to transmission latency it usually takes a couple of milliseconds for the server to respond to errors. This methods reads the server response and handles the errors. Make sure to call this regularly to catch up on malformed notifications.
@@ -109,11 +144,23 @@
  */
 - (NSUInteger)readFailed;
 
+/** Continuously read error responses on a dedicated queue, instead of calling `readFailed` every so often.
+ 
+ The reader waits for the server to respond, so a failed notification is reported to the delegate as soon as the response arrives, after which the connection is reestablished. Pushing and reading are serialized internally, so it is safe to keep pushing from another queue. The delegate is called on the reading queue. Stopped by `stopReading` or `disconnect`.
+ */
+- (void)startReading;
+
+/** Stop reading error responses in the background, takes effect within a second. */
+- (void)stopReading;
+
 /** @name Pushing (pros) */
 
+/** Take the next notification identifier from `index`, skipping 0. Safe to call from any thread, without taking the lock of the hub. */
+- (NSUInteger)nextIdentifier;
+
 /** Push a notification and reconnect if anything failed. 
  
- This will assign the notification a unique (incremental) identifier and feed it to the internal pusher. If this succeeds, the notification is stored for later lookup by `readFailed:autoReconnect:error:`. If it fails, the delegate will be invoked and it will reconnect if set to auto-reconnect.
+ This will first validate the notification, reporting it to the delegate without writing if the server would reject it. A rejected notification would otherwise make the server drop the connection, taking all notifications pushed after it. It then assigns the notification a unique (incremental) identifier and feeds it to the internal pusher. If this succeeds, the notification is stored for later lookup by `readFailed:autoReconnect:error:`. If it fails, the delegate will be invoked and it will reconnect if set to auto-reconnect.
  
  @see readFailed:autoReconnect:error:
  */
@@ -125,16 +172,24 @@
  
  From the server we only get the notification identifier and the error message. This method translates this back into the original notification by keeping track of all notifications sent in the past 30 seconds. If somehow the original notification cannot be found, it will assign `NSNull`.
  
- Usually, when a notification fails, the server will drop the connection. To prevent this from causing any more problems, the connection can be reestablished by setting it to reconnect automatically.
+ Usually, when a notification fails, the server will drop the connection. To prevent this from causing any more problems, the connection can be reestablished by setting it to reconnect automatically. If `replay` is enabled, all tracked notifications pushed after the failed one are then pushed again. They keep their entries in the tracker, and a write that fails during this replay is reported and followed by another reconnect.
  
  @see trimIdentifiers
  @see feedbackSpan
  */
 - (BOOL)readFailed:(NWNotification **)notification autoReconnect:(BOOL)reconnect error:(NSError **)error;
 
+/** Resend all unconfirmed notifications in the journal, for example after reconnecting in a new process that crashed mid-broadcast. Returns the number resent.
+ 
+ The notifications are written as they were recorded, with their original identifiers. Those that cannot be written are reported to the delegate, as `nil` if no longer tracked, and stay in the journal for the next replay. A failed write may have cut a frame off, so the hub then reconnects and continues with the frame after it.
+ 
+ @see journal
+ */
+- (NSUInteger)replayJournal;
+
 /** Let go of old notification, after you read the failed notifications.
  
- This class keeps track of all notifications sent so we can look them up later based on their identifier. This allows it to translate identifiers back into the original notification. To limit the amount of memory all older notifications should be trimmed from this lookup, which is done by this method. This is done based on the `feedbackSpan`, which defaults to 30 seconds.
+ This class keeps track of all notifications sent so we can look them up later based on their identifier. This allows it to translate identifiers back into the original notification. The lookup is bounded by the capacity of the `tracker`, but all older notifications should be trimmed from it to let go of them in time, which is done by this method. This is done based on the `feedbackSpan`, which defaults to 30 seconds.
  
  Be careful not to call this function without first reading all failed notifications, using `readFailed:autoReconnect:error:`.
  
@@ -8,11 +8,22 @@
 #import "NWHub.h"
 #import "NWPusher.h"
 #import "NWNotification.h"
+#import "NWSSLConnection.h"
 #import "NWSecTools.h"
+#import "NWTracker.h"
+#import "NWJournal.h"
+#import "NWMetrics.h"
+#include <stdatomic.h>
 
 
+static NSUInteger const NWHubTokenSize = 32;
+static NSTimeInterval const NWHubReadInterval = 1;
+
 @implementation NWHub {
-    NSMutableDictionary *_notificationForIdentifier;
+    NSRecursiveLock *_lock;
+    dispatch_queue_t _readQueue;
+    _Atomic(uint32_t) _counter;
+    _Atomic(NSUInteger) _rejected;
 }
     
 - (instancetype)init
@@ -29,37 +40,76 @@
 {
     self = [super init];
     if (self) {
-        _index = 1;
+        atomic_init(&_counter, 1);
         _feedbackSpan = 30;
         _pusher = pusher;
         _delegate = delegate;
-        _notificationForIdentifier = @{}.mutableCopy;
+        _tracker = [[NWTracker alloc] init];
         _type = kNWNotificationType2;
+        _lock = [[NSRecursiveLock alloc] init];
     }
     return self;
 }
     
     
+- (void)setJournal:(NWJournal *)journal
+{
+    [_lock lock];
+    _journal = journal;
+    if (journal.writtenIdentifier) self.index = journal.writtenIdentifier + 1;
+    [_lock unlock];
+}
+
+- (NSUInteger)rejected
+{
+    return atomic_load_explicit(&_rejected, memory_order_relaxed);
+}
+
+- (NSUInteger)index
+{
+    return atomic_load_explicit(&_counter, memory_order_relaxed);
+}
+
+- (void)setIndex:(NSUInteger)index
+{
+    atomic_store_explicit(&_counter, (uint32_t)index ?: 1, memory_order_relaxed);
+}
+    
+    
 #pragma mark - Connecting
 
 - (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
 {
-    return [_pusher connectWithIdentity:identity environment:environment error:error];
+    [_lock lock];
+    BOOL connected = [_pusher connectWithIdentity:identity environment:environment error:error];
+    [_lock unlock];
+    return connected;
 }
 
 - (BOOL)connectWithPKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
 {
-    return [_pusher connectWithPKCS12Data:data password:password environment:environment error:error];
+    [_lock lock];
+    BOOL connected = [_pusher connectWithPKCS12Data:data password:password environment:environment error:error];
+    [_lock unlock];
+    return connected;
 }
 
 - (BOOL)reconnectWithError:(NSError *__autoreleasing *)error
 {
-    return [_pusher reconnectWithError:error];
+    [_lock lock];
+    BOOL connected = [_pusher reconnectWithError:error];
+    [_lock unlock];
+    return connected;
 }
 
 - (void)disconnect
 {
+    [self stopReading];
+    [_lock lock];
     [_pusher disconnect];
+    NWJournal *journal = _journal;
+    [_lock unlock];
+    [journal synchronize];
 }
     
 + (instancetype)connectWithDelegate:(id<NWHubDelegate>)delegate identity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
@@ -84,12 +134,17 @@
 
 - (NSUInteger)pushPayload:(NSString *)payload tokens:(NSArray *)tokens
 {
+    NSData *payloadData = [payload dataUsingEncoding:NSUTF8StringEncoding];
     NSMutableArray *notifications = @[].mutableCopy;
-    for (NSString *token in tokens) {
-        NWNotification *notification = [[NWNotification alloc] initWithPayload:payload token:token identifier:0 expiration:nil priority:0];
-        [notifications addObject:notification];
+    NSMutableArray *others = @[].mutableCopy;
+    NSArray *tokenDatas = [NWNotification dataFromHexes:tokens];
+    for (NSUInteger i = 0; i < tokens.count; i++) {
+        NSData *tokenData = tokenDatas[i] != NSNull.null ? tokenDatas[i] : nil;
+        NWNotification *notification = [[NWNotification alloc] initWithPayloadData:payloadData tokenData:tokenData identifier:0 expirationStamp:0 addExpiration:NO priority:0];
+        if (!tokenData) notification.token = tokens[i];
+        [(notification.tokenData.length == NWHubTokenSize ? notifications : others) addObject:notification];
     }
-    return [self pushNotifications:notifications];
+    return [self pushFanOut:notifications] + [self pushNotifications:others];
 }
 
 - (NSUInteger)pushPayloads:(NSArray *)payloads token:(NSString *)token
@@ -114,27 +169,190 @@
     return fails;
 }
 
+- (NSUInteger)pushBatch:(NSArray *)notifications
+{
+    [_lock lock];
+    NSUInteger fails = [self pushBatchLocked:notifications];
+    [_lock unlock];
+    return fails;
+}
+
+- (NSUInteger)pushBatchLocked:(NSArray *)notifications
+{
+    NSMutableArray *valid = [[NSMutableArray alloc] initWithCapacity:notifications.count];
+    NSUInteger fails = 0;
+    for (NWNotification *notification in notifications) {
+        NSError *invalid = nil;
+        if (![notification validateWithType:_type error:&invalid]) {
+            fails++;
+            if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                [_delegate notification:notification didFailWithError:invalid];
+            }
+            continue;
+        }
+        if (!notification.identifier) notification.identifier = [self nextIdentifier];
+        [valid addObject:notification];
+    }
+    return fails + [self writeNotificationsLocked:valid track:YES];
+}
+
+// Writes validated notifications in as few writes as fit, reconnecting after a failed write. Returns the number of failures.
+- (NSUInteger)writeNotificationsLocked:(NSArray *)notifications track:(BOOL)track
+{
+    NSUInteger fails = 0;
+    NSUInteger count = notifications.count;
+    NSUInteger *accepted = calloc(count, sizeof(NSUInteger));
+    for (NSUInteger offset = 0; offset < count;) {
+        NSError *error = nil;
+        NSArray *range = [notifications subarrayWithRange:NSMakeRange(offset, count - offset)];
+        memset(accepted, 0, range.count * sizeof(NSUInteger));
+        [_pusher pushNotifications:range type:_type accepted:accepted error:&error];
+        NSUInteger sent = 0;
+        for (; sent < range.count && accepted[sent] == [range[sent] lengthWithType:_type]; sent++) {
+            if (track) {
+                [_tracker addNotification:range[sent]];
+                [self journalNotification:range[sent]];
+            }
+        }
+        offset += sent;
+        if (offset < count) {
+            NWNotification *notification = notifications[offset++];
+            fails++;
+            if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                [_delegate notification:notification didFailWithError:error];
+            }
+            // the connection may have stopped in the middle of a frame, so never write on it again
+            NWMetricsAddReconnect(error.code);
+            if (![self reconnectWithError:nil]) {
+                for (; offset < count; offset++) {
+                    fails++;
+                    if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                        [_delegate notification:notifications[offset] didFailWithError:error];
+                    }
+                }
+            }
+        }
+    }
+    free(accepted);
+    return fails;
+}
+
+- (NSUInteger)pushFanOut:(NSArray *)notifications
+{
+    [_lock lock];
+    NSUInteger fails = [self pushFanOutLocked:notifications];
+    [_lock unlock];
+    return fails;
+}
+
+- (NSUInteger)pushFanOutLocked:(NSArray *)notifications
+{
+    NSError *invalid = nil;
+    if (notifications.count && ![notifications[0] validateWithType:_type error:&invalid]) {
+        for (NWNotification *notification in notifications) {
+            if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                [_delegate notification:notification didFailWithError:invalid];
+            }
+        }
+        return notifications.count;
+    }
+    for (NWNotification *notification in notifications) {
+        notification.identifier = [self nextIdentifier];
+    }
+    NSArray *tokens = [notifications valueForKey:@"tokenData"];
+    NSUInteger fails = 0;
+    for (NSUInteger offset = 0, count = notifications.count; offset < count;) {
+        NSError *error = nil;
+        NSUInteger end = offset + 1;
+        while (end < count && (uint32_t)(((NWNotification *)notifications[end]).identifier - ((NWNotification *)notifications[end - 1]).identifier) == 1) end++;
+        NSArray *range = [tokens subarrayWithRange:NSMakeRange(offset, end - offset)];
+        NSUInteger sent = [_pusher pushNotification:notifications[offset] tokenDatas:range type:_type error:&error];
+        for (NSUInteger i = offset; i < offset + sent; i++) {
+            [_tracker addNotification:notifications[i]];
+            [self journalNotification:notifications[i]];
+        }
+        offset += sent;
+        if (offset < count) {
+            NWNotification *notification = notifications[offset++];
+            fails++;
+            if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                [_delegate notification:notification didFailWithError:error];
+            }
+            if (error.code == kNWErrorAPNInvalidTokenSize) {
+                continue;
+            }
+            // the connection may have stopped in the middle of a frame, so never write on it again
+            NWMetricsAddReconnect(error.code);
+            if (![self reconnectWithError:nil]) {
+                for (; offset < count; offset++) {
+                    fails++;
+                    if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+                        [_delegate notification:notifications[offset] didFailWithError:error];
+                    }
+                }
+            }
+        }
+    }
+    return fails;
+}
+
+- (NSUInteger)nextIdentifier
+{
+    uint32_t result = 0;
+    // 0 means no identifier, skip it when the counter wraps
+    while (!result) result = atomic_fetch_add_explicit(&_counter, 1, memory_order_relaxed);
+    return result;
+}
+
 #pragma mark - Pushing with NSError
 
 - (BOOL)pushNotification:(NWNotification *)notification autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
 {
-    if (!notification.identifier) notification.identifier = _index++;
+    [_lock lock];
+    BOOL pushed = [self pushNotificationLocked:notification autoReconnect:reconnect error:error];
+    [_lock unlock];
+    return pushed;
+}
+
+- (BOOL)pushNotificationLocked:(NWNotification *)notification autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
+{
     NSError *e = nil;
+    if (![notification validateWithType:_type error:&e]) {
+        if (error) *error = e;
+        if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+            [_delegate notification:notification didFailWithError:e];
+        }
+        return NO;
+    }
+    if (!notification.identifier) notification.identifier = [self nextIdentifier];
     BOOL pushed = [_pusher pushNotification:notification type:_type error:&e];
     if (!pushed) {
         if (error) *error = e;
         if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
             [_delegate notification:notification didFailWithError:e];
         }
-        if (reconnect && e.code == kNWErrorWriteClosedGraceful) {
+        if (reconnect && (e.code == kNWErrorWriteClosedGraceful || e.code == kNWErrorPushWriteFail)) {
+            NWMetricsAddReconnect(e.code);
             [self reconnectWithError:error];
         }
         return pushed;
     }
-    _notificationForIdentifier[@(notification.identifier)] = @[notification, NSDate.date];
+    [_tracker addNotification:notification];
+    [self journalNotification:notification];
     return YES;
 }
 
+- (void)journalNotification:(NWNotification *)notification
+{
+    NSError *error = nil;
+    // frames are only confirmed by the server or the error window, a full journal cannot make room by itself
+    if (_journal && ![_journal appendNotification:notification type:_type error:&error]) {
+        if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+            [_delegate notification:notification didFailWithError:error];
+        }
+    }
+}
+
 - (BOOL)pushNotifications:(NSArray *)notifications autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
 {
     for (NWNotification *notification in notifications) {
@@ -156,6 +374,14 @@
 }
 
 - (BOOL)readFailed:(NSArray **)notifications max:(NSUInteger)max autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
+{
+    [_lock lock];
+    BOOL read = [self readFailedLocked:notifications max:max autoReconnect:reconnect error:error];
+    [_lock unlock];
+    return read;
+}
+
+- (BOOL)readFailedLocked:(NSArray **)notifications max:(NSUInteger)max autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
 {
     NSMutableArray *n = @[].mutableCopy;
     for (NSUInteger i = 0; i < max; i++) {
@@ -175,6 +401,14 @@
 }
 
 - (BOOL)readFailed:(NWNotification **)notification autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
+{
+    [_lock lock];
+    BOOL read = [self readFailedLocked:notification autoReconnect:reconnect error:error];
+    [_lock unlock];
+    return read;
+}
+
+- (BOOL)readFailedLocked:(NWNotification **)notification autoReconnect:(BOOL)reconnect error:(NSError *__autoreleasing *)error
 {
     NSUInteger identifier = 0;
     NSError *apnError = nil;
@@ -183,26 +417,145 @@
         return read;
     }
     if (apnError) {
-        NWNotification *n = _notificationForIdentifier[@(identifier)][0];
+        NWNotification *n = [_tracker notificationForIdentifier:identifier];
+        NSTimeInterval age = [_tracker timeSinceAddingIdentifier:identifier];
+        NWMetricsAdd(kNWMetricErrorResponses, 1);
+        atomic_fetch_add_explicit(&_rejected, 1, memory_order_relaxed);
+        [_journal acknowledgeThroughIdentifier:identifier];
+        if (age >= 0) NWHistogramRecord(kNWHistogramErrorResponse, (uint64_t)(age * NSEC_PER_SEC));
         if (notification) *notification = n ?: (NWNotification *)NSNull.null;
         if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
             [_delegate notification:n didFailWithError:apnError];
         }
         if (reconnect) {
-            [self reconnectWithError:error];
+            NWMetricsAddReconnect(apnError.code);
+            BOOL reconnected = [self reconnectWithError:error];
+            if (reconnected && _replay) {
+                if (_journal) [self replayJournalLocked];
+                else [self replayAfterIdentifier:identifier];
+            }
         }
     }
     return YES;
 }
 
+- (NSUInteger)replayAfterIdentifier:(NSUInteger)identifier
+{
+    NSArray *notifications = [_tracker notificationsAfterIdentifier:identifier];
+    // replayed notifications keep their entries in the tracker, with the time of their first push
+    return notifications.count - [self writeNotificationsLocked:notifications track:NO];
+}
+
+- (NSUInteger)replayJournal
+{
+    [_lock lock];
+    NSUInteger replayed = [self replayJournalLocked];
+    [_lock unlock];
+    return replayed;
+}
+
+- (NSUInteger)replayJournalLocked
+{
+    NSMutableArray *frames = @[].mutableCopy;
+    NSMutableArray *identifiers = @[].mutableCopy;
+    [_journal enumerateUnacknowledgedFramesUsingBlock:^(NSData *frame, NSUInteger identifier, BOOL *stop) {
+        [frames addObject:frame];
+        [identifiers addObject:@(identifier)];
+    }];
+    // the frames stay in the journal until confirmed, so a crash or failed write during replay loses none of them
+    NSUInteger count = frames.count;
+    NSUInteger capacity = MAX(_pusher.writeBufferSize, 1);
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:capacity];
+    NSUInteger replayed = 0, last = 0;
+    for (NSUInteger index = 0; index < count;) {
+        NSError *error = nil;
+        NSUInteger end = index;
+        [data setLength:0];
+        while (end < count && (!data.length || data.length + ((NSData *)frames[end]).length <= capacity)) {
+            [data appendData:frames[end++]];
+        }
+        NSUInteger length = 0;
+        if (!_pusher.connection) {
+            [NWErrorUtil noWithErrorCode:kNWErrorPushNotConnected error:&error];
+        } else if ([_pusher.connection write:data length:&length error:&error] && length != data.length) {
+            [NWErrorUtil noWithErrorCode:kNWErrorPushWriteFail reason:length error:&error];
+        }
+        for (NSUInteger offset = 0; index < end && offset + ((NSData *)frames[index]).length <= length; index++) {
+            offset += ((NSData *)frames[index]).length;
+            last = [identifiers[index] unsignedIntegerValue];
+            replayed++;
+        }
+        if (index < end) {
+            [self replayedFrameWithIdentifier:[identifiers[index++] unsignedIntegerValue] didFailWithError:error];
+            // the connection may have stopped in the middle of a frame, so never write on it again
+            NWMetricsAddReconnect(error.code);
+            if (![self reconnectWithError:nil]) {
+                while (index < count) [self replayedFrameWithIdentifier:[identifiers[index++] unsignedIntegerValue] didFailWithError:error];
+            }
+        }
+    }
+    if (replayed) [_journal renewFramesThroughIdentifier:last];
+    [_journal flush];
+    return replayed;
+}
+
+// Reports a frame that could not be replayed, it stays unconfirmed in the journal for the next replay.
+- (void)replayedFrameWithIdentifier:(NSUInteger)identifier didFailWithError:(NSError *)error
+{
+    if ([_delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+        [_delegate notification:[_tracker notificationForIdentifier:identifier] didFailWithError:error];
+    }
+}
+
 - (BOOL)trimIdentifiers
 {
-    NSDate *oldBefore = [NSDate dateWithTimeIntervalSinceNow:-_feedbackSpan];
-    NSArray *old = [[_notificationForIdentifier keysOfEntriesPassingTest:^BOOL(id key, id obj, BOOL *stop) {
-        return [oldBefore compare:obj[1]] == NSOrderedDescending;
-    }] allObjects];
-    [_notificationForIdentifier removeObjectsForKeys:old];
-    return !!old.count;
+    [_lock lock];
+    [_journal acknowledgeFramesOlderThan:_feedbackSpan];
+    [_journal flush];
+    BOOL trimmed = !![_tracker removeNotificationsOlderThan:_feedbackSpan];
+    [_lock unlock];
+    return trimmed;
+}
+
+#pragma mark - Reading in background
+
+- (void)startReading
+{
+    [_lock lock];
+    BOOL reading = _reading;
+    _reading = YES;
+    if (!_readQueue) _readQueue = dispatch_queue_create("NWHub.read", DISPATCH_QUEUE_SERIAL);
+    [_lock unlock];
+    if (reading) {
+        return;
+    }
+    __weak NWHub *weakSelf = self;
+    dispatch_async(_readQueue, ^{
+        for (;;) {
+            NWHub *hub = weakSelf;
+            if (!hub.reading) {
+                break;
+            }
+            [hub waitAndReadFailed];
+        }
+    });
+}
+
+- (void)stopReading
+{
+    [_lock lock];
+    _reading = NO;
+    [_lock unlock];
+}
+
+- (void)waitAndReadFailed
+{
+    [_lock lock];
+    NWSSLConnection *connection = _pusher.connection;
+    [_lock unlock];
+    [connection waitForReadWithTimeout:NWHubReadInterval];
+    if (!connection) [NSThread sleepForTimeInterval:NWHubReadInterval];
+    [self readFailed];
 }
 
 #pragma mark - Deprecated
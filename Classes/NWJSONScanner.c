@@ -0,0 +1,162 @@
+//
+//  NWJSONScanner.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWJSONScanner.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif // __SSE2__
+
+
+#pragma mark - Tokens
+
+static inline const char *NWJSONSkipSpace(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    return p;
+}
+
+static inline int NWJSONIsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline int NWJSONIsHex(char c) {
+    return NWJSONIsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// Returns the position after the escape sequence that starts after the backslash at p, or NULL if invalid.
+static const char *NWJSONScanEscape(const char *p, const char *end) {
+    if (p == end) return NULL;
+    switch (*p) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't': return p + 1;
+        case 'u': {
+            if (end - p < 5) return NULL;
+            for (int i = 1; i <= 4; i++) {
+                if (!NWJSONIsHex(p[i])) return NULL;
+            }
+            return p + 5;
+        }
+    }
+    return NULL;
+}
+
+// Returns the position after the closing quote of the string starting after the opening quote at p, or NULL if invalid.
+static const char *NWJSONScanString(const char *p, const char *end) {
+    for (;;) {
+#if defined(__SSE2__)
+        // skip 16 plain characters at a time, stopping at a quote, backslash or control character
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        while (end - p >= 16) {
+            __m128i c = _mm_loadu_si128((const __m128i *)p);
+            __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, backslash)), _mm_cmpeq_epi8(_mm_max_epu8(c, control), control));
+            int mask = _mm_movemask_epi8(special);
+            if (mask) {
+                p += __builtin_ctz(mask);
+                break;
+            }
+            p += 16;
+        }
+#endif // __SSE2__
+        while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) p++;
+        if (p == end || (unsigned char)*p < 0x20) return NULL;
+        if (*p == '"') return p + 1;
+        p = NWJSONScanEscape(p + 1, end);
+        if (!p) return NULL;
+    }
+}
+
+// Returns the position after the number starting at p, or NULL if invalid.
+static const char *NWJSONScanNumber(const char *p, const char *end) {
+    if (p < end && *p == '-') p++;
+    if (p == end) return NULL;
+    if (*p == '0') {
+        p++;
+    } else if (NWJSONIsDigit(*p)) {
+        while (p < end && NWJSONIsDigit(*p)) p++;
+    } else {
+        return NULL;
+    }
+    if (p < end && *p == '.') {
+        if (++p == end || !NWJSONIsDigit(*p)) return NULL;
+        while (p < end && NWJSONIsDigit(*p)) p++;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        if (++p < end && (*p == '+' || *p == '-')) p++;
+        if (p == end || !NWJSONIsDigit(*p)) return NULL;
+        while (p < end && NWJSONIsDigit(*p)) p++;
+    }
+    return p;
+}
+
+static const char *NWJSONScanLiteral(const char *p, const char *end, const char *literal, size_t length) {
+    return (size_t)(end - p) >= length && !memcmp(p, literal, length) ? p + length : NULL;
+}
+
+// Returns the position after the key and colon of an object member starting at p, or NULL if invalid.
+static const char *NWJSONScanKey(const char *p, const char *end) {
+    if (p == end || *p != '"') return NULL;
+    p = NWJSONScanString(p + 1, end);
+    if (!p) return NULL;
+    p = NWJSONSkipSpace(p, end);
+    if (p == end || *p != ':') return NULL;
+    return NWJSONSkipSpace(p + 1, end);
+}
+
+
+#pragma mark - Scanner
+
+int NWJSONValidate(const char *bytes, size_t length, int object) {
+    const char *p = NWJSONSkipSpace(bytes, bytes + length);
+    const char *end = bytes + length;
+    char stack[NWJSONMaxDepth];
+    size_t depth = 0;
+    if (object && (p == end || *p != '{')) return 0;
+    for (;;) {
+        // scan one value
+        if (p == end) return 0;
+        switch (*p) {
+            case '{':
+            case '[': {
+                if (depth == NWJSONMaxDepth) return 0;
+                char open = *p;
+                stack[depth++] = open;
+                p = NWJSONSkipSpace(p + 1, end);
+                if (p < end && *p == (open == '{' ? '}' : ']')) {
+                    depth--;
+                    p++;
+                    break;
+                }
+                if (open == '{') {
+                    p = NWJSONScanKey(p, end);
+                    if (!p) return 0;
+                }
+                continue;
+            }
+            case '"': p = NWJSONScanString(p + 1, end); break;
+            case 't': p = NWJSONScanLiteral(p, end, "true", 4); break;
+            case 'f': p = NWJSONScanLiteral(p, end, "false", 5); break;
+            case 'n': p = NWJSONScanLiteral(p, end, "null", 4); break;
+            default: p = NWJSONScanNumber(p, end); break;
+        }
+        if (!p) return 0;
+        // close containers or move to the next element
+        for (p = NWJSONSkipSpace(p, end);; p = NWJSONSkipSpace(p + 1, end)) {
+            if (!depth) return p == end;
+            if (p == end) return 0;
+            if (*p != (stack[depth - 1] == '{' ? '}' : ']')) break;
+            depth--;
+        }
+        if (*p != ',') return 0;
+        p = NWJSONSkipSpace(p + 1, end);
+        if (stack[depth - 1] == '{') {
+            p = NWJSONScanKey(p, end);
+            if (!p) return 0;
+        }
+    }
+}
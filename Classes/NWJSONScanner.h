@@ -0,0 +1,27 @@
+//
+//  NWJSONScanner.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef _NWJSONSCANNER_H_
+#define _NWJSONSCANNER_H_
+
+/** Maximum nesting of objects and arrays accepted by the scanner. */
+#define NWJSONMaxDepth 64
+
+/** Returns true if the bytes form a single well-formed JSON value, without building any objects. If object is true, this value must be an object. Does not validate UTF-8 sequences. */
+extern int NWJSONValidate(const char *bytes, size_t length, int object);
+
+#endif // _NWJSONSCANNER_H_
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
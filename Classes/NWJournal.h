@@ -0,0 +1,84 @@
+//
+//  NWJournal.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+@class NWNotification;
+
+/** Keeps a crash-safe record of the notifications written to the server, so a broadcast can resume after a restart.
+
+ The journal is a memory-mapped file holding a ring of serialized frames, each with its identifier and the time it was written. Two watermarks are kept in the file header. The write watermark moves past every frame appended. The acknowledge watermark moves past frames the server has accepted, either because it reported an error on a later frame or because the error window (`feedbackSpan` of `NWHub`) has passed. Frames between the two watermarks are unconfirmed and can be sent again.
+
+ Appending is a copy into the mapped file, without system calls. The file survives the process, so after a crash the unconfirmed frames are still there; they are flushed to disk by the system, or by `flush` and `synchronize` to survive power loss as well. Reopening the same path picks up where the journal left off.
+
+ The journal is not thread-safe, `NWHub` uses it under its own lock.
+ */
+@interface NWJournal : NSObject
+
+/** @name Properties */
+
+/** The path of the journal file. */
+@property (nonatomic, readonly) NSString *path;
+
+/** The number of bytes available for frames. */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/** The number of unconfirmed frames. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** The identifier of the last frame appended, or 0 if none. */
+@property (nonatomic, readonly) NSUInteger writtenIdentifier;
+
+/** The identifier of the last frame confirmed, or 0 if none. */
+@property (nonatomic, readonly) NSUInteger acknowledgedIdentifier;
+
+/** @name Initialization */
+
+/** Open the journal at path, creating it with room for capacity bytes of frames if it does not exist. An existing journal keeps its capacity and contents, up to the first entry that is torn or corrupt. */
++ (instancetype)journalWithPath:(NSString *)path capacity:(NSUInteger)capacity error:(NSError **)error;
+
+/** Open the journal at path, see `journalWithPath:capacity:error:`. */
+- (BOOL)openWithPath:(NSString *)path capacity:(NSUInteger)capacity error:(NSError **)error;
+
+/** Unmap and close the journal file. */
+- (void)close;
+
+/** Flush the journal to disk, returns after it has been written. */
+- (BOOL)synchronize;
+
+/** Start writing the header and the frames changed since the last flush to disk, without waiting for it. */
+- (BOOL)flush;
+
+/** @name Appending */
+
+/** Serialize the notification straight into the journal. Returns `NO` with `kNWErrorJournalFull` if there is no room before the acknowledge watermark. */
+- (BOOL)appendNotification:(NWNotification *)notification type:(NWNotificationType)type error:(NSError **)error;
+
+/** Append a serialized frame with its identifier. Returns `NO` with `kNWErrorJournalFull` if there is no room before the acknowledge watermark. */
+- (BOOL)appendFrame:(NSData *)frame identifier:(NSUInteger)identifier error:(NSError **)error;
+
+/** @name Acknowledging */
+
+/** Confirm all frames up to and including the one with this identifier, taking wraparound into account. Returns the number of frames confirmed. */
+- (NSUInteger)acknowledgeThroughIdentifier:(NSUInteger)identifier;
+
+/** Confirm all frames appended more than span seconds ago. Returns the number of frames confirmed. */
+- (NSUInteger)acknowledgeFramesOlderThan:(NSTimeInterval)span;
+
+/** @name Replaying */
+
+/** Calls block with a copy of every unconfirmed frame and its identifier, oldest first. */
+- (void)enumerateUnacknowledgedFramesUsingBlock:(void(^)(NSData *frame, NSUInteger identifier, BOOL *stop))block;
+
+/** Restart the error window of the unconfirmed frames up to and including the one with this identifier, after sending them again. Returns the number of frames renewed. */
+- (NSUInteger)renewFramesThroughIdentifier:(NSUInteger)identifier;
+
+/** Move the write watermark back to the acknowledge watermark, dropping all unconfirmed frames. */
+- (void)removeUnacknowledgedFrames;
+
+@end
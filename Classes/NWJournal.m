@@ -0,0 +1,334 @@
+//
+//  NWJournal.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWJournal.h"
+#import "NWNotification.h"
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static char const NWJournalMagic[8] = "NWJRNL01";
+static NSUInteger const NWJournalHeaderSize = 4096;
+static NSUInteger const NWJournalMinCapacity = 64 * 1024;
+static uint32_t const NWJournalWrap = UINT32_MAX;
+
+// The file starts with this header, followed by the ring of entries. Positions are absolute byte counts, taken modulo capacity.
+typedef struct {
+    char magic[8];
+    uint64_t capacity;
+    uint64_t head;
+    uint64_t tail;
+    uint32_t written;
+    uint32_t acknowledged;
+} NWJournalHeader;
+
+// A frame in the ring, followed by its bytes and padded to 8 bytes. A length of NWJournalWrap marks the rest of the ring unused.
+typedef struct {
+    uint32_t length;
+    uint32_t identifier;
+    double time;
+} NWJournalEntry;
+
+static inline uint64_t NWJournalEntrySize(NSUInteger length)
+{
+    return (sizeof(NWJournalEntry) + length + 7) & ~(uint64_t)7;
+}
+
+@implementation NWJournal {
+    int _fd;
+    NWJournalHeader *_header;
+    char *_entries;
+    size_t _size;
+    uint64_t _reserved;
+    uint64_t _dirty;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _fd = -1;
+        _dirty = UINT64_MAX;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self close];
+}
+
++ (instancetype)journalWithPath:(NSString *)path capacity:(NSUInteger)capacity error:(NSError *__autoreleasing *)error
+{
+    NWJournal *journal = [[NWJournal alloc] init];
+    return [journal openWithPath:path capacity:capacity error:error] ? journal : nil;
+}
+
+- (BOOL)openWithPath:(NSString *)path capacity:(NSUInteger)capacity error:(NSError *__autoreleasing *)error
+{
+    [self close];
+    capacity = MAX((capacity + 7) & ~(NSUInteger)7, NWJournalMinCapacity);
+    int fd = open(path.fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorJournalOpen reason:errno error:error];
+    }
+    NWJournalHeader header;
+    struct stat st;
+    BOOL valid = !fstat(fd, &st) && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && !memcmp(header.magic, NWJournalMagic, sizeof(header.magic)) && header.capacity && header.capacity % 8 == 0
+        && st.st_size == (off_t)(NWJournalHeaderSize + header.capacity) && header.tail <= header.head && header.head - header.tail <= header.capacity;
+    if (valid) {
+        capacity = (NSUInteger)header.capacity;
+    } else if (ftruncate(fd, 0) || ftruncate(fd, NWJournalHeaderSize + capacity)) {
+        int reason = errno;
+        close(fd);
+        return [NWErrorUtil noWithErrorCode:kNWErrorJournalOpen reason:reason error:error];
+    }
+    size_t size = NWJournalHeaderSize + capacity;
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        int reason = errno;
+        close(fd);
+        return [NWErrorUtil noWithErrorCode:kNWErrorJournalOpen reason:reason error:error];
+    }
+    _fd = fd;
+    _size = size;
+    _header = base;
+    _entries = (char *)base + NWJournalHeaderSize;
+    _path = path;
+    _capacity = capacity;
+    if (!valid) {
+        _header->capacity = capacity;
+        atomic_thread_fence(memory_order_release);
+        memcpy(_header->magic, NWJournalMagic, sizeof(_header->magic));
+    }
+    _count = 0;
+    uint64_t position = _header->tail;
+    for (NWJournalEntry *entry = [self entryAtPosition:&position]; entry; entry = [self entryAtPosition:&position]) {
+        // an entry torn by a crash or a corrupt file ends the journal, the frames after it cannot be trusted
+        uint64_t room = _capacity - position % _capacity;
+        if (entry->length > room || NWJournalEntrySize(entry->length) > room || position + NWJournalEntrySize(entry->length) > _header->head) {
+            _header->head = position;
+            break;
+        }
+        position += NWJournalEntrySize(entry->length);
+        _header->written = entry->identifier;
+        _count++;
+    }
+    return YES;
+}
+
+- (void)close
+{
+    if (_header) munmap(_header, _size);
+    if (_fd >= 0) close(_fd);
+    _header = NULL;
+    _entries = NULL;
+    _fd = -1;
+    _count = 0;
+    _dirty = UINT64_MAX;
+}
+
+- (BOOL)synchronize
+{
+    _dirty = UINT64_MAX;
+    return _header && !msync(_header, _size, MS_SYNC);
+}
+
+- (BOOL)flush
+{
+    if (!_header) {
+        return NO;
+    }
+    BOOL flushed = !msync(_header, NWJournalHeaderSize, MS_ASYNC);
+    uint64_t head = _header->head;
+    if (_dirty < head) {
+        uint64_t length = MIN(head - _dirty, (uint64_t)_capacity);
+        uint64_t offset = _dirty % _capacity;
+        uint64_t first = MIN(length, _capacity - offset);
+        flushed = [self flushEntriesAtOffset:offset length:first] && flushed;
+        if (length > first) flushed = [self flushEntriesAtOffset:0 length:length - first] && flushed;
+    }
+    _dirty = UINT64_MAX;
+    return flushed;
+}
+
+- (BOOL)flushEntriesAtOffset:(uint64_t)offset length:(uint64_t)length
+{
+    uintptr_t page = (uintptr_t)getpagesize();
+    uintptr_t start = (uintptr_t)(_entries + offset) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(_entries + offset + length);
+    return !msync((void *)start, end - start, MS_ASYNC);
+}
+
+- (NSUInteger)writtenIdentifier
+{
+    return _header ? _header->written : 0;
+}
+
+- (NSUInteger)acknowledgedIdentifier
+{
+    return _header ? _header->acknowledged : 0;
+}
+
+#pragma mark - Appending
+
+- (BOOL)appendNotification:(NWNotification *)notification type:(NWNotificationType)type error:(NSError *__autoreleasing *)error
+{
+    NSUInteger length = [notification lengthWithType:type];
+    NWJournalEntry *entry = [self reserveLength:length error:error];
+    if (!entry) {
+        return NO;
+    }
+    if (![notification getBytes:entry + 1 length:length type:type error:error]) {
+        return NO;
+    }
+    [self commitEntry:entry length:length identifier:notification.identifier];
+    return YES;
+}
+
+- (BOOL)appendFrame:(NSData *)frame identifier:(NSUInteger)identifier error:(NSError *__autoreleasing *)error
+{
+    NWJournalEntry *entry = [self reserveLength:frame.length error:error];
+    if (!entry) {
+        return NO;
+    }
+    memcpy(entry + 1, frame.bytes, frame.length);
+    [self commitEntry:entry length:frame.length identifier:identifier];
+    return YES;
+}
+
+- (NWJournalEntry *)reserveLength:(NSUInteger)length error:(NSError *__autoreleasing *)error
+{
+    if (!_header) {
+        [NWErrorUtil noWithErrorCode:kNWErrorJournalOpen error:error];
+        return NULL;
+    }
+    uint64_t size = NWJournalEntrySize(length);
+    uint64_t head = _header->head;
+    uint64_t offset = head % _capacity;
+    uint64_t skip = _capacity - offset < size ? _capacity - offset : 0;
+    if (length >= NWJournalWrap || head + skip + size - _header->tail > _capacity) {
+        [NWErrorUtil noWithErrorCode:kNWErrorJournalFull error:error];
+        return NULL;
+    }
+    _dirty = MIN(_dirty, head);
+    if (skip) {
+        *(uint32_t *)(_entries + offset) = NWJournalWrap;
+        _header->head = head + skip;
+    }
+    _reserved = head + skip;
+    return (NWJournalEntry *)(_entries + _reserved % _capacity);
+}
+
+- (void)commitEntry:(NWJournalEntry *)entry length:(NSUInteger)length identifier:(NSUInteger)identifier
+{
+    entry->length = (uint32_t)length;
+    entry->identifier = (uint32_t)identifier;
+    entry->time = CFAbsoluteTimeGetCurrent();
+    // the entry is complete before the watermark passes it, also when the process dies in between
+    atomic_thread_fence(memory_order_release);
+    _header->head = _reserved + NWJournalEntrySize(length);
+    _header->written = (uint32_t)identifier;
+    _count++;
+}
+
+#pragma mark - Acknowledging
+
+// Returns the entry at position, skipping the unused end of the ring, or NULL at the write watermark.
+- (NWJournalEntry *)entryAtPosition:(uint64_t *)position
+{
+    while (*position < _header->head) {
+        uint64_t offset = *position % _capacity;
+        NWJournalEntry *entry = (NWJournalEntry *)(_entries + offset);
+        if (_capacity - offset < sizeof(NWJournalEntry) || entry->length == NWJournalWrap) {
+            *position += _capacity - offset;
+            continue;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+- (NSUInteger)acknowledgeWhile:(BOOL(^)(NWJournalEntry *entry))condition
+{
+    if (!_header) {
+        return 0;
+    }
+    NSUInteger result = 0;
+    uint64_t position = _header->tail;
+    for (NWJournalEntry *entry = [self entryAtPosition:&position]; entry && condition(entry); entry = [self entryAtPosition:&position]) {
+        position += NWJournalEntrySize(entry->length);
+        _header->acknowledged = entry->identifier;
+        result++;
+    }
+    if (result) {
+        _header->tail = position;
+        _count -= result;
+    }
+    return result;
+}
+
+- (NSUInteger)acknowledgeThroughIdentifier:(NSUInteger)identifier
+{
+    return [self acknowledgeWhile:^BOOL(NWJournalEntry *entry) {
+        return (int32_t)(entry->identifier - (uint32_t)identifier) <= 0;
+    }];
+}
+
+- (NSUInteger)acknowledgeFramesOlderThan:(NSTimeInterval)span
+{
+    CFAbsoluteTime limit = CFAbsoluteTimeGetCurrent() - span;
+    return [self acknowledgeWhile:^BOOL(NWJournalEntry *entry) {
+        return entry->time < limit;
+    }];
+}
+
+#pragma mark - Replaying
+
+- (void)enumerateUnacknowledgedFramesUsingBlock:(void(^)(NSData *frame, NSUInteger identifier, BOOL *stop))block
+{
+    if (!_header) {
+        return;
+    }
+    BOOL stop = NO;
+    uint64_t position = _header->tail;
+    for (NWJournalEntry *entry = [self entryAtPosition:&position]; entry && !stop; entry = [self entryAtPosition:&position]) {
+        position += NWJournalEntrySize(entry->length);
+        block([NSData dataWithBytes:entry + 1 length:entry->length], entry->identifier, &stop);
+    }
+}
+
+- (NSUInteger)renewFramesThroughIdentifier:(NSUInteger)identifier
+{
+    if (!_header) {
+        return 0;
+    }
+    NSUInteger result = 0;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    uint64_t position = _header->tail;
+    for (NWJournalEntry *entry = [self entryAtPosition:&position]; entry && (int32_t)(entry->identifier - (uint32_t)identifier) <= 0; entry = [self entryAtPosition:&position]) {
+        _dirty = MIN(_dirty, position);
+        entry->time = now;
+        position += NWJournalEntrySize(entry->length);
+        result++;
+    }
+    return result;
+}
+
+- (void)removeUnacknowledgedFrames
+{
+    if (_header) {
+        _header->head = _header->tail;
+        _count = 0;
+    }
+}
+
+@end
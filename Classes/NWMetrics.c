@@ -0,0 +1,202 @@
+//
+//  NWMetrics.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWMetrics.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif // __APPLE__
+
+#define NWMetricsStripeCount 16
+#define NWHistogramStripeCount 8
+
+// Every thread sticks to one stripe, so threads rarely write to the same cache line.
+typedef struct {
+    _Alignas(64) _Atomic(uint64_t) values[kNWMetricCount];
+} NWMetricsStripe;
+
+typedef struct {
+    _Alignas(64) _Atomic(uint64_t) count;
+    _Atomic(uint64_t) sum;
+    _Atomic(uint64_t) max;
+    _Atomic(uint64_t) buckets[NWHistogramBucketCount];
+} NWHistogramStripe;
+
+static NWMetricsStripe NWMetricsStripes[NWMetricsStripeCount];
+static NWHistogramStripe NWHistogramStripes[kNWHistogramCount][NWHistogramStripeCount];
+static _Atomic(uint64_t) NWMetricsReconnectCodes[NWMetricsErrorCodeCount];
+
+static const char *NWMetricNames[kNWMetricCount] = {
+    "writes_total", "write_bytes_total", "handshakes_total", "reconnects_total", "error_responses_total", "in_flight", "tracker_evictions_total",
+};
+
+static const char *NWHistogramNames[kNWHistogramCount] = {
+    "serialize_ns", "write_ns", "write_bytes", "handshake_ns", "error_response_ns",
+};
+
+
+#pragma mark - Helpers
+
+// A hash of the thread handle, as thread-local storage is not available on iOS before 9.
+static inline unsigned NWMetricsThread(void) {
+    uint64_t thread = (uint64_t)(uintptr_t)pthread_self();
+    return (unsigned)((thread * 0x9E3779B97F4A7C15ULL) >> 40);
+}
+
+static inline size_t NWHistogramIndex(uint64_t value) {
+    if (value < 8) return (size_t)value;
+    unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+    return (size_t)(exponent - 2) * 8 + ((value >> (exponent - 3)) & 7);
+}
+
+static inline size_t NWMetricsCodeIndex(long code) {
+    unsigned long index = code < 0 ? -(unsigned long)code : (unsigned long)code;
+    return index < NWMetricsErrorCodeCount ? (size_t)index : NWMetricsErrorCodeCount - 1;
+}
+
+uint64_t NWMetricsNow(void) {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t info;
+    if (!info.denom) mach_timebase_info(&info);
+    return mach_absolute_time() * info.numer / info.denom;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+#endif // __APPLE__
+}
+
+
+#pragma mark - Counters
+
+void NWMetricsAdd(NWMetric metric, int64_t delta) {
+    atomic_fetch_add_explicit(&NWMetricsStripes[NWMetricsThread() % NWMetricsStripeCount].values[metric], (uint64_t)delta, memory_order_relaxed);
+}
+
+int64_t NWMetricsValue(NWMetric metric) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < NWMetricsStripeCount; i++) {
+        result += atomic_load_explicit(&NWMetricsStripes[i].values[metric], memory_order_relaxed);
+    }
+    return (int64_t)result;
+}
+
+void NWMetricsAddReconnect(long code) {
+    NWMetricsAdd(kNWMetricReconnects, 1);
+    atomic_fetch_add_explicit(&NWMetricsReconnectCodes[NWMetricsCodeIndex(code)], 1, memory_order_relaxed);
+}
+
+uint64_t NWMetricsReconnectsWithCode(long code) {
+    return atomic_load_explicit(&NWMetricsReconnectCodes[NWMetricsCodeIndex(code)], memory_order_relaxed);
+}
+
+
+#pragma mark - Histograms
+
+void NWHistogramRecord(NWHistogram histogram, uint64_t value) {
+    NWHistogramStripe *stripe = &NWHistogramStripes[histogram][NWMetricsThread() % NWHistogramStripeCount];
+    atomic_fetch_add_explicit(&stripe->buckets[NWHistogramIndex(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stripe->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stripe->count, 1, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&stripe->max, memory_order_relaxed);
+    while (value > max && !atomic_compare_exchange_weak_explicit(&stripe->max, &max, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+void NWHistogramGetSnapshot(NWHistogram histogram, NWHistogramSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(NWHistogramSnapshot));
+    for (size_t s = 0; s < NWHistogramStripeCount; s++) {
+        NWHistogramStripe *stripe = &NWHistogramStripes[histogram][s];
+        snapshot->count += atomic_load_explicit(&stripe->count, memory_order_relaxed);
+        snapshot->sum += atomic_load_explicit(&stripe->sum, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&stripe->max, memory_order_relaxed);
+        if (max > snapshot->max) snapshot->max = max;
+        for (size_t i = 0; i < NWHistogramBucketCount; i++) {
+            snapshot->buckets[i] += atomic_load_explicit(&stripe->buckets[i], memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t NWHistogramBucketValue(size_t index) {
+    if (index < 8) return index;
+    unsigned exponent = (unsigned)(index / 8) + 2;
+    return (uint64_t)(8 + index % 8) << (exponent - 3);
+}
+
+uint64_t NWHistogramPercentile(const NWHistogramSnapshot *snapshot, double percentile) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < NWHistogramBucketCount; i++) total += snapshot->buckets[i];
+    if (!total) return 0;
+    uint64_t rank = (uint64_t)(percentile / 100 * total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NWHistogramBucketCount; i++) {
+        seen += snapshot->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = i + 1 < NWHistogramBucketCount ? NWHistogramBucketValue(i + 1) - 1 : UINT64_MAX;
+            return upper < snapshot->max ? upper : snapshot->max;
+        }
+    }
+    return snapshot->max;
+}
+
+
+#pragma mark - Exporting
+
+static void NWMetricsAppend(char *buffer, size_t length, size_t *offset, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(*offset < length ? buffer + *offset : NULL, *offset < length ? length - *offset : 0, format, args);
+    va_end(args);
+    if (n > 0) *offset += (size_t)n;
+}
+
+size_t NWMetricsExport(char *buffer, size_t length) {
+    size_t offset = 0;
+    if (length) buffer[0] = '\0';
+    for (int m = 0; m < kNWMetricCount; m++) {
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s %lld\n", NWMetricNames[m], (long long)NWMetricsValue((NWMetric)m));
+    }
+    for (size_t i = 0; i < NWMetricsErrorCodeCount; i++) {
+        uint64_t count = atomic_load_explicit(&NWMetricsReconnectCodes[i], memory_order_relaxed);
+        if (count) NWMetricsAppend(buffer, length, &offset, "nwpusher_reconnects_total{code=\"-%zu\"} %llu\n", i, (unsigned long long)count);
+    }
+    NWHistogramSnapshot snapshot;
+    for (int h = 0; h < kNWHistogramCount; h++) {
+        NWHistogramGetSnapshot((NWHistogram)h, &snapshot);
+        const char *name = NWHistogramNames[h];
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s{quantile=\"0.5\"} %llu\n", name, (unsigned long long)NWHistogramPercentile(&snapshot, 50));
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s{quantile=\"0.9\"} %llu\n", name, (unsigned long long)NWHistogramPercentile(&snapshot, 90));
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s{quantile=\"0.99\"} %llu\n", name, (unsigned long long)NWHistogramPercentile(&snapshot, 99));
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s_max %llu\n", name, (unsigned long long)snapshot.max);
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s_sum %llu\n", name, (unsigned long long)snapshot.sum);
+        NWMetricsAppend(buffer, length, &offset, "nwpusher_%s_count %llu\n", name, (unsigned long long)snapshot.count);
+    }
+    return offset;
+}
+
+void NWMetricsReset(void) {
+    for (size_t i = 0; i < NWMetricsStripeCount; i++) {
+        for (int m = 0; m < kNWMetricCount; m++) atomic_store_explicit(&NWMetricsStripes[i].values[m], 0, memory_order_relaxed);
+    }
+    for (int h = 0; h < kNWHistogramCount; h++) {
+        for (size_t s = 0; s < NWHistogramStripeCount; s++) {
+            NWHistogramStripe *stripe = &NWHistogramStripes[h][s];
+            atomic_store_explicit(&stripe->count, 0, memory_order_relaxed);
+            atomic_store_explicit(&stripe->sum, 0, memory_order_relaxed);
+            atomic_store_explicit(&stripe->max, 0, memory_order_relaxed);
+            for (size_t i = 0; i < NWHistogramBucketCount; i++) atomic_store_explicit(&stripe->buckets[i], 0, memory_order_relaxed);
+        }
+    }
+    for (size_t i = 0; i < NWMetricsErrorCodeCount; i++) atomic_store_explicit(&NWMetricsReconnectCodes[i], 0, memory_order_relaxed);
+}
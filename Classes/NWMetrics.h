@@ -0,0 +1,103 @@
+//
+//  NWMetrics.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef _NWMETRICS_H_
+#define _NWMETRICS_H_
+
+/** Number of buckets in a histogram: values below 8 exactly, above that 8 buckets per power of two (within 12.5%). */
+#define NWHistogramBucketCount 496
+
+/** Error codes beyond this magnitude are counted together with the last one. */
+#define NWMetricsErrorCodeCount 512
+
+/** Counters and gauges of the push pipeline, summed over all threads. */
+typedef enum {
+    /** Number of calls to SSLWrite. */
+    kNWMetricWrites = 0,
+    /** Number of bytes accepted by SSLWrite. */
+    kNWMetricWriteBytes,
+    /** Number of TLS handshakes completed. */
+    kNWMetricHandshakes,
+    /** Number of reconnects after an error, see NWMetricsReconnectsWithCode for a breakdown. */
+    kNWMetricReconnects,
+    /** Number of error responses read from the server. */
+    kNWMetricErrorResponses,
+    /** Gauge: number of pushed notifications tracked for error responses. */
+    kNWMetricInFlight,
+    /** Number of in-flight notifications dropped because the tracker was full, these can no longer be matched to error responses. */
+    kNWMetricTrackerEvictions,
+    kNWMetricCount,
+} NWMetric;
+
+/** Latency and size distributions of the push pipeline, in nanoseconds unless noted otherwise. */
+typedef enum {
+    /** Time spent serializing a batch of notifications. */
+    kNWHistogramSerialize = 0,
+    /** Time spent in a single SSLWrite. */
+    kNWHistogramWrite,
+    /** Bytes accepted by a single SSLWrite. */
+    kNWHistogramWriteSize,
+    /** Time spent on a TLS handshake. */
+    kNWHistogramHandshake,
+    /** Time between pushing a notification and reading its error response. */
+    kNWHistogramErrorResponse,
+    kNWHistogramCount,
+} NWHistogram;
+
+/** A histogram summed over all threads, filled by NWHistogramGetSnapshot. */
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[NWHistogramBucketCount];
+} NWHistogramSnapshot;
+
+/** Monotonic time in nanoseconds, for measuring durations. */
+extern uint64_t NWMetricsNow(void);
+
+/** Adds delta to a counter or gauge, lock-free and without contention between threads. */
+extern void NWMetricsAdd(NWMetric metric, int64_t delta);
+
+/** Returns the current value of a counter or gauge. */
+extern int64_t NWMetricsValue(NWMetric metric);
+
+/** Counts a reconnect caused by the error code (an NWError). */
+extern void NWMetricsAddReconnect(long code);
+
+/** Returns the number of reconnects caused by the error code. */
+extern uint64_t NWMetricsReconnectsWithCode(long code);
+
+/** Records a value in a histogram, lock-free and without contention between threads. */
+extern void NWHistogramRecord(NWHistogram histogram, uint64_t value);
+
+/** Fills snapshot with the current state of the histogram, without allocating. */
+extern void NWHistogramGetSnapshot(NWHistogram histogram, NWHistogramSnapshot *snapshot);
+
+/** Returns the value below which percentile (0-100) percent of the values in snapshot fall, within bucket precision. */
+extern uint64_t NWHistogramPercentile(const NWHistogramSnapshot *snapshot, double percentile);
+
+/** Returns the lowest value counted in bucket index. */
+extern uint64_t NWHistogramBucketValue(size_t index);
+
+/** Writes all metrics as text, one `name value` line each, into buffer. Returns the full length of the text, which is truncated if it does not fit length, but always null-terminated. */
+extern size_t NWMetricsExport(char *buffer, size_t length);
+
+/** Sets all counters, gauges and histograms to zero. */
+extern void NWMetricsReset(void);
+
+#endif // _NWMETRICS_H_
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
@@ -62,6 +62,29 @@
 /** Serialize this notification using provided format. */
 - (NSData *)dataWithType:(NWNotificationType)type;
 
+/** The exact number of bytes this notification serializes into using provided format. */
+- (NSUInteger)lengthWithType:(NWNotificationType)type;
+
+/** Serialize this notification into a caller-provided buffer, without allocating.
+ 
+ Returns the number of bytes written, which equals `lengthWithType:`. Returns zero if the buffer is too small to hold the frame (`kNWErrorPushBufferSize`) or if the token or payload does not fit the 16-bit length field of the format (`kNWErrorPushInvalidPayload`), in which case nothing is written.
+ */
+- (NSUInteger)getBytes:(void *)buffer length:(NSUInteger)length type:(NWNotificationType)type error:(NSError **)error;
+
+/** Byte offset of the device token in the frame serialized using provided format, or `NSNotFound` if there is no token. */
+- (NSUInteger)tokenOffsetWithType:(NWNotificationType)type;
+
+/** Byte offset of the 4-byte identifier in the frame serialized using provided format, or `NSNotFound` if the frame has no identifier. */
+- (NSUInteger)identifierOffsetWithType:(NWNotificationType)type;
+
+/** @name Validation */
+
+/** Check locally whether the server would accept this notification in the provided format, before any bytes are written.
+ 
+ Checks the token size, the payload size limit of the format (256 bytes for the simple and enhanced formats, 2 KB for the item-based format) and whether the payload is a well-formed JSON object. Returns `NO` with the `kNWErrorAPN*` code the server would have responded with, or `kNWErrorPushInvalidPayload` for malformed JSON.
+ */
+- (BOOL)validateWithType:(NWNotificationType)type error:(NSError **)error;
+
 /** @name Helpers */
 
 /** Converts a hex string into binary data. */
@@ -70,4 +93,7 @@
 /** Converts binary data into a hex string. */
 + (NSString *)hexFromData:(NSData *)data;
 
+/** Converts an array of 64-character hex token strings into 32-byte token data, in one batch. Strings that are not exactly 64 hex characters result in `NSNull`. */
++ (NSArray *)dataFromHexes:(NSArray *)hexes;
+
 @end
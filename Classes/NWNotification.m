@@ -6,10 +6,13 @@
 //
 
 #import "NWNotification.h"
+#import "NWTokenCodec.h"
+#import "NWJSONScanner.h"
 
 
 static NSUInteger const NWDeviceTokenSize = 32;
 static NSUInteger const NWPayloadMaxSize = 256;
+static NSUInteger const NWPayloadMaxSize2 = 2048;
 
 @implementation NWNotification
 
@@ -59,6 +62,14 @@ static NSUInteger const NWPayloadMaxSize = 256;
 
 - (void)setToken:(NSString *)token
 {
+    const char *chars = token.length == NWDeviceTokenSize * 2 ? [token cStringUsingEncoding:NSASCIIStringEncoding] : NULL;
+    if (chars) {
+        NSMutableData *data = [[NSMutableData alloc] initWithLength:NWDeviceTokenSize];
+        if (NWHexDecode(chars, NWDeviceTokenSize, data.mutableBytes)) {
+            _tokenData = data;
+            return;
+        }
+    }
     if (token) {
         NSString *normal = [self.class filterHex:token];
         NSString *trunk = normal.length >= 64 ? [normal substringToIndex:64] : nil;
@@ -84,20 +95,27 @@ static NSUInteger const NWPayloadMaxSize = 256;
 
 + (NSString *)filterHex:(NSString *)hex
 {
-    hex = hex.lowercaseString;
-    NSMutableString *result = [[NSMutableString alloc] init];
-    for (NSUInteger i = 0; i < hex.length; i++) {
-        unichar c = [hex characterAtIndex:i];
-        if ((c >= 'a' && c <= 'f') || (c >= '0' && c <= '9')) {
-            [result appendString:[NSString stringWithCharacters:&c length:1]];
+    const char *chars = hex.UTF8String ?: "";
+    NSUInteger length = strlen(chars);
+    char *buffer = malloc(length + 1);
+    NSUInteger count = 0;
+    for (const char *c = chars, *end = chars + length; c != end; c++) {
+        char l = *c | 0x20;
+        if ((l >= 'a' && l <= 'f') || (*c >= '0' && *c <= '9')) {
+            buffer[count++] = *c >= '0' && *c <= '9' ? *c : l;
         }
     }
-    return result;
+    return [[NSString alloc] initWithBytesNoCopy:buffer length:count encoding:NSASCIIStringEncoding freeWhenDone:YES];
 }
 
 + (NSData *)dataFromHex:(NSString *)hex
 {
-    NSMutableData *result = [[NSMutableData alloc] init];
+    NSUInteger length = [hex lengthOfBytesUsingEncoding:NSASCIIStringEncoding] / 2;
+    NSMutableData *result = [[NSMutableData alloc] initWithLength:length];
+    if (length && NWHexDecode([hex cStringUsingEncoding:NSASCIIStringEncoding], length, result.mutableBytes)) {
+        return result;
+    }
+    result.length = 0;
     char buffer[3] = {'\0','\0','\0'};
     for (NSUInteger i = 0; i < hex.length / 2; i++) {
         buffer[0] = [hex characterAtIndex:i * 2];
@@ -110,114 +128,200 @@ static NSUInteger const NWPayloadMaxSize = 256;
 
 + (NSString *)hexFromData:(NSData *)data
 {
-    NSUInteger length = data.length;
-    NSMutableString *result = [NSMutableString stringWithCapacity:length * 2];
-    for (const unsigned char *b = data.bytes, *end = b + length; b != end; b++) {
-        [result appendFormat:@"%02X", *b];
+    NSUInteger length = data.length * 2;
+    char *buffer = malloc(length + 1);
+    NWHexEncode(data.bytes, data.length, buffer);
+    return [[NSString alloc] initWithBytesNoCopy:buffer length:length encoding:NSASCIIStringEncoding freeWhenDone:YES];
+}
+
++ (NSArray *)dataFromHexes:(NSArray *)hexes
+{
+    NSUInteger count = hexes.count;
+    NSUInteger stride = NWDeviceTokenSize * 2;
+    char *column = malloc(count * stride + 1);
+    uint8_t *valid = calloc(count, sizeof(uint8_t));
+    for (NSUInteger i = 0; i < count; i++) {
+        NSString *hex = hexes[i];
+        if (hex.length == stride && [hex getCString:column + i * stride maxLength:stride + 1 encoding:NSASCIIStringEncoding]) {
+            valid[i] = 1;
+        }
+    }
+    NSMutableData *tokens = [[NSMutableData alloc] initWithLength:count * NWDeviceTokenSize];
+    uint8_t *decoded = calloc(count, sizeof(uint8_t));
+    for (NSUInteger i = 0; i < count;) {
+        NSUInteger run = i;
+        while (run < count && valid[run]) run++;
+        NWHexDecodeTokens(column + i * stride, stride, run - i, (uint8_t *)tokens.mutableBytes + i * NWDeviceTokenSize, decoded + i);
+        i = run + 1;
     }
+    NSMutableArray *result = [[NSMutableArray alloc] initWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [result addObject:decoded[i] ? [tokens subdataWithRange:NSMakeRange(i * NWDeviceTokenSize, NWDeviceTokenSize)] : NSNull.null];
+    }
+    free(decoded);
+    free(valid);
+    free(column);
     return result;
 }
 
 
+#pragma mark - Validation
+
+- (BOOL)validateWithType:(NWNotificationType)type error:(NSError *__autoreleasing *)error
+{
+    if (!_tokenData.length) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorAPNMissingDeviceToken error:error];
+    }
+    if (_tokenData.length != NWDeviceTokenSize) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorAPNInvalidTokenSize reason:_tokenData.length error:error];
+    }
+    if (!_payloadData.length) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorAPNMissingPayload error:error];
+    }
+    NSUInteger max = type == kNWNotificationType2 ? NWPayloadMaxSize2 : NWPayloadMaxSize;
+    if (_payloadData.length > max) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorAPNInvalidPayloadSize reason:_payloadData.length error:error];
+    }
+    if (!NWJSONValidate(_payloadData.bytes, _payloadData.length, 1)) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorPushInvalidPayload error:error];
+    }
+    return YES;
+}
+
+
 #pragma mark - Types
 
+static NSUInteger const NWItemHeaderSize = sizeof(uint8_t) + sizeof(uint16_t);
+
+static inline char *NWAppendBytes(char *p, const void *bytes, NSUInteger length)
+{
+    if (length) memcpy(p, bytes, length);
+    return p + length;
+}
+
+static inline char *NWAppendUInt8(char *p, uint8_t value)
+{
+    return NWAppendBytes(p, &value, sizeof(uint8_t));
+}
+
+static inline char *NWAppendUInt16(char *p, uint16_t value)
+{
+    uint16_t v = htons(value);
+    return NWAppendBytes(p, &v, sizeof(uint16_t));
+}
+
+static inline char *NWAppendUInt32(char *p, uint32_t value)
+{
+    uint32_t v = htonl(value);
+    return NWAppendBytes(p, &v, sizeof(uint32_t));
+}
+
+static inline char *NWAppendItem(char *p, uint8_t identifier, const void *bytes, NSUInteger length)
+{
+    p = NWAppendUInt8(p, identifier);
+    p = NWAppendUInt16(p, length);
+    return NWAppendBytes(p, bytes, length);
+}
+
 - (NSData *)dataWithType:(NWNotificationType)type
 {
+    NSMutableData *result = [NSMutableData dataWithLength:[self lengthWithType:type]];
+    NSUInteger length = [self getBytes:result.mutableBytes length:result.length type:type error:nil];
+    return length ? result : nil;
+}
+
+- (NSUInteger)lengthWithType:(NWNotificationType)type
+{
+    NSUInteger token = _tokenData.length;
+    NSUInteger payload = _payloadData.length;
     switch (type) {
-        case kNWNotificationType0: return [self dataWithType0];
-        case kNWNotificationType1: return [self dataWithType1];
-        case kNWNotificationType2: return [self dataWithType2];
+        case kNWNotificationType0: return sizeof(uint8_t) + sizeof(uint16_t) + token + sizeof(uint16_t) + payload;
+        case kNWNotificationType1: return sizeof(uint8_t) + sizeof(uint32_t) * 2 + sizeof(uint16_t) + token + sizeof(uint16_t) + payload;
+        case kNWNotificationType2: {
+            NSUInteger result = sizeof(uint8_t) + sizeof(uint32_t);
+            if (_tokenData) result += NWItemHeaderSize + token;
+            if (_payloadData) result += NWItemHeaderSize + payload;
+            if ((uint32_t)_identifier) result += NWItemHeaderSize + sizeof(uint32_t);
+            if (_addExpiration) result += NWItemHeaderSize + sizeof(uint32_t);
+            if ((uint8_t)_priority) result += NWItemHeaderSize + sizeof(uint8_t);
+            return result;
+        }
     }
-    return nil;
+    return 0;
 }
 
-- (NSData *)dataWithType0
+- (NSUInteger)getBytes:(void *)buffer length:(NSUInteger)length type:(NWNotificationType)type error:(NSError *__autoreleasing *)error
 {
-    char buffer[sizeof(uint8_t) + sizeof(uint32_t) * 2 + sizeof(uint16_t) + NWDeviceTokenSize + sizeof(uint16_t) + NWPayloadMaxSize];
-    char *p = buffer;
-    
-    uint8_t command = 0;
-    memcpy(p, &command, sizeof(uint8_t));
-    p += sizeof(uint8_t);
-    
-    uint16_t tokenLength = htons(_tokenData.length);
-    memcpy(p, &tokenLength, sizeof(uint16_t));
-    p += sizeof(uint16_t);
-    
-    memcpy(p, _tokenData.bytes, _tokenData.length);
-    p += _tokenData.length;
-    
-    uint16_t payloadLength = htons(_payloadData.length);
-    memcpy(p, &payloadLength, sizeof(uint16_t));
-    p += sizeof(uint16_t);
-    
-    memcpy(p, _payloadData.bytes, _payloadData.length);
-    p += _payloadData.length;
-    
-    return [NSData dataWithBytes:buffer length:p - buffer];
-}
-
-- (NSData *)dataWithType1
-{
-    char buffer[sizeof(uint8_t) + sizeof(uint32_t) * 2 + sizeof(uint16_t) + NWDeviceTokenSize + sizeof(uint16_t) + NWPayloadMaxSize];
+    if (_tokenData.length > UINT16_MAX || _payloadData.length > UINT16_MAX) {
+        [NWErrorUtil noWithErrorCode:kNWErrorPushInvalidPayload reason:MAX(_tokenData.length, _payloadData.length) error:error];
+        return 0;
+    }
+    NSUInteger needed = [self lengthWithType:type];
+    if (!needed || needed > length) {
+        [NWErrorUtil noWithErrorCode:kNWErrorPushBufferSize reason:needed error:error];
+        return 0;
+    }
     char *p = buffer;
-    
-    uint8_t command = 1;
-    memcpy(p, &command, sizeof(uint8_t));
-    p += sizeof(uint8_t);
-    
-    uint32_t ID = htonl(_identifier);
-    memcpy(p, &ID, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    
-    uint32_t exp = htonl(_expirationStamp);
-    memcpy(p, &exp, sizeof(uint32_t));
-    p += sizeof(uint32_t);
-    
-    uint16_t tokenLength = htons(_tokenData.length);
-    memcpy(p, &tokenLength, sizeof(uint16_t));
-    p += sizeof(uint16_t);
-    
-    memcpy(p, _tokenData.bytes, _tokenData.length);
-    p += _tokenData.length;
-    
-    uint16_t payloadLength = htons(_payloadData.length);
-    memcpy(p, &payloadLength, sizeof(uint16_t));
-    p += sizeof(uint16_t);
-    
-    memcpy(p, _payloadData.bytes, _payloadData.length);
-    p += _payloadData.length;
-    
-    return [NSData dataWithBytes:buffer length:p - buffer];
-}
-
-- (NSData *)dataWithType2
-{
-    NSMutableData *result = [[NSMutableData alloc] initWithLength:5];
-    
-    if (_tokenData) [self.class appendTo:result identifier:1 bytes:_tokenData.bytes length:_tokenData.length];
-    if (_payloadData) [self.class appendTo:result identifier:2 bytes:_payloadData.bytes length:_payloadData.length];
-    uint32_t identifier = htonl(_identifier);
-    uint32_t expires = htonl(_expirationStamp);
-    uint8_t priority = _priority;
-    if (identifier) [self.class appendTo:result identifier:3 bytes:&identifier length:4];
-    if (_addExpiration) [self.class appendTo:result identifier:4 bytes:&expires length:4];
-    if (priority) [self.class appendTo:result identifier:5 bytes:&priority length:1];
-    uint8_t command = 2;
-    [result replaceBytesInRange:NSMakeRange(0, 1) withBytes:&command];
-    uint32_t length = htonl(result.length - 5);
-    [result replaceBytesInRange:NSMakeRange(1, 4) withBytes:&length];
-        
-    return result;
+    switch (type) {
+        case kNWNotificationType0: {
+            p = NWAppendUInt8(p, 0);
+            p = NWAppendUInt16(p, _tokenData.length);
+            p = NWAppendBytes(p, _tokenData.bytes, _tokenData.length);
+            p = NWAppendUInt16(p, _payloadData.length);
+            p = NWAppendBytes(p, _payloadData.bytes, _payloadData.length);
+        } break;
+        case kNWNotificationType1: {
+            p = NWAppendUInt8(p, 1);
+            p = NWAppendUInt32(p, (uint32_t)_identifier);
+            p = NWAppendUInt32(p, (uint32_t)_expirationStamp);
+            p = NWAppendUInt16(p, _tokenData.length);
+            p = NWAppendBytes(p, _tokenData.bytes, _tokenData.length);
+            p = NWAppendUInt16(p, _payloadData.length);
+            p = NWAppendBytes(p, _payloadData.bytes, _payloadData.length);
+        } break;
+        case kNWNotificationType2: {
+            uint32_t identifier = htonl(_identifier);
+            uint32_t expires = htonl(_expirationStamp);
+            uint8_t priority = _priority;
+            p = NWAppendUInt8(p, 2);
+            p = NWAppendUInt32(p, (uint32_t)(needed - sizeof(uint8_t) - sizeof(uint32_t)));
+            if (_tokenData) p = NWAppendItem(p, 1, _tokenData.bytes, _tokenData.length);
+            if (_payloadData) p = NWAppendItem(p, 2, _payloadData.bytes, _payloadData.length);
+            if (identifier) p = NWAppendItem(p, 3, &identifier, sizeof(uint32_t));
+            if (_addExpiration) p = NWAppendItem(p, 4, &expires, sizeof(uint32_t));
+            if (priority) p = NWAppendItem(p, 5, &priority, sizeof(uint8_t));
+        } break;
+    }
+    return p - (char *)buffer;
 }
 
-+ (void)appendTo:(NSMutableData *)buffer identifier:(NSUInteger)identifier bytes:(const void *)bytes length:(NSUInteger)length
+- (NSUInteger)tokenOffsetWithType:(NWNotificationType)type
 {
-    uint8_t i = identifier;
-    uint16_t l = htons(length);
-    [buffer appendBytes:&i length:1];
-    [buffer appendBytes:&l length:2];
-    [buffer appendBytes:bytes length:length];
+    if (!_tokenData) {
+        return NSNotFound;
+    }
+    switch (type) {
+        case kNWNotificationType0: return sizeof(uint8_t) + sizeof(uint16_t);
+        case kNWNotificationType1: return sizeof(uint8_t) + sizeof(uint32_t) * 2 + sizeof(uint16_t);
+        case kNWNotificationType2: return sizeof(uint8_t) + sizeof(uint32_t) + NWItemHeaderSize;
+    }
+    return NSNotFound;
+}
+
+- (NSUInteger)identifierOffsetWithType:(NWNotificationType)type
+{
+    switch (type) {
+        case kNWNotificationType0: break;
+        case kNWNotificationType1: return sizeof(uint8_t);
+        case kNWNotificationType2: {
+            if (!(uint32_t)_identifier) break;
+            NSUInteger result = sizeof(uint8_t) + sizeof(uint32_t);
+            if (_tokenData) result += NWItemHeaderSize + _tokenData.length;
+            if (_payloadData) result += NWItemHeaderSize + _payloadData.length;
+            return result + NWItemHeaderSize;
+        }
+    }
+    return NSNotFound;
 }
 
 @end
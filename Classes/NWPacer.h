@@ -0,0 +1,64 @@
+//
+//  NWPacer.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+@class NWSSLConnection;
+
+/** Adapts the size and timing of writes to how fast the connection drains.
+
+ After every write, the pacer looks at the number of bytes the kernel has not sent yet, relative to the size of the socket send buffer. While the buffer stays below `lowOccupancy`, the batch size grows by `minBatchSize` at a time. When it fills beyond `highOccupancy`, a write is partial, or the server responds with an error, the batch size is halved. Before writing, the pacer waits for the buffer to drain below `highOccupancy`, so a burst never has to be cut off halfway. It waits with `waitForWriteWithTimeout:`, with the `sendLowWatermark` of the connection set to the free space that takes.
+
+ Unsent bytes are read with `SO_NWRITE` on Darwin and `TIOCOUTQ` on Linux. Where neither is available, only partial writes and error responses shrink the batch.
+
+ Assign a pacer to `NWPusher` to enable it.
+ */
+@interface NWPacer : NSObject
+
+/** @name Properties */
+
+/** The number of bytes to pack into the next write. */
+@property (nonatomic, assign) NSUInteger batchSize;
+
+/** The smallest batch size, also the step by which it grows, defaults to 2 KB. */
+@property (nonatomic, assign) NSUInteger minBatchSize;
+
+/** The largest batch size, defaults to 64 KB. */
+@property (nonatomic, assign) NSUInteger maxBatchSize;
+
+/** The fraction of the send buffer below which the batch size grows, defaults to 0.25. */
+@property (nonatomic, assign) double lowOccupancy;
+
+/** The fraction of the send buffer above which the batch size shrinks and writes wait, defaults to 0.75. */
+@property (nonatomic, assign) double highOccupancy;
+
+/** @name Initialization */
+
+/** Create a pacer starting at batch size bytes. */
+- (instancetype)initWithBatchSize:(NSUInteger)batchSize;
+
+/** @name Pacing */
+
+/** Wait until the send buffer of the connection has drained below `highOccupancy`, at most the connection's `timeout`. */
+- (void)waitForConnection:(NWSSLConnection *)connection;
+
+/** Adjust the batch size after writing, given the number of bytes written out of the number of bytes offered. */
+- (void)connection:(NWSSLConnection *)connection didWriteLength:(NSUInteger)written ofLength:(NSUInteger)length;
+
+/** Shrink the batch size after the server responded with an error. */
+- (void)didReceiveErrorResponse;
+
+/** @name Statistics */
+
+/** Counters since the first write, with keys `written` (bytes), `writes`, `rate` (bytes per second), `batchSize`, `occupancy` (average fraction of send buffer in use after writing), `decreases` and `waited` (seconds). */
+- (NSDictionary *)statistics;
+
+/** Reset all counters. */
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,124 @@
+//
+//  NWPacer.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWPacer.h"
+#import "NWSSLConnection.h"
+
+
+static NSUInteger const NWPacerBatchSize = 16 * 1024;
+static NSUInteger const NWPacerMinBatchSize = 2 * 1024;
+static NSUInteger const NWPacerMaxBatchSize = 64 * 1024;
+static double const NWPacerLowOccupancy = 0.25;
+static double const NWPacerHighOccupancy = 0.75;
+static useconds_t const NWPacerSpinInterval = 1000;
+
+@implementation NWPacer {
+    NSTimeInterval _start;
+    NSUInteger _written;
+    NSUInteger _writes;
+    double _occupancy;
+    NSUInteger _samples;
+    NSUInteger _decreases;
+    NSTimeInterval _waited;
+}
+
+- (instancetype)init
+{
+    return [self initWithBatchSize:NWPacerBatchSize];
+}
+
+- (instancetype)initWithBatchSize:(NSUInteger)batchSize
+{
+    self = [super init];
+    if (self) {
+        _batchSize = batchSize;
+        _minBatchSize = NWPacerMinBatchSize;
+        _maxBatchSize = NWPacerMaxBatchSize;
+        _lowOccupancy = NWPacerLowOccupancy;
+        _highOccupancy = NWPacerHighOccupancy;
+    }
+    return self;
+}
+
+#pragma mark - Pacing
+
+- (void)waitForConnection:(NWSSLConnection *)connection
+{
+    NSInteger size = connection.sendBufferSize;
+    NSInteger limit = (NSInteger)(size * _highOccupancy);
+    if (size <= 0 || connection.unsentLength <= limit) {
+        return;
+    }
+    // the socket becomes writable once the buffer has drained below the limit, so waiting is a single poll
+    if (connection.sendLowWatermark != (NSUInteger)(size - limit)) connection.sendLowWatermark = (NSUInteger)(size - limit);
+    NSTimeInterval start = NSDate.timeIntervalSinceReferenceDate;
+    NSTimeInterval deadline = start + connection.timeout;
+    NSTimeInterval now = start;
+    while (connection.unsentLength > limit && now < deadline) {
+        // where the watermark is ignored (Linux), writable can still be above the limit, do not spin on it
+        if ([connection waitForWriteWithTimeout:deadline - now] && connection.unsentLength > limit) usleep(NWPacerSpinInterval);
+        now = NSDate.timeIntervalSinceReferenceDate;
+    }
+    @synchronized(self) {
+        _waited += now - start;
+    }
+}
+
+- (void)connection:(NWSSLConnection *)connection didWriteLength:(NSUInteger)written ofLength:(NSUInteger)length
+{
+    NSInteger size = connection.sendBufferSize;
+    NSInteger unsent = connection.unsentLength;
+    double occupancy = size > 0 && unsent >= 0 ? (double)unsent / size : -1;
+    @synchronized(self) {
+        if (!_start) _start = NSDate.timeIntervalSinceReferenceDate;
+        _written += written;
+        _writes++;
+        if (occupancy >= 0) {
+            _occupancy += occupancy;
+            _samples++;
+        }
+        if (written < length || occupancy > _highOccupancy) {
+            [self decrease];
+        } else if (occupancy < _lowOccupancy) {
+            _batchSize = MIN(_batchSize + _minBatchSize, _maxBatchSize);
+        }
+    }
+}
+
+- (void)didReceiveErrorResponse
+{
+    @synchronized(self) {
+        [self decrease];
+    }
+}
+
+- (void)decrease
+{
+    _batchSize = MAX(_batchSize / 2, _minBatchSize);
+    _decreases++;
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary *)statistics
+{
+    @synchronized(self) {
+        NSTimeInterval span = _start ? NSDate.timeIntervalSinceReferenceDate - _start : 0;
+        return @{@"written": @(_written), @"writes": @(_writes), @"rate": @(span > 0 ? _written / span : 0), @"batchSize": @(_batchSize), @"occupancy": @(_samples ? _occupancy / _samples : 0), @"decreases": @(_decreases), @"waited": @(_waited)};
+    }
+}
+
+- (void)resetStatistics
+{
+    @synchronized(self) {
+        _start = 0;
+        _written = _writes = _samples = _decreases = 0;
+        _occupancy = _waited = 0;
+    }
+}
+
+@end
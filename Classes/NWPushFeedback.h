@@ -10,6 +10,14 @@
 
 @class NWSSLConnection;
 
+/** A single entry of the feedback service, in host byte order. */
+typedef struct {
+    /** Time the device stopped accepting notifications, in seconds since 1970. */
+    uint32_t timestamp;
+    /** The binary device token. */
+    uint8_t token[32];
+} NWFeedbackTuple;
+
 /** Reads tokens and dates from the APNs feedback service.
  
  The feedback service is a separate server that provides a list of all device tokens that it tried to deliver a notification to, but was unable to. This usually indicates that this device no longer has the app installed. This way, the feedback service provides reliable way of finding out who uninstalled the app, which can be fed back into your database.
@@ -54,6 +62,12 @@
 /** Read all (or max) token-date pairs, where token is hex string. */
 - (NSArray *)readTokenDatePairsWithMax:(NSUInteger)max error:(NSError **)error;
 
+/** Stream all (or max) entries into the handler, in batches.
+ 
+ Reads large chunks from the connection and parses them in place, without creating objects per entry. The tuples pointer is only valid during the call to the handler. Returns when the server closes the connection, max entries have been read or no data arrived within the connection timeout.
+ */
+- (BOOL)readTuplesWithMax:(NSUInteger)max handler:(void(^)(const NWFeedbackTuple *tuples, NSUInteger count))handler error:(NSError **)error;
+
 // deprecated
 
 + (instancetype)connectWithIdentity:(NWIdentityRef)identity error:(NSError **)error __deprecated;
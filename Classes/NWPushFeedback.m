@@ -9,20 +9,34 @@
 #import "NWSSLConnection.h"
 #import "NWSecTools.h"
 #import "NWNotification.h"
+#import "NWTokenCodec.h"
 
 
 static NSString * const NWSandboxPushHost = @"feedback.sandbox.push.apple.com";
 static NSString * const NWPushHost = @"feedback.push.apple.com";
 static NSUInteger const NWPushPort = 2196;
 static NSUInteger const NWTokenMaxSize = 32;
+static NSUInteger const NWTupleSize = sizeof(uint32_t) + sizeof(uint16_t) + NWTokenMaxSize;
+static NSUInteger const NWFeedbackBufferSize = 64 * 1024;
 
-@implementation NWPushFeedback
+@implementation NWPushFeedback {
+    char *_buffer;
+    NSUInteger _buffered;
+    BOOL _closed;
+}
+
+- (void)dealloc
+{
+    free(_buffer);
+}
 
 #pragma mark - Connecting
 
 - (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
 {
     if (_connection) [_connection disconnect]; _connection = nil;
+    _buffered = 0;
+    _closed = NO;
     if (environment == NWEnvironmentAuto) environment = [NWSecTools environmentForIdentity:identity];
     NSString *host = (environment == NWEnvironmentSandbox) ? NWSandboxPushHost : NWPushHost;
     NWSSLConnection *connection = [[NWSSLConnection alloc] initWithHost:host port:NWPushPort identity:identity];
@@ -46,6 +60,8 @@ static NSUInteger const NWTokenMaxSize = 32;
 - (void)disconnect
 {
     [_connection disconnect]; _connection = nil;
+    _buffered = 0;
+    _closed = NO;
 }
 
 + (instancetype)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
@@ -67,25 +83,20 @@ static NSUInteger const NWTokenMaxSize = 32;
 {
     *token = nil;
     *date = nil;
-    NSMutableData *data = [NSMutableData dataWithLength:sizeof(uint32_t) + sizeof(uint16_t) + NWTokenMaxSize];
-    NSUInteger length = 0;
-    BOOL read = [_connection read:data length:&length error:error];
-    if (!read || length == 0) {
+    NWFeedbackTuple tuple;
+    NSUInteger count = 0;
+    BOOL closed = NO;
+    BOOL read = [self readTuples:&tuple max:1 count:&count closed:&closed error:error];
+    if (!read) {
         return read;
     }
-    if (length != data.length) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorFeedbackLength reason:length error:error];
+    if (!count && closed) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorReadClosedGraceful error:error];
     }
-    uint32_t time = 0;
-    [data getBytes:&time range:NSMakeRange(0, 4)];
-    *date = [NSDate dateWithTimeIntervalSince1970:htonl(time)];
-    uint16_t l = 0;
-    [data getBytes:&l range:NSMakeRange(4, 2)];
-    NSUInteger tokenLength = htons(l);
-    if (tokenLength != NWTokenMaxSize) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorFeedbackTokenLength reason:tokenLength error:error];
+    if (count) {
+        *date = [NSDate dateWithTimeIntervalSince1970:tuple.timestamp];
+        *token = [NSData dataWithBytes:tuple.token length:NWTokenMaxSize];
     }
-    *token = [data subdataWithRange:NSMakeRange(6, length - 6)];
     return YES;
 }
 
@@ -104,23 +115,84 @@ static NSUInteger const NWTokenMaxSize = 32;
 - (NSArray *)readTokenDatePairsWithMax:(NSUInteger)max error:(NSError *__autoreleasing *)error
 {
     NSMutableArray *pairs = @[].mutableCopy;
-    for (NSUInteger i = 0; i < max; i++) {
-        NSString *token = nil;
-        NSDate *date = nil;
-        NSError *e = nil;
-        BOOL read = [self readToken:&token date:&date error:&e];
-        if (!read && e.code == kNWErrorReadClosedGraceful) {
+    BOOL read = [self readTuplesWithMax:max handler:^(const NWFeedbackTuple *tuples, NSUInteger count) {
+        char hex[NWTokenSize * 2];
+        for (NSUInteger i = 0; i < count; i++) {
+            NWHexEncode(tuples[i].token, NWTokenMaxSize, hex);
+            NSString *token = [[NSString alloc] initWithBytes:hex length:sizeof(hex) encoding:NSASCIIStringEncoding];
+            [pairs addObject:@[token, [NSDate dateWithTimeIntervalSince1970:tuples[i].timestamp]]];
+        }
+    } error:error];
+    return read ? pairs : nil;
+}
+
+- (BOOL)readTuplesWithMax:(NSUInteger)max handler:(void(^)(const NWFeedbackTuple *tuples, NSUInteger count))handler error:(NSError *__autoreleasing *)error
+{
+    NSUInteger batch = NWFeedbackBufferSize / NWTupleSize;
+    NWFeedbackTuple *tuples = malloc(batch * sizeof(NWFeedbackTuple));
+    BOOL closed = NO;
+    BOOL result = YES;
+    for (NSUInteger total = 0; result && total < max && !closed;) {
+        NSUInteger count = 0;
+        result = [self readTuples:tuples max:MIN(batch, max - total) count:&count closed:&closed error:error];
+        if (count) {
+            handler(tuples, count);
+            total += count;
+        } else if (result && !closed && ![_connection waitForReadWithTimeout:_connection.timeout]) {
             break;
         }
-        if (!read) {
+    }
+    free(tuples);
+    return result;
+}
+
+- (BOOL)readTuples:(NWFeedbackTuple *)tuples max:(NSUInteger)max count:(NSUInteger *)count closed:(BOOL *)closed error:(NSError *__autoreleasing *)error
+{
+    *count = 0;
+    if (!_buffer) _buffer = malloc(NWFeedbackBufferSize);
+    if (_buffered < NWTupleSize && !_closed) {
+        NSUInteger length = 0;
+        NSError *e = nil;
+        BOOL read = [_connection readBytes:_buffer + _buffered maxLength:NWFeedbackBufferSize - _buffered length:&length error:&e];
+        _buffered += length;
+        if (!read && e.code == kNWErrorReadClosedGraceful) {
+            _closed = YES;
+        } else if (!read) {
             if (error) *error = e;
-            return nil;
+            return read;
         }
-        if (token && date) {
-            [pairs addObject:@[token, date]];
+    }
+    NSUInteger offset = 0;
+    for (; *count < max && offset + NWTupleSize <= _buffered; offset += NWTupleSize) {
+        const char *p = _buffer + offset;
+        uint32_t time = 0;
+        memcpy(&time, p, sizeof(uint32_t));
+        uint16_t l = 0;
+        memcpy(&l, p + 4, sizeof(uint16_t));
+        NSUInteger tokenLength = htons(l);
+        if (tokenLength != NWTokenMaxSize) {
+            _buffered = 0;
+            return [NWErrorUtil noWithErrorCode:kNWErrorFeedbackTokenLength reason:tokenLength error:error];
         }
+        NWFeedbackTuple *tuple = &tuples[(*count)++];
+        tuple->timestamp = htonl(time);
+        memcpy(tuple->token, p + 6, NWTokenMaxSize);
     }
-    return pairs;
+    _buffered -= offset;
+    if (offset && _buffered) memmove(_buffer, _buffer + offset, _buffered);
+    if (_closed && _buffered < NWTupleSize) {
+        // complete tuples go out first, a trailing fragment is reported by the call after
+        if (_buffered && *count) {
+            return YES;
+        }
+        *closed = YES;
+        if (_buffered) {
+            NSUInteger fragment = _buffered;
+            _buffered = 0;
+            return [NWErrorUtil noWithErrorCode:kNWErrorFeedbackLength reason:fragment error:error];
+        }
+    }
+    return YES;
 }
 
 #pragma mark - Deprecated
@@ -0,0 +1,42 @@
+//
+//  NWPushQueue.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+@class NWHub, NWNotification;
+
+/** Lets many threads push notifications through a single hub.
+
+ Notifications are submitted to a bounded, lock-free queue, from any number of threads. A single consumer on a serial queue takes them off in batches and pushes them through the hub. Producers never wait for each other or for the connection; when the queue is full, submitting fails with `kNWErrorPushQueueFull` and should be retried later.
+
+ Every notification is assigned its identifier while it is submitted, taken from the atomic counter of the hub (see `nextIdentifier` of `NWHub`). Identifiers are therefore unique also when pushing through the hub directly. Producers racing each other may enqueue their identifiers slightly out of order, which the tracker of the hub handles. The consumer pushes each batch with `pushBatch:`, writing many notifications at once.
+ */
+@interface NWPushQueue : NSObject
+
+/** @name Properties */
+
+/** The hub through which all notifications are pushed. */
+@property (nonatomic, readonly) NWHub *hub;
+
+/** The maximum number of notifications waiting to be pushed, a power of two. */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/** The approximate number of notifications waiting to be pushed. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** @name Initialization */
+
+/** Create a queue in front of the hub, with room for capacity notifications, rounded up to a power of two. */
+- (instancetype)initWithHub:(NWHub *)hub capacity:(NSUInteger)capacity;
+
+/** @name Submitting */
+
+/** Submit a notification for pushing, safe to call from any thread. Returns `NO` with `kNWErrorPushQueueFull` if the queue is full. */
+- (BOOL)pushNotification:(NWNotification *)notification error:(NSError **)error;
+
+@end
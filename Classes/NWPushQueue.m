@@ -0,0 +1,132 @@
+//
+//  NWPushQueue.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWPushQueue.h"
+#import "NWHub.h"
+#import "NWNotification.h"
+#include <stdatomic.h>
+
+
+static NSUInteger const NWPushQueueDefaultCapacity = 1 << 14;
+static NSUInteger const NWPushQueueBatchSize = 256;
+
+// A slot is free for position p when its sequence equals p, and filled when it equals p + 1.
+typedef struct {
+    _Atomic(uintptr_t) sequence;
+    void *notification;
+} NWPushQueueCell;
+
+@implementation NWPushQueue {
+    NWPushQueueCell *_cells;
+    uintptr_t _mask;
+    _Atomic(uintptr_t) _tail;
+    _Atomic(uintptr_t) _head;
+    dispatch_queue_t _queue;
+    dispatch_source_t _source;
+}
+
+- (instancetype)init
+{
+    return [self initWithHub:[[NWHub alloc] init] capacity:NWPushQueueDefaultCapacity];
+}
+
+- (instancetype)initWithHub:(NWHub *)hub capacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        _hub = hub;
+        _capacity = 2;
+        while (_capacity < capacity && _capacity < (1UL << 31)) _capacity <<= 1;
+        _mask = _capacity - 1;
+        _cells = calloc(_capacity, sizeof(NWPushQueueCell));
+        for (uintptr_t i = 0; i < _capacity; i++) {
+            atomic_init(&_cells[i].sequence, i);
+        }
+        atomic_init(&_tail, 0);
+        atomic_init(&_head, 0);
+        _queue = dispatch_queue_create("NWPushQueue", DISPATCH_QUEUE_SERIAL);
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, _queue);
+        __weak NWPushQueue *weakSelf = self;
+        dispatch_source_set_event_handler(_source, ^{
+            [weakSelf drain];
+        });
+        dispatch_resume(_source);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    dispatch_source_cancel(_source);
+    for (uintptr_t i = 0; i < _capacity; i++) {
+        if (_cells[i].notification) CFRelease(_cells[i].notification);
+    }
+    free(_cells);
+}
+
+- (NSUInteger)count
+{
+    return atomic_load_explicit(&_tail, memory_order_relaxed) - atomic_load_explicit(&_head, memory_order_relaxed);
+}
+
+#pragma mark - Submitting
+
+- (BOOL)pushNotification:(NWNotification *)notification error:(NSError *__autoreleasing *)error
+{
+    uintptr_t position = atomic_load_explicit(&_tail, memory_order_relaxed);
+    NWPushQueueCell *cell = NULL;
+    for (;;) {
+        cell = &_cells[position & _mask];
+        intptr_t diff = (intptr_t)(atomic_load_explicit(&cell->sequence, memory_order_acquire) - position);
+        if (diff < 0) {
+            return [NWErrorUtil noWithErrorCode:kNWErrorPushQueueFull error:error];
+        }
+        if (!diff && atomic_compare_exchange_weak_explicit(&_tail, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+        if (diff) position = atomic_load_explicit(&_tail, memory_order_relaxed);
+    }
+    notification.identifier = [_hub nextIdentifier];
+    cell->notification = (__bridge_retained void *)notification;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    dispatch_source_merge_data(_source, 1);
+    return YES;
+}
+
+#pragma mark - Consuming
+
+- (NWNotification *)dequeue
+{
+    uintptr_t position = atomic_load_explicit(&_head, memory_order_relaxed);
+    NWPushQueueCell *cell = &_cells[position & _mask];
+    if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != position + 1) {
+        return nil;
+    }
+    NWNotification *notification = (__bridge_transfer NWNotification *)cell->notification;
+    cell->notification = NULL;
+    atomic_store_explicit(&cell->sequence, position + _mask + 1, memory_order_release);
+    atomic_store_explicit(&_head, position + 1, memory_order_relaxed);
+    return notification;
+}
+
+- (void)drain
+{
+    NSMutableArray *batch = [[NSMutableArray alloc] initWithCapacity:NWPushQueueBatchSize];
+    for (;;) {
+        NWNotification *notification = nil;
+        while (batch.count < NWPushQueueBatchSize && (notification = [self dequeue])) {
+            [batch addObject:notification];
+        }
+        if (!batch.count) {
+            break;
+        }
+        [_hub pushBatch:batch];
+        [batch removeAllObjects];
+    }
+}
+
+@end
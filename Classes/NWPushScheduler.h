@@ -0,0 +1,63 @@
+//
+//  NWPushScheduler.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+@class NWHub, NWNotification;
+
+/** The lanes in which the scheduler queues notifications. */
+typedef NS_ENUM(NSInteger, NWPushLane) {
+    /** Notifications with priority 10 or no priority, which are delivered immediately. */
+    NWPushLaneHigh = 0,
+    /** Notifications with priority 5, which are delivered at a time that conserves power. */
+    NWPushLaneLow = 1,
+};
+
+/** Orders notifications by priority before pushing them through a hub.
+
+ Notifications are queued in a lane depending on their priority. A single consumer drains the lanes in rounds, taking `highWeight` batches from the high-priority lane for every batch from the low-priority lane, and pushes each round with one call to `pushBatch:` of the hub. This way an urgent notification does not have to wait for a large broadcast that was queued before it, while the broadcast still makes progress.
+
+ Right before a notification is handed to the hub, its expiration is checked. Notifications that have expired while waiting are not sent, but reported to the hub delegate with `kNWErrorPushExpired`.
+
+ The hub is used from the scheduler's queue under the hub's own lock, so it can still be used directly from other threads. Notifications pushed that way skip the lanes.
+ */
+@interface NWPushScheduler : NSObject
+
+/** @name Properties */
+
+/** The hub through which all notifications are pushed. */
+@property (nonatomic, readonly) NWHub *hub;
+
+/** The number of high-priority batches drained for every low-priority batch, defaults to 4. */
+@property (nonatomic, assign) NSUInteger highWeight;
+
+/** @name Initialization */
+
+/** Create a scheduler in front of the hub. */
+- (instancetype)initWithHub:(NWHub *)hub;
+
+/** @name Scheduling */
+
+/** Queue a notification in the lane that matches its priority, safe to call from any thread. */
+- (void)pushNotification:(NWNotification *)notification;
+
+/** Queue notifications in the lanes that match their priority, safe to call from any thread. */
+- (void)pushNotifications:(NSArray *)notifications;
+
+/** Returns the lane in which the notification will be queued. */
++ (NWPushLane)laneWithNotification:(NWNotification *)notification;
+
+/** @name Statistics */
+
+/** The number of notifications waiting in the lane. */
+- (NSUInteger)countWithLane:(NWPushLane)lane;
+
+/** Counters of the lane, with keys `count` (waiting), `pushed`, `expired`, `wait` (average seconds waited before pushing) and `maxWait`. */
+- (NSDictionary *)statisticsWithLane:(NWPushLane)lane;
+
+@end
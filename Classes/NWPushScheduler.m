@@ -0,0 +1,183 @@
+//
+//  NWPushScheduler.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWPushScheduler.h"
+#import "NWHub.h"
+#import "NWNotification.h"
+
+
+static NSUInteger const NWPushSchedulerLaneCount = 2;
+static NSUInteger const NWPushSchedulerBatchSize = 256;
+static NSUInteger const NWPushSchedulerHighWeight = 4;
+
+@implementation NWPushScheduler {
+    NSMutableArray *_notifications[NWPushSchedulerLaneCount];
+    NSMutableData *_enqueued[NWPushSchedulerLaneCount];
+    NSUInteger _pushed[NWPushSchedulerLaneCount];
+    NSUInteger _expired[NWPushSchedulerLaneCount];
+    NSTimeInterval _waited[NWPushSchedulerLaneCount];
+    NSTimeInterval _maxWait[NWPushSchedulerLaneCount];
+    NSUInteger _credits;
+    NSLock *_lock;
+    dispatch_queue_t _queue;
+    dispatch_source_t _source;
+}
+
+- (instancetype)init
+{
+    return [self initWithHub:[[NWHub alloc] init]];
+}
+
+- (instancetype)initWithHub:(NWHub *)hub
+{
+    self = [super init];
+    if (self) {
+        _hub = hub;
+        _highWeight = NWPushSchedulerHighWeight;
+        for (NSUInteger i = 0; i < NWPushSchedulerLaneCount; i++) {
+            _notifications[i] = @[].mutableCopy;
+            _enqueued[i] = [[NSMutableData alloc] init];
+        }
+        _lock = [[NSLock alloc] init];
+        _queue = dispatch_queue_create("NWPushScheduler", DISPATCH_QUEUE_SERIAL);
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, _queue);
+        __weak NWPushScheduler *weakSelf = self;
+        dispatch_source_set_event_handler(_source, ^{
+            [weakSelf drain];
+        });
+        dispatch_resume(_source);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    dispatch_source_cancel(_source);
+}
+
++ (NWPushLane)laneWithNotification:(NWNotification *)notification
+{
+    return notification.priority == 5 ? NWPushLaneLow : NWPushLaneHigh;
+}
+
+#pragma mark - Scheduling
+
+- (void)pushNotification:(NWNotification *)notification
+{
+    [self pushNotifications:@[notification]];
+}
+
+- (void)pushNotifications:(NSArray *)notifications
+{
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    [_lock lock];
+    for (NWNotification *notification in notifications) {
+        NWPushLane lane = [NWPushScheduler laneWithNotification:notification];
+        [_notifications[lane] addObject:notification];
+        [_enqueued[lane] appendBytes:&now length:sizeof(now)];
+    }
+    [_lock unlock];
+    dispatch_source_merge_data(_source, notifications.count);
+}
+
+#pragma mark - Draining
+
+- (NWPushLane)nextLane
+{
+    BOOL high = _notifications[NWPushLaneHigh].count > 0;
+    BOOL low = _notifications[NWPushLaneLow].count > 0;
+    if (high && low) {
+        if (_credits < _highWeight) {
+            _credits++;
+            return NWPushLaneHigh;
+        }
+        _credits = 0;
+        return NWPushLaneLow;
+    }
+    return high ? NWPushLaneHigh : NWPushLaneLow;
+}
+
+// Moves the next batch into round, taking turns between the lanes. Returns NO if both lanes are empty.
+- (BOOL)dequeueBatchIntoRound:(NSMutableArray *)round expired:(NSMutableArray *)expired
+{
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    NSUInteger stamp = (NSUInteger)NSDate.date.timeIntervalSince1970;
+    [_lock lock];
+    NWPushLane lane = [self nextLane];
+    NSMutableArray *notifications = _notifications[lane];
+    NSMutableData *enqueued = _enqueued[lane];
+    NSRange range = NSMakeRange(0, MIN(notifications.count, NWPushSchedulerBatchSize));
+    const NSTimeInterval *times = enqueued.bytes;
+    for (NSUInteger i = 0; i < range.length; i++) {
+        NWNotification *notification = notifications[i];
+        if (notification.addExpiration && notification.expirationStamp && notification.expirationStamp <= stamp) {
+            [expired addObject:notification];
+            _expired[lane]++;
+            continue;
+        }
+        NSTimeInterval wait = now - times[i];
+        _waited[lane] += wait;
+        _maxWait[lane] = MAX(_maxWait[lane], wait);
+        _pushed[lane]++;
+        [round addObject:notification];
+    }
+    [notifications removeObjectsInRange:range];
+    [enqueued replaceBytesInRange:NSMakeRange(0, range.length * sizeof(NSTimeInterval)) withBytes:NULL length:0];
+    [_lock unlock];
+    return range.length > 0;
+}
+
+- (void)drain
+{
+    for (BOOL more = YES; more;) {
+        // a round takes up to highWeight batches from the high lane and one from the low lane, pushed as one batch
+        NSMutableArray *round = @[].mutableCopy;
+        NSMutableArray *expired = @[].mutableCopy;
+        for (NSUInteger i = 0; i <= _highWeight && more; i++) {
+            more = [self dequeueBatchIntoRound:round expired:expired];
+        }
+        if (expired.count) {
+            [self failExpired:expired];
+        }
+        if (round.count) {
+            [_hub pushBatch:round];
+        }
+    }
+}
+
+- (void)failExpired:(NSArray *)notifications
+{
+    id<NWHubDelegate> delegate = _hub.delegate;
+    if (![delegate respondsToSelector:@selector(notification:didFailWithError:)]) {
+        return;
+    }
+    for (NWNotification *notification in notifications) {
+        NSError *error = nil;
+        [NWErrorUtil noWithErrorCode:kNWErrorPushExpired error:&error];
+        [delegate notification:notification didFailWithError:error];
+    }
+}
+
+#pragma mark - Statistics
+
+- (NSUInteger)countWithLane:(NWPushLane)lane
+{
+    [_lock lock];
+    NSUInteger result = _notifications[lane].count;
+    [_lock unlock];
+    return result;
+}
+
+- (NSDictionary *)statisticsWithLane:(NWPushLane)lane
+{
+    [_lock lock];
+    NSDictionary *result = @{@"count": @(_notifications[lane].count), @"pushed": @(_pushed[lane]), @"expired": @(_expired[lane]), @"wait": @(_pushed[lane] ? _waited[lane] / _pushed[lane] : 0), @"maxWait": @(_maxWait[lane])};
+    [_lock unlock];
+    return result;
+}
+
+@end
@@ -8,7 +8,7 @@
 #import "NWType.h"
 #import <Foundation/Foundation.h>
 
-@class NWNotification, NWSSLConnection;
+@class NWNotification, NWSSLConnection, NWPacer;
 
 /** Serializes notification objects and pushes them to the APNs.
  
@@ -29,6 +29,15 @@
 /** The SSL connection through which all notifications are pushed. */
 @property (nonatomic, strong) NWSSLConnection *connection;
 
+/** The maximum number of bytes packed into a single write when pushing multiple notifications, defaults to 16 KB. */
+@property (nonatomic, assign) NSUInteger writeBufferSize;
+
+/** Index of the gateway address to try first when connecting, lets multiple pushers spread over the gateway addresses. */
+@property (nonatomic, assign) NSUInteger addressOffset;
+
+/** Adapts the number of bytes per write to how fast the connection drains, `nil` by default to always write up to `writeBufferSize`. */
+@property (nonatomic, strong) NWPacer *pacer;
+
 /** @name Initialization */
 
 /** Creates, connects and returns a pusher object based on the provided identity. */
@@ -59,6 +68,27 @@
 /** Push a notification using push type for serialization. */
 - (BOOL)pushNotification:(NWNotification *)notification type:(NWNotificationType)type error:(NSError **)error;
 
+/** Push multiple notifications using push type for serialization, packing frames into as few writes as possible.
+ @see pushNotifications:type:accepted:error:
+ */
+- (BOOL)pushNotifications:(NSArray *)notifications type:(NWNotificationType)type error:(NSError **)error;
+
+/** Push multiple notifications and report the number of bytes accepted for each of them.
+ 
+ The serialized frames are packed into a contiguous buffer of up to `writeBufferSize` bytes, which is then flushed with a single write. This saves a TLS record and a system call per notification. A frame larger than the buffer size is written on its own.
+ 
+ The optional `accepted` array should hold one element per notification, all zero on the first call. On return it contains the number of bytes of each frame accepted by the connection. If the connection did not accept all bytes within its `timeout`, this method returns `NO` with `kNWErrorPushWriteFail`. Pass the same array on the next call to resume where the previous write stopped, without re-sending any frame (or part of a frame) that was already accepted.
+ */
+- (BOOL)pushNotifications:(NSArray *)notifications type:(NWNotificationType)type accepted:(NSUInteger *)accepted error:(NSError **)error;
+
+/** Push one notification to many devices, serializing it only once.
+ 
+ The notification is serialized into a frame template, which is then copied for every device token in `tokens`, an array of `NSData`. Only the token bytes and the identifier are stamped into each copy, where the i-th frame gets identifier `notification.identifier + i`. The token of the notification itself only serves as placeholder and determines the expected token length. Frames are packed into writes of up to `writeBufferSize` bytes.
+ 
+ Returns the number of frames that have been fully written, which equals `tokens.count` on success. Otherwise the error is set and the frame at the returned index has not been (fully) sent, for example because its token length does not match. A frame that was partly written is finished before returning, so the stream stays intact. If even that fails, the connection is left in the middle of a frame and has to be reconnected before pushing again; this is the case for any error other than `kNWErrorAPNInvalidTokenSize`.
+ */
+- (NSUInteger)pushNotification:(NWNotification *)notification tokenDatas:(NSArray *)tokens type:(NWNotificationType)type error:(NSError **)error;
+
 /** @name Reading */
 
 /** Read back from the server the notification identifiers of failed pushes. */
@@ -9,14 +9,26 @@
 #import "NWSSLConnection.h"
 #import "NWSecTools.h"
 #import "NWNotification.h"
+#import "NWPacer.h"
+#import "NWMetrics.h"
 
 
 static NSString * const NWSandboxPushHost = @"gateway.sandbox.push.apple.com";
 static NSString * const NWPushHost = @"gateway.push.apple.com";
 static NSUInteger const NWPushPort = 2195;
+static NSUInteger const NWPushWriteBufferSize = 16 * 1024;
 
 @implementation NWPusher
 
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _writeBufferSize = NWPushWriteBufferSize;
+    }
+    return self;
+}
+
 #pragma mark - Connecting
 
 - (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
@@ -25,6 +37,7 @@ static NSUInteger const NWPushPort = 2195;
     if (environment == NWEnvironmentAuto) environment = [NWSecTools environmentForIdentity:identity];
     NSString *host = (environment == NWEnvironmentSandbox) ? NWSandboxPushHost : NWPushHost;
     NWSSLConnection *connection = [[NWSSLConnection alloc] initWithHost:host port:NWPushPort identity:identity];
+    connection.addressOffset = _addressOffset;
     BOOL connected = [connection connectWithError:error];
     if (!connected) {
         return connected;
@@ -77,7 +90,10 @@ static NSUInteger const NWPushPort = 2195;
 - (BOOL)pushNotification:(NWNotification *)notification type:(NWNotificationType)type error:(NSError *__autoreleasing *)error
 {
     NSUInteger length = 0;
-    NSData *data = [notification dataWithType:type];
+    NSMutableData *data = [NSMutableData dataWithLength:[notification lengthWithType:type]];
+    if (![notification getBytes:data.mutableBytes length:data.length type:type error:error]) {
+        return NO;
+    }
     BOOL written = [_connection write:data length:&length error:error];
     if (!written) {
         return written;
@@ -88,6 +104,155 @@ static NSUInteger const NWPushPort = 2195;
     return YES;
 }
 
+- (BOOL)pushNotifications:(NSArray *)notifications type:(NWNotificationType)type error:(NSError *__autoreleasing *)error
+{
+    return [self pushNotifications:notifications type:type accepted:NULL error:error];
+}
+
+- (BOOL)pushNotifications:(NSArray *)notifications type:(NWNotificationType)type accepted:(NSUInteger *)accepted error:(NSError *__autoreleasing *)error
+{
+    NSUInteger count = notifications.count;
+    if (!count) {
+        return YES;
+    }
+    NSUInteger *lengths = calloc(count, sizeof(NSUInteger));
+    NSUInteger *done = accepted ?: calloc(count, sizeof(NSUInteger));
+    NSUInteger capacity = _writeBufferSize;
+    char *buffer = malloc(capacity);
+    NSError *invalid = nil;
+    BOOL result = buffer || [NWErrorUtil noWithErrorCode:kNWErrorPushBufferSize reason:capacity error:error];
+    for (NSUInteger index = 0; result && !invalid && index < count;) {
+        NSUInteger limit = _pacer ? _pacer.batchSize : _writeBufferSize;
+        uint64_t serialize = NWMetricsNow();
+        NSUInteger used = 0;
+        NSUInteger start = index;
+        for (; index < count; index++) {
+            NWNotification *notification = notifications[index];
+            NSUInteger frame = [notification lengthWithType:type];
+            NSUInteger skip = MIN(done[index], frame);
+            lengths[index] = frame;
+            if (skip == frame) {
+                continue;
+            }
+            if (used && used + frame - skip > limit) {
+                break;
+            }
+            if (used + frame > capacity) {
+                char *grown = realloc(buffer, used + frame);
+                if (!grown) {
+                    [NWErrorUtil noWithErrorCode:kNWErrorPushBufferSize reason:used + frame error:&invalid];
+                    break;
+                }
+                buffer = grown;
+                capacity = used + frame;
+            }
+            if (![notification getBytes:buffer + used length:capacity - used type:type error:&invalid]) {
+                break;
+            }
+            if (skip) memmove(buffer + used, buffer + used + skip, frame - skip);
+            used += frame - skip;
+        }
+        if (!used) {
+            continue;
+        }
+        NWHistogramRecord(kNWHistogramSerialize, NWMetricsNow() - serialize);
+        NSUInteger length = 0;
+        NSData *data = [[NSData alloc] initWithBytesNoCopy:buffer length:used freeWhenDone:NO];
+        [_pacer waitForConnection:_connection];
+        result = [_connection write:data length:&length error:error];
+        [_pacer connection:_connection didWriteLength:length ofLength:used];
+        for (NSUInteger i = start, left = length; i < index && left; i++) {
+            NSUInteger n = lengths[i] > done[i] ? MIN(lengths[i] - done[i], left) : 0;
+            done[i] += n;
+            left -= n;
+        }
+        if (result && length != used) {
+            result = [NWErrorUtil noWithErrorCode:kNWErrorPushWriteFail reason:length error:error];
+        }
+    }
+    if (result && invalid) {
+        if (error) *error = invalid;
+        result = NO;
+    }
+    if (done != accepted) free(done);
+    free(lengths);
+    free(buffer);
+    return result;
+}
+
+- (NSUInteger)pushNotification:(NWNotification *)notification tokenDatas:(NSArray *)tokens type:(NWNotificationType)type error:(NSError *__autoreleasing *)error
+{
+    NSUInteger frame = [notification lengthWithType:type];
+    NSUInteger tokenOffset = [notification tokenOffsetWithType:type];
+    NSUInteger tokenLength = notification.tokenData.length;
+    NSUInteger identifierOffset = [notification identifierOffsetWithType:type];
+    uint32_t identifier = (uint32_t)notification.identifier;
+    if (tokenOffset == NSNotFound) {
+        [NWErrorUtil noWithErrorCode:kNWErrorAPNMissingDeviceToken error:error];
+        return 0;
+    }
+    NSUInteger slots = frame ? MAX(MAX(_writeBufferSize, _pacer.maxBatchSize) / frame, 1) : 1;
+    char *buffer = malloc(slots * frame);
+    if (!buffer) {
+        [NWErrorUtil noWithErrorCode:kNWErrorPushBufferSize reason:slots * frame error:error];
+        return 0;
+    }
+    if (![notification getBytes:buffer length:frame type:type error:error]) {
+        free(buffer);
+        return 0;
+    }
+    for (NSUInteger i = 1; i < slots; i++) {
+        memcpy(buffer + i * frame, buffer, frame);
+    }
+    NSUInteger count = tokens.count;
+    NSUInteger sent = 0;
+    while (sent < count) {
+        NSUInteger limit = _pacer && frame ? MIN(MAX(_pacer.batchSize / frame, 1), slots) : slots;
+        NSUInteger n = 0;
+        for (; n < limit && sent + n < count; n++) {
+            NSData *token = tokens[sent + n];
+            if (token.length != tokenLength) {
+                break;
+            }
+            char *p = buffer + n * frame;
+            memcpy(p + tokenOffset, token.bytes, tokenLength);
+            if (identifierOffset != NSNotFound) {
+                uint32_t ID = htonl(identifier + (uint32_t)(sent + n));
+                memcpy(p + identifierOffset, &ID, sizeof(uint32_t));
+            }
+        }
+        if (n) {
+            NSUInteger length = 0;
+            NSData *data = [[NSData alloc] initWithBytesNoCopy:buffer length:n * frame freeWhenDone:NO];
+            [_pacer waitForConnection:_connection];
+            BOOL written = [_connection write:data length:&length error:error];
+            NSUInteger partial = length % frame;
+            if (written && partial) {
+                // a frame is partly on the wire, finish it before anything else is written
+                NSUInteger rest = 0;
+                NSData *remainder = [[NSData alloc] initWithBytesNoCopy:buffer + length length:frame - partial freeWhenDone:NO];
+                written = [_connection write:remainder length:&rest error:error];
+                length += rest;
+            }
+            [_pacer connection:_connection didWriteLength:length ofLength:data.length];
+            sent += length / frame;
+            if (!written) {
+                break;
+            }
+            if (length != data.length) {
+                [NWErrorUtil noWithErrorCode:kNWErrorPushWriteFail reason:length error:error];
+                break;
+            }
+        }
+        if (n < limit && sent < count) {
+            [NWErrorUtil noWithErrorCode:kNWErrorAPNInvalidTokenSize reason:[tokens[sent] length] error:error];
+            break;
+        }
+    }
+    free(buffer);
+    return sent;
+}
+
 #pragma mark - Reading failed
 
 - (BOOL)readFailedIdentifier:(NSUInteger *)identifier apnError:(NSError *__autoreleasing *)apnError error:(NSError *__autoreleasing *)error
@@ -109,6 +274,7 @@ static NSUInteger const NWPushPort = 2195;
     uint32_t ID = 0;
     [data getBytes:&ID range:NSMakeRange(2, 4)];
     *identifier = htonl(ID);
+    [_pacer didReceiveErrorResponse];
     switch (status) {
         case 1: [NWErrorUtil noWithErrorCode:kNWErrorAPNProcessing error:apnError]; break;
         case 2: [NWErrorUtil noWithErrorCode:kNWErrorAPNMissingDeviceToken error:apnError]; break;
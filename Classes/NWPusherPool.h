@@ -0,0 +1,86 @@
+//
+//  NWPusherPool.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import "NWHub.h"
+#import <Foundation/Foundation.h>
+
+/** Spreads pushing over multiple parallel connections with the APNs.
+
+ A single connection is limited by the throughput of one TLS stream, encrypted on one core. This class opens a number of connections with the same identity, each managed by its own `NWHub` on its own serial queue. Notifications are divided into contiguous shards, one per connection, which are then pushed in parallel.
+
+ Every hub assigns identifiers and keeps track of its own notifications, so error responses read from a connection map back to the notification pushed over that same connection. Hubs reconnect independently when their connection drops. Each connection starts at a different gateway address, spreading the pool over the front-end servers. The delegate is shared by all hubs and may be called from any of their queues.
+ */
+@interface NWPusherPool : NSObject
+
+/** @name Properties */
+
+/** The hubs, one per connection. */
+@property (nonatomic, readonly) NSArray *hubs;
+
+/** Assign a delegate to get notified when something fails during or after pushing, on any connection. */
+@property (nonatomic, weak) id<NWHubDelegate> delegate;
+
+/** @name Initialization */
+
+/** Create a pool of size hubs, not connected yet. */
+- (instancetype)initWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate;
+
+/** Create, connect and return a pool of size connections using the identity. */
++ (instancetype)connectWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate identity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Create, connect and return a pool of size connections using the PKCS #12 data. */
++ (instancetype)connectWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate PKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** @name Connecting */
+
+/** Connect all hubs in parallel using the identity, fails if any of them fails. */
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Connect all hubs in parallel using the identity from PKCS #12 data, which is decoded only once. */
+- (BOOL)connectWithPKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError **)error;
+
+/** Reconnect all hubs, fails if any of them fails. */
+- (BOOL)reconnectWithError:(NSError **)error;
+
+/** Disconnect all hubs. */
+- (void)disconnect;
+
+/** @name Pushing */
+
+/** Push notifications, divided over all connections. Returns the number of notifications that failed.
+ @see [NWHub pushNotifications:]
+ */
+- (NSUInteger)pushNotifications:(NSArray *)notifications;
+
+/** Push a JSON string payload to multiple devices, divided over all connections. Returns the number of notifications that failed.
+ @see [NWHub pushPayload:tokens:]
+ */
+- (NSUInteger)pushPayload:(NSString *)payload tokens:(NSArray *)tokens;
+
+/** Read the error responses of all connections in parallel. Returns the number of failed notifications.
+ @see [NWHub readFailed]
+ */
+- (NSUInteger)readFailed;
+
+/** Read the error responses of every connection on its own dedicated queue.
+ @see [NWHub startReading]
+ */
+- (void)startReading;
+
+/** Stop reading error responses in the background. */
+- (void)stopReading;
+
+/** @name Statistics */
+
+/** Aggregated counters of all connections, with keys `pushed`, `failed` and `rate` (pushes per second since connecting). A notification is counted as failed if it could not be written or if `readFailed` reported it, it is not counted as pushed in either case. Can be called from any thread. */
+- (NSDictionary *)statistics;
+
+/** Counters per connection, an array of dictionaries with the same keys as `statistics`. */
+- (NSArray *)connectionStatistics;
+
+@end
@@ -0,0 +1,235 @@
+//
+//  NWPusherPool.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWPusherPool.h"
+#import "NWSecTools.h"
+#include <stdatomic.h>
+
+
+@implementation NWPusherPool {
+    NSArray *_queues;
+    // per connection, updated on its queue and read from any thread
+    _Atomic(NSUInteger) *_written;
+    _Atomic(NSUInteger) *_unwritten;
+    _Atomic(NSTimeInterval) *_connected;
+}
+
+- (instancetype)init
+{
+    return [self initWithSize:NSProcessInfo.processInfo.activeProcessorCount delegate:nil];
+}
+
+- (instancetype)initWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate
+{
+    self = [super init];
+    if (self) {
+        size = size ?: 1;
+        NSMutableArray *hubs = @[].mutableCopy;
+        NSMutableArray *queues = @[].mutableCopy;
+        for (NSUInteger i = 0; i < size; i++) {
+            NWHub *hub = [[NWHub alloc] initWithDelegate:delegate];
+            hub.pusher.addressOffset = i;
+            [hubs addObject:hub];
+            [queues addObject:dispatch_queue_create("NWPusherPool", DISPATCH_QUEUE_SERIAL)];
+        }
+        _hubs = hubs;
+        _queues = queues;
+        _delegate = delegate;
+        _written = calloc(size, sizeof(*_written));
+        _unwritten = calloc(size, sizeof(*_unwritten));
+        _connected = calloc(size, sizeof(*_connected));
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    free(_written);
+    free(_unwritten);
+    free(_connected);
+}
+
+- (void)setDelegate:(id<NWHubDelegate>)delegate
+{
+    _delegate = delegate;
+    for (NWHub *hub in _hubs) {
+        hub.delegate = delegate;
+    }
+}
+
+#pragma mark - Connecting
+
++ (instancetype)connectWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate identity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWPusherPool *pool = [[NWPusherPool alloc] initWithSize:size delegate:delegate];
+    return identity && [pool connectWithIdentity:identity environment:environment error:error] ? pool : nil;
+}
+
++ (instancetype)connectWithSize:(NSUInteger)size delegate:(id<NWHubDelegate>)delegate PKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWPusherPool *pool = [[NWPusherPool alloc] initWithSize:size delegate:delegate];
+    return data && [pool connectWithPKCS12Data:data password:password environment:environment error:error] ? pool : nil;
+}
+
+- (BOOL)connectWithIdentity:(NWIdentityRef)identity environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    return [self performOnAll:^BOOL(NSUInteger i, NSError *__autoreleasing *e) {
+        atomic_store_explicit(&_connected[i], NSDate.timeIntervalSinceReferenceDate, memory_order_relaxed);
+        return [_hubs[i] connectWithIdentity:identity environment:environment error:e];
+    } error:error];
+}
+
+- (BOOL)connectWithPKCS12Data:(NSData *)data password:(NSString *)password environment:(NWEnvironment)environment error:(NSError *__autoreleasing *)error
+{
+    NWIdentityRef identity = [NWSecTools identityWithPKCS12Data:data password:password error:error];
+    if (!identity) {
+        return NO;
+    }
+    return [self connectWithIdentity:identity environment:environment error:error];
+}
+
+- (BOOL)reconnectWithError:(NSError *__autoreleasing *)error
+{
+    return [self performOnAll:^BOOL(NSUInteger i, NSError *__autoreleasing *e) {
+        return [_hubs[i] reconnectWithError:e];
+    } error:error];
+}
+
+- (void)disconnect
+{
+    [self performOnAll:^BOOL(NSUInteger i, NSError *__autoreleasing *e) {
+        [_hubs[i] disconnect];
+        return YES;
+    } error:nil];
+}
+
+- (BOOL)performOnAll:(BOOL(^)(NSUInteger index, NSError *__autoreleasing *error))block error:(NSError *__autoreleasing *)error
+{
+    NSMutableArray *errors = @[].mutableCopy;
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger i = 0; i < _hubs.count; i++) {
+        dispatch_group_async(group, _queues[i], ^{
+            NSError *e = nil;
+            BOOL success = block(i, &e);
+            @synchronized(errors) {
+                if (!success) [errors addObject:e ?: NSNull.null];
+            }
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    if (errors.count) {
+        if (error) *error = errors[0] != NSNull.null ? errors[0] : nil;
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark - Pushing
+
+- (NSUInteger)pushNotifications:(NSArray *)notifications
+{
+    return [self shard:notifications push:^NSUInteger(NWHub *hub, NSArray *shard) {
+        return [hub pushNotifications:shard];
+    }];
+}
+
+- (NSUInteger)pushPayload:(NSString *)payload tokens:(NSArray *)tokens
+{
+    return [self shard:tokens push:^NSUInteger(NWHub *hub, NSArray *shard) {
+        return [hub pushPayload:payload tokens:shard];
+    }];
+}
+
+- (NSUInteger)shard:(NSArray *)items push:(NSUInteger(^)(NWHub *hub, NSArray *shard))block
+{
+    NSUInteger size = _hubs.count;
+    NSUInteger count = items.count;
+    __block NSUInteger fails = 0;
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger i = 0; i < size; i++) {
+        NSUInteger start = count * i / size;
+        NSUInteger end = count * (i + 1) / size;
+        if (start == end) {
+            continue;
+        }
+        NSArray *shard = [items subarrayWithRange:NSMakeRange(start, end - start)];
+        dispatch_group_async(group, _queues[i], ^{
+            NSUInteger f = block(_hubs[i], shard);
+            atomic_fetch_add_explicit(&_written[i], shard.count - f, memory_order_relaxed);
+            atomic_fetch_add_explicit(&_unwritten[i], f, memory_order_relaxed);
+            @synchronized(self) {
+                fails += f;
+            }
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    return fails;
+}
+
+- (NSUInteger)readFailed
+{
+    __block NSUInteger fails = 0;
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger i = 0; i < _hubs.count; i++) {
+        dispatch_group_async(group, _queues[i], ^{
+            NSUInteger f = [_hubs[i] readFailed];
+            @synchronized(self) {
+                fails += f;
+            }
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    return fails;
+}
+
+- (void)startReading
+{
+    for (NWHub *hub in _hubs) {
+        [hub startReading];
+    }
+}
+
+- (void)stopReading
+{
+    for (NWHub *hub in _hubs) {
+        [hub stopReading];
+    }
+}
+
+#pragma mark - Statistics
+
+- (NSDictionary *)statistics
+{
+    NSUInteger pushed = 0, failed = 0;
+    double rate = 0;
+    for (NSDictionary *connection in self.connectionStatistics) {
+        pushed += [connection[@"pushed"] unsignedIntegerValue];
+        failed += [connection[@"failed"] unsignedIntegerValue];
+        rate += [connection[@"rate"] doubleValue];
+    }
+    return @{@"pushed": @(pushed), @"failed": @(failed), @"rate": @(rate)};
+}
+
+- (NSArray *)connectionStatistics
+{
+    NSTimeInterval now = NSDate.timeIntervalSinceReferenceDate;
+    NSMutableArray *result = @[].mutableCopy;
+    for (NSUInteger i = 0; i < _hubs.count; i++) {
+        NSTimeInterval connected = atomic_load_explicit(&_connected[i], memory_order_relaxed);
+        NSUInteger written = atomic_load_explicit(&_written[i], memory_order_relaxed);
+        NSUInteger unwritten = atomic_load_explicit(&_unwritten[i], memory_order_relaxed);
+        // rejected notifications were written first, count them as failed only, whichever path read their error response
+        NSUInteger rejected = ((NWHub *)_hubs[i]).rejected;
+        NSUInteger pushed = written > rejected ? written - rejected : 0;
+        NSTimeInterval span = connected ? now - connected : 0;
+        double rate = span > 0 ? pushed / span : 0;
+        [result addObject:@{@"pushed": @(pushed), @"failed": @(unwritten + rejected), @"rate": @(rate)}];
+    }
+    return result;
+}
+
+@end
@@ -0,0 +1,45 @@
+//
+//  NWResolver.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+/** Resolves and caches the addresses of a host.
+
+ Lookups use `getaddrinfo`, which is thread-safe and returns both IPv4 and IPv6 addresses, in the order they should be tried. Results are cached for `ttl` seconds, so many connections reconnecting at once do not each wait for DNS.
+
+ Addresses are `NSData` objects containing a `struct sockaddr`, ready to be passed to `connect`.
+ */
+@interface NWResolver : NSObject
+
+/** @name Properties */
+
+/** The number of seconds a lookup is cached, defaults to 60. */
+@property (nonatomic, assign) NSTimeInterval ttl;
+
+/** @name Initialization */
+
+/** The resolver shared by all connections. */
++ (instancetype)sharedResolver;
+
+/** @name Resolving */
+
+/** Returns the addresses of the host with port filled in, from cache if not expired. */
+- (NSArray *)addressesForHost:(NSString *)host port:(NSUInteger)port error:(NSError **)error;
+
+/** Let go of the cached addresses of the host, for example after failing to connect to any of them. */
+- (void)removeAddressesForHost:(NSString *)host port:(NSUInteger)port;
+
+/** Let go of all cached addresses. */
+- (void)removeAllAddresses;
+
+/** @name Helpers */
+
+/** Returns the numeric representation of an address, for logging purposes. */
++ (NSString *)descriptionWithAddress:(NSData *)address;
+
+@end
@@ -0,0 +1,105 @@
+//
+//  NWResolver.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWResolver.h"
+#include <netdb.h>
+
+
+static NSTimeInterval const NWResolverTTL = 60;
+
+@implementation NWResolver {
+    NSMutableDictionary *_addresses;
+    NSMutableDictionary *_expires;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _ttl = NWResolverTTL;
+        _addresses = @{}.mutableCopy;
+        _expires = @{}.mutableCopy;
+    }
+    return self;
+}
+
++ (instancetype)sharedResolver
+{
+    static NWResolver *shared = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        shared = [[NWResolver alloc] init];
+    });
+    return shared;
+}
+
+#pragma mark - Resolving
+
+- (NSArray *)addressesForHost:(NSString *)host port:(NSUInteger)port error:(NSError *__autoreleasing *)error
+{
+    NSString *key = [NSString stringWithFormat:@"%@:%lu", host, (unsigned long)port];
+    @synchronized(self) {
+        NSArray *addresses = _addresses[key];
+        if (addresses && [_expires[key] timeIntervalSinceNow] > 0) {
+            return addresses;
+        }
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *info = NULL;
+    int status = getaddrinfo(host.UTF8String, [NSString stringWithFormat:@"%lu", (unsigned long)port].UTF8String, &hints, &info);
+    if (status) {
+        return [NWErrorUtil nilWithErrorCode:kNWErrorSocketResolveHostName reason:status error:error];
+    }
+    NSMutableArray *addresses = @[].mutableCopy;
+    for (struct addrinfo *i = info; i; i = i->ai_next) {
+        [addresses addObject:[NSData dataWithBytes:i->ai_addr length:i->ai_addrlen]];
+    }
+    freeaddrinfo(info);
+    if (!addresses.count) {
+        return [NWErrorUtil nilWithErrorCode:kNWErrorSocketResolveHostName error:error];
+    }
+    @synchronized(self) {
+        _addresses[key] = addresses;
+        _expires[key] = [NSDate dateWithTimeIntervalSinceNow:_ttl];
+    }
+    return addresses;
+}
+
+- (void)removeAddressesForHost:(NSString *)host port:(NSUInteger)port
+{
+    NSString *key = [NSString stringWithFormat:@"%@:%lu", host, (unsigned long)port];
+    @synchronized(self) {
+        [_addresses removeObjectForKey:key];
+        [_expires removeObjectForKey:key];
+    }
+}
+
+- (void)removeAllAddresses
+{
+    @synchronized(self) {
+        [_addresses removeAllObjects];
+        [_expires removeAllObjects];
+    }
+}
+
+#pragma mark - Helpers
+
++ (NSString *)descriptionWithAddress:(NSData *)address
+{
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    if (getnameinfo(address.bytes, (socklen_t)address.length, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV)) {
+        return nil;
+    }
+    const struct sockaddr *addr = address.bytes;
+    return [NSString stringWithFormat:addr->sa_family == AF_INET6 ? @"[%s]:%s" : @"%s:%s", host, port];
+}
+
+@end
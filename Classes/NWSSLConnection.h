@@ -13,10 +13,14 @@
 
  This class is basically an Objective-C wrapper around `SSLContextRef` and `SSLConnectionRef`, which are part of the native Secure Transport framework. This class provides a generic interface for SSL (TLS) connections, independent of NWPusher.
  
- A SSL connection is set up using the host name, host port and an identity. The host name will be resolved using DNS. The identity is an instance of `SecIdentityRef` and contains both a certificate and a private key. See the *Secure Transport Reference* for more info on that.
+ A SSL connection is set up using the host name, host port and an identity. The host name will be resolved using DNS, cached by `NWResolver`. Connecting races the first few addresses of the host and continues with the first to succeed. The identity is an instance of `SecIdentityRef` and contains both a certificate and a private key. See the *Secure Transport Reference* for more info on that.
  
  Read more about provider communication in Apple's documentation under *Apple Push Notification Service*.
  
+ The socket is non-blocking from the moment it is created. Connecting and the handshake wait for socket readiness using `poll`, bounded by `timeout`, rather than spinning. Use `waitForReadWithTimeout:` and `waitForWriteWithTimeout:` to block until the connection can make progress.
+
+ Connecting, disconnecting, reading and writing are serialized internally, so one thread can read from the connection while another is writing to it. Waiting is done outside the lock.
+ 
  Methods return `NO` if an error occurred.
  */
 @interface NWSSLConnection : NSObject
@@ -32,6 +36,39 @@
 /** Identity containing a certificate-key pair for setting up the TLS connection. */
 @property (nonatomic, strong) NWIdentityRef identity;
 
+/** Index of the resolved host address to try first, lets multiple connections spread over the addresses of the host. */
+@property (nonatomic, assign) NSUInteger addressOffset;
+
+/** The address connected to, an `NSData` containing a `struct sockaddr`, or `nil` if not connected. */
+@property (nonatomic, readonly) NSData *address;
+
+/** The time in seconds to wait for connecting, the handshake or a write to make progress, defaults to 10. */
+@property (nonatomic, assign) NSTimeInterval timeout;
+
+/** Certificates (`SecCertificateRef`) to trust as roots instead of the system ones, for testing against a server with a self-signed certificate. Defaults to `nil`, which uses the system roots. */
+@property (nonatomic, copy) NSArray *anchorCertificates;
+
+/** Resume the TLS session of an earlier connection to the same host, port and client certificate, skipping the full handshake. Defaults to `YES`. */
+@property (nonatomic, assign) BOOL resumeSession;
+
+/** The time in seconds the last handshake took. */
+@property (nonatomic, readonly) NSTimeInterval handshakeDuration;
+
+/** Whether the last handshake resumed an earlier session, which is when the server did not send its certificate. */
+@property (nonatomic, readonly) BOOL sessionResumed;
+
+/** Whether the last write could not be delivered to the socket completely, so it is worth waiting for the socket to become writable. */
+@property (nonatomic, readonly) BOOL writePending;
+
+/** The number of bytes written to the socket that the kernel has not sent yet, or -1 if unknown. */
+@property (nonatomic, readonly) NSInteger unsentLength;
+
+/** The size in bytes of the kernel send buffer of the socket, or -1 if unknown. */
+@property (nonatomic, readonly) NSInteger sendBufferSize;
+
+/** The free space in bytes the kernel send buffer needs before the socket counts as writable, set as `SO_SNDLOWAT` on the socket, also after reconnecting. Defaults to 0, which leaves the socket option as it is. Linux ignores it. */
+@property (nonatomic, assign) NSUInteger sendLowWatermark;
+
 /** @name Initialization */
 
 /** Initialize a connection parameters host name, port, and identity. */
@@ -46,12 +83,26 @@
 /** Drop connection if connected. */
 - (void)disconnect;
 
+/** Counters of all handshakes on this connection, with keys `full` and `resumed` (number of handshakes), and `fullDuration` and `resumedDuration` (average seconds). */
+- (NSDictionary *)handshakeStatistics;
+
 /** @name I/O */
 
 /** Read length number of bytes into mutable data object. */
 - (BOOL)read:(NSMutableData *)data length:(NSUInteger *)length error:(NSError **)error;
 
-/** Write length number of bytes from data object. */
+/** Read at most max bytes into a buffer, sets length to the number of bytes read. */
+- (BOOL)readBytes:(void *)bytes maxLength:(NSUInteger)max length:(NSUInteger *)length error:(NSError **)error;
+
+/** Write length number of bytes from data object, waiting up to `timeout` for the socket to accept all of it. */
 - (BOOL)write:(NSData *)data length:(NSUInteger *)length error:(NSError **)error;
 
+/** @name Waiting */
+
+/** Wait until there is data to read, returns `NO` if none arrived within timeout. When disconnected, it waits the full timeout. */
+- (BOOL)waitForReadWithTimeout:(NSTimeInterval)timeout;
+
+/** Wait until a pending write can make progress, returns `NO` if the socket did not become writable within timeout. */
+- (BOOL)waitForWriteWithTimeout:(NSTimeInterval)timeout;
+
 @end
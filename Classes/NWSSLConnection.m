@@ -6,17 +6,34 @@
 //
 
 #import "NWSSLConnection.h"
+#import "NWResolver.h"
+#import "NWMetrics.h"
+#import "NWSecTools.h"
+#import <CommonCrypto/CommonDigest.h>
 #include <netdb.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 
-#define NWSSL_HANDSHAKE_TRY_COUNT 1 << 26
+static NSTimeInterval const NWSSLConnectionTimeout = 10;
+#define NWSSLConnectRaceCount 3
+
+typedef struct {
+    int socket;
+    BOOL blocked;
+} NWSSLSocket;
 
 OSStatus NWSSLRead(SSLConnectionRef connection, void *data, size_t *length);
 OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *length);
+int NWSSLPoll(struct pollfd *fds, nfds_t count, NSTimeInterval timeout);
+int NWSSLStartConnect(const struct sockaddr *address, socklen_t length, int *error);
 
 
 @implementation NWSSLConnection {
-    int _socket;
+    NWSSLSocket _io;
     SSLContextRef _context;
+    NSRecursiveLock *_lock;
+    NSUInteger _handshakes[2];
+    NSTimeInterval _handshakeTimes[2];
 }
 
 - (instancetype)init
@@ -31,7 +48,10 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
         _host = host;
         _port = port;
         _identity = identity;
-        _socket = -1;
+        _timeout = NWSSLConnectionTimeout;
+        _resumeSession = YES;
+        _io.socket = -1;
+        _lock = [[NSRecursiveLock alloc] init];
     }
     return self;
 }
@@ -44,6 +64,14 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
 #pragma mark - Connecting
 
 - (BOOL)connectWithError:(NSError *__autoreleasing *)error
+{
+    [_lock lock];
+    BOOL connected = [self connectLockedWithError:error];
+    [_lock unlock];
+    return connected;
+}
+
+- (BOOL)connectLockedWithError:(NSError *__autoreleasing *)error
 {
     [self disconnect];
     BOOL socket = [self connectSocketWithError:error];
@@ -66,34 +94,57 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
 
 - (BOOL)connectSocketWithError:(NSError *__autoreleasing *)error
 {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorSocketCreate reason:sock error:error];
-    }
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    struct hostent *entr = gethostbyname(_host.UTF8String);
-    if (!entr) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorSocketResolveHostName error:error];
-    }
-    struct in_addr host;
-    memcpy(&host, entr->h_addr, sizeof(struct in_addr));
-    addr.sin_addr = host;
-    addr.sin_port = htons((u_short)_port);
-    addr.sin_family = AF_INET;
-    int conn = connect(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
-    if (conn < 0) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorSocketConnect reason:conn error:error];
-    }
-    int cntl = fcntl(sock, F_SETFL, O_NONBLOCK);
-    if (cntl < 0) {
-        return [NWErrorUtil noWithErrorCode:kNWErrorSocketFileControl reason:cntl error:error];
-    }
-    int set = 1, sopt = setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int));
+    NSArray *addresses = [NWResolver.sharedResolver addressesForHost:_host port:_port error:error];
+    if (!addresses) {
+        return NO;
+    }
+    NSUInteger count = MIN(addresses.count, NWSSLConnectRaceCount);
+    struct pollfd fds[NWSSLConnectRaceCount];
+    NSUInteger pending = 0;
+    int err = 0;
+    for (NSUInteger i = 0; i < count; i++) {
+        NSData *address = addresses[(_addressOffset + i) % addresses.count];
+        fds[i] = (struct pollfd){NWSSLStartConnect(address.bytes, (socklen_t)address.length, &err), POLLOUT, 0};
+        if (fds[i].fd >= 0) pending++;
+    }
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:_timeout];
+    while (pending && _io.socket < 0 && NWSSLPoll(fds, (nfds_t)count, deadline.timeIntervalSinceNow) > 0) {
+        for (NSUInteger i = 0; i < count; i++) {
+            if (fds[i].fd < 0 || !fds[i].revents) {
+                continue;
+            }
+            int e = 0;
+            socklen_t len = sizeof(int);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &e, &len) < 0) e = errno;
+            if (!e && _io.socket < 0) {
+                _io.socket = fds[i].fd;
+                _address = addresses[(_addressOffset + i) % addresses.count];
+            } else {
+                if (e) err = e;
+                close(fds[i].fd);
+            }
+            fds[i].fd = -1;
+            pending--;
+        }
+    }
+    for (NSUInteger i = 0; i < count; i++) {
+        if (fds[i].fd >= 0) close(fds[i].fd);
+    }
+    if (_io.socket < 0) {
+        [NWResolver.sharedResolver removeAddressesForHost:_host port:_port];
+        if (pending) {
+            return [NWErrorUtil noWithErrorCode:kNWErrorSocketConnectTimeout error:error];
+        }
+        return [NWErrorUtil noWithErrorCode:kNWErrorSocketConnect reason:err error:error];
+    }
+    int set = 1, sopt = setsockopt(_io.socket, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int));
     if (sopt < 0) {
         return [NWErrorUtil noWithErrorCode:kNWErrorSocketOptions reason:sopt error:error];
     }
-    _socket = sock;
+    if (_sendLowWatermark) {
+        int lowat = (int)_sendLowWatermark;
+        setsockopt(_io.socket, SOL_SOCKET, SO_SNDLOWAT, &lowat, sizeof(lowat));
+    }
     return YES;
 }
 
@@ -107,7 +158,7 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
     if (setio != errSecSuccess) {
         return [NWErrorUtil noWithErrorCode:kNWErrorSSLIOFuncs reason:setio error:error];
     }
-    OSStatus setconn = SSLSetConnection(context, (SSLConnectionRef)(NSInteger)_socket);
+    OSStatus setconn = SSLSetConnection(context, (SSLConnectionRef)&_io);
     if (setconn != errSecSuccess) {
         return [NWErrorUtil noWithErrorCode:kNWErrorSSLConnection reason:setconn error:error];
     }
@@ -119,16 +170,63 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
     if (setcert != errSecSuccess) {
         return [NWErrorUtil noWithErrorCode:kNWErrorSSLCertificate reason:setcert error:error];
     }
+    // the handshake pauses when the server has sent its certificate, which it does not when resuming a session
+    OSStatus setbreak = SSLSetSessionOption(context, kSSLSessionOptionBreakOnServerAuth, true);
+    if (setbreak != errSecSuccess) {
+        return [NWErrorUtil noWithErrorCode:kNWErrorSSLContext reason:setbreak error:error];
+    }
+    if (_resumeSession) {
+        NSData *peer = self.peerID;
+        SSLSetPeerID(context, peer.bytes, peer.length);
+    }
     _context = context;
     return YES;
 }
 
+// Sessions are cached by host, port and certificate. The certificate is identified by its SHA-256, as CFHash can collide and differs between identity objects of the same certificate.
+- (NSData *)peerID
+{
+    NSMutableData *result = [[[NSString stringWithFormat:@"%@:%lu:", _host, (unsigned long)_port] dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    NWCertificateRef certificate = [NWSecTools certificateWithIdentity:_identity error:nil];
+    NSData *data = certificate ? CFBridgingRelease(SecCertificateCopyData((__bridge SecCertificateRef)certificate)) : nil;
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH] = {0};
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest);
+    [result appendBytes:digest length:sizeof(digest)];
+    return result;
+}
+
 - (BOOL)handshakeSSLWithError:(NSError *__autoreleasing *)error
 {
-    OSStatus status = errSSLWouldBlock;
-    for (NSUInteger i = 0; i < NWSSL_HANDSHAKE_TRY_COUNT && status == errSSLWouldBlock; i++) {
+    NSDate *start = [NSDate date];
+    NSDate *deadline = [start dateByAddingTimeInterval:_timeout];
+    // blocked only tells which way the handshake waits if it is reset before every call
+    _io.blocked = NO;
+    BOOL authenticated = NO;
+    OSStatus status = SSLHandshake(_context);
+    while (status == errSSLWouldBlock || status == errSSLServerAuthCompleted) {
+        if (status == errSSLServerAuthCompleted) {
+            authenticated = YES;
+            if (![self trustsPeer]) {
+                status = errSSLXCertChainInvalid;
+                break;
+            }
+        } else {
+            struct pollfd fd = {_io.socket, _io.blocked ? POLLOUT : POLLIN, 0};
+            if (NWSSLPoll(&fd, 1, deadline.timeIntervalSinceNow) <= 0) {
+                break;
+            }
+        }
+        _io.blocked = NO;
         status = SSLHandshake(_context);
     }
+    if (status == errSecSuccess) {
+        _sessionResumed = !authenticated;
+        _handshakeDuration = -start.timeIntervalSinceNow;
+        _handshakes[_sessionResumed]++;
+        _handshakeTimes[_sessionResumed] += _handshakeDuration;
+        NWMetricsAdd(kNWMetricHandshakes, 1);
+        NWHistogramRecord(kNWHistogramHandshake, (uint64_t)(_handshakeDuration * NSEC_PER_SEC));
+    }
     switch (status) {
         case errSecSuccess: return YES;
         case errSSLWouldBlock: return [NWErrorUtil noWithErrorCode:kNWErrorSSLHandshakeTimeout error:error];
@@ -152,20 +250,59 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
     return [NWErrorUtil noWithErrorCode:kNWErrorSSLHandshakeFail reason:status error:error];
 }
 
+- (BOOL)trustsPeer
+{
+    SecTrustRef trust = NULL;
+    if (SSLCopyPeerTrust(_context, &trust) != errSecSuccess || !trust) {
+        return NO;
+    }
+    // the trust checks the host name, against the system roots unless anchors are set
+    SecTrustResultType result = kSecTrustResultInvalid;
+    BOOL trusted = (!_anchorCertificates.count || SecTrustSetAnchorCertificates(trust, (__bridge CFArrayRef)_anchorCertificates) == errSecSuccess)
+        && SecTrustEvaluate(trust, &result) == errSecSuccess
+        && (result == kSecTrustResultUnspecified || result == kSecTrustResultProceed);
+    CFRelease(trust);
+    return trusted;
+}
+
 - (void)disconnect
 {
+    [_lock lock];
+    _address = nil;
     if (_context) SSLClose(_context);
-    if (_socket >= 0) close(_socket); _socket = -1;
+    if (_io.socket >= 0) close(_io.socket); _io.socket = -1;
+    _io.blocked = NO;
     if (_context) CFRelease(_context); _context = NULL;
+    [_lock unlock];
+}
+
+- (NSDictionary *)handshakeStatistics
+{
+    [_lock lock];
+    NSDictionary *result = @{
+        @"full": @(_handshakes[0]),
+        @"resumed": @(_handshakes[1]),
+        @"fullDuration": @(_handshakes[0] ? _handshakeTimes[0] / _handshakes[0] : 0),
+        @"resumedDuration": @(_handshakes[1] ? _handshakeTimes[1] / _handshakes[1] : 0),
+    };
+    [_lock unlock];
+    return result;
 }
 
 #pragma mark - Read Write
 
 - (BOOL)read:(NSMutableData *)data length:(NSUInteger *)length error:(NSError *__autoreleasing *)error
+{
+    return [self readBytes:data.mutableBytes maxLength:data.length length:length error:error];
+}
+
+- (BOOL)readBytes:(void *)bytes maxLength:(NSUInteger)max length:(NSUInteger *)length error:(NSError *__autoreleasing *)error
 {
     *length = 0;
     size_t processed = 0;
-    OSStatus status = SSLRead(_context, data.mutableBytes, data.length, &processed);
+    [_lock lock];
+    OSStatus status = SSLRead(_context, bytes, max, &processed);
+    [_lock unlock];
     *length = processed;
     switch (status) {
         case errSecSuccess: return YES;
@@ -180,9 +317,25 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
 - (BOOL)write:(NSData *)data length:(NSUInteger *)length error:(NSError *__autoreleasing *)error
 {
     *length = 0;
-    size_t processed = 0;
-    OSStatus status = SSLWrite(_context, data.bytes, data.length, &processed);
-    *length = processed;
+    NSDate *deadline = nil;
+    OSStatus status = errSecSuccess;
+    do {
+        size_t processed = 0;
+        uint64_t start = NWMetricsNow();
+        [_lock lock];
+        _io.blocked = NO;
+        status = SSLWrite(_context, (const char *)data.bytes + *length, data.length - *length, &processed);
+        [_lock unlock];
+        NWHistogramRecord(kNWHistogramWrite, NWMetricsNow() - start);
+        NWHistogramRecord(kNWHistogramWriteSize, processed);
+        NWMetricsAdd(kNWMetricWrites, 1);
+        NWMetricsAdd(kNWMetricWriteBytes, (int64_t)processed);
+        *length += processed;
+        if (status != errSSLWouldBlock) {
+            break;
+        }
+        deadline = deadline ?: [NSDate dateWithTimeIntervalSinceNow:_timeout];
+    } while ([self waitForWriteWithTimeout:deadline.timeIntervalSinceNow]);
     switch (status) {
         case errSecSuccess: return YES;
         case errSSLWouldBlock: return YES;
@@ -193,15 +346,88 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
     return [NWErrorUtil noWithErrorCode:kNWErrorWriteFail reason:status error:error];
 }
 
+#pragma mark - Waiting
+
+- (BOOL)writePending
+{
+    return _io.blocked;
+}
+
+- (int)socket
+{
+    [_lock lock];
+    int socket = _io.socket;
+    [_lock unlock];
+    return socket;
+}
+
+- (NSInteger)unsentLength
+{
+    int unsent = 0;
+    int socket = self.socket;
+#if defined(SO_NWRITE)
+    socklen_t size = sizeof(unsent);
+    int status = socket >= 0 ? getsockopt(socket, SOL_SOCKET, SO_NWRITE, &unsent, &size) : -1;
+#elif defined(TIOCOUTQ)
+    int status = socket >= 0 ? ioctl(socket, TIOCOUTQ, &unsent) : -1;
+#else
+    int status = -1;
+#endif
+    return status ? -1 : unsent;
+}
+
+- (NSInteger)sendBufferSize
+{
+    int size = 0;
+    socklen_t length = sizeof(size);
+    int socket = self.socket;
+    return socket >= 0 && !getsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, &length) ? size : -1;
+}
+
+- (void)setSendLowWatermark:(NSUInteger)sendLowWatermark
+{
+    [_lock lock];
+    _sendLowWatermark = sendLowWatermark;
+    int lowat = (int)sendLowWatermark;
+    if (_io.socket >= 0 && lowat) setsockopt(_io.socket, SOL_SOCKET, SO_SNDLOWAT, &lowat, sizeof(lowat));
+    [_lock unlock];
+}
+
+- (BOOL)hasBufferedRead
+{
+    size_t buffered = 0;
+    [_lock lock];
+    BOOL result = _context && SSLGetBufferedReadSize(_context, &buffered) == errSecSuccess && buffered;
+    [_lock unlock];
+    return result;
+}
+
+- (BOOL)waitForReadWithTimeout:(NSTimeInterval)timeout
+{
+    if (self.hasBufferedRead) {
+        return YES;
+    }
+    // the socket is replaced on reconnect, poll the one current now
+    struct pollfd fd = {self.socket, POLLIN, 0};
+    return NWSSLPoll(&fd, 1, timeout) > 0;
+}
+
+- (BOOL)waitForWriteWithTimeout:(NSTimeInterval)timeout
+{
+    struct pollfd fd = {self.socket, POLLOUT, 0};
+    return fd.fd >= 0 && NWSSLPoll(&fd, 1, timeout) > 0;
+}
+
 @end
 
 OSStatus NWSSLRead(SSLConnectionRef connection, void *data, size_t *length) {
+    const NWSSLSocket *io = connection;
     size_t leng = *length;
     *length = 0;
     size_t read = 0;
     ssize_t rcvd = 0;
     for(; read < leng; read += rcvd) {
-        rcvd = recv((int)connection, (char *)data + read, leng - read, 0);
+        rcvd = recv(io->socket, (char *)data + read, leng - read, 0);
         if (rcvd <= 0) break;
     }
     *length = read;
@@ -219,15 +445,17 @@ OSStatus NWSSLRead(SSLConnectionRef connection, void *data, size_t *length) {
 }
 
 OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *length) {
+    NWSSLSocket *io = (NWSSLSocket *)connection;
     size_t leng = *length;
     *length = 0;
     size_t sent = 0;
     ssize_t wrtn = 0;
     for (; sent < leng; sent += wrtn) {
-        wrtn = write((int)connection, (char *)data + sent, leng - sent);
+        wrtn = write(io->socket, (char *)data + sent, leng - sent);
         if (wrtn <= 0) break;
     }
     *length = sent;
+    io->blocked = wrtn < 0 && errno == EAGAIN;
     if (wrtn > 0 || !leng) {
         return errSecSuccess;
     }
@@ -237,3 +465,29 @@ OSStatus NWSSLWrite(SSLConnectionRef connection, const void *data, size_t *lengt
     }
     return errSecIO;
 }
+
+int NWSSLStartConnect(const struct sockaddr *address, socklen_t length, int *error) {
+    int sock = socket(address->sa_family, SOCK_STREAM, 0);
+    if (sock < 0) {
+        *error = errno;
+        return -1;
+    }
+    if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0 || (connect(sock, address, length) < 0 && errno != EINPROGRESS)) {
+        *error = errno;
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int NWSSLPoll(struct pollfd *fds, nfds_t count, NSTimeInterval timeout) {
+    NSTimeInterval deadline = NSDate.timeIntervalSinceReferenceDate + timeout;
+    for (;;) {
+        int ms = (int)MAX(ceil(timeout * 1000), 0);
+        int ready = poll(fds, count, ms);
+        if (ready >= 0 || errno != EINTR) {
+            return ready;
+        }
+        timeout = deadline - NSDate.timeIntervalSinceReferenceDate;
+    }
+}
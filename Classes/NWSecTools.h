@@ -11,6 +11,8 @@
 /** A collection of tools for reading, converting and inspecting Keychain objects and PKCS #12 files.
 
  This is practically the glue that connects this framework to the Security framework and allows interacting with the OS Keychain and PKCS #12 files. It is mostly an Objective-C around the Security framework, including the benefits of ARC. `NWIdentityRef`, `NWCertificateRef` and `NWKeyRef` represent respectively `SecIdentityRef`, `SecCertificateRef`, `SecKeyRef`. It uses Cocoa-style error handling, so methods return `nil` or `NO` if an error occurred.
+
+ Identities read from PKCS #12 data are cached by a SHA-256 digest of the data and password, so connecting again with the same file does not decode it again. Certificate summary and expiration are cached per certificate, which makes type and environment lookups cheap. Entries are evicted once their certificate has expired (OS X only), or explicitly using the caching methods.
  */
 @interface NWSecTools : NSObject
 
@@ -69,6 +71,17 @@
 + (NSDictionary *)valuesWithCertificate:(NWCertificateRef)certificate keys:(NSArray *)keys error:(NSError **)error;
 #endif
 
+/** @name Caching */
+
+/** Let go of the cached identities read from this PKCS #12 data and password. */
++ (void)removeCachedIdentityWithPKCS12Data:(NSData *)pkcs12 password:(NSString *)password;
+
+/** Let go of all cached identities and certificate details whose certificate has expired. */
++ (void)removeExpiredCachedIdentities;
+
+/** Let go of all cached identities and certificate details, for example after the Keychain has changed. */
++ (void)removeAllCachedIdentities;
+
 // deprecated
 
 + (BOOL)isSandboxIdentity:(NWIdentityRef)identity __deprecated;
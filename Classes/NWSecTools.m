@@ -6,6 +6,10 @@
 //
 
 #import "NWSecTools.h"
+#import <CommonCrypto/CommonDigest.h>
+
+
+static NSUInteger const NWSecToolsCacheLimit = 64;
 
 @implementation NWSecTools
 
@@ -31,6 +35,11 @@
     if (!pkcs12.length) {
         return [NWErrorUtil nilWithErrorCode:kNWErrorPKCS12EmptyData error:error];
     }
+    NSData *digest = [self digestWithPKCS12Data:pkcs12 password:password];
+    NSArray *cached = [self cachedIdentitiesWithDigest:digest];
+    if (cached) {
+        return cached;
+    }
     NSArray *dicts = [self allIdentitiesWithPKCS12Data:pkcs12 password:password error:error];
     if (!dicts) {
         return nil;
@@ -52,6 +61,7 @@
             }
         }
     }
+    [self cacheIdentities:ids digest:digest];
     return ids;
 }
 
@@ -75,7 +85,9 @@
 + (NWCertType)typeWithCertificate:(NWCertificateRef)certificate summary:(NSString **)summary
 {
     if (summary) *summary = nil;
-    NSString *name = [self plainSummaryWithCertificate:certificate];
+    NSString *name = [self cachedValueWithCertificate:certificate key:@"summary" create:^id{
+        return [self plainSummaryWithCertificate:certificate];
+    }];
     for (NWCertType t = kNWCertTypeNone; t < kNWCertTypeUnknown; t++) {
         NSString *prefix = [self prefixWithCertType:t];
         if (prefix && [name hasPrefix:prefix]) {
@@ -186,6 +198,136 @@
     return result;
 }
 
+#pragma mark - Caching
+
++ (NSMutableDictionary *)identityCache
+{
+    static NSMutableDictionary *cache = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        cache = @{}.mutableCopy;
+    });
+    return cache;
+}
+
++ (NSMapTable *)certificateCache
+{
+    static NSMapTable *cache = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        cache = [NSMapTable strongToStrongObjectsMapTable];
+    });
+    return cache;
+}
+
++ (NSData *)digestWithPKCS12Data:(NSData *)pkcs12 password:(NSString *)password
+{
+    NSData *pass = [password dataUsingEncoding:NSUTF8StringEncoding];
+    uint8_t hasPassword = !!password;
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    CC_SHA256_Update(&context, pkcs12.bytes, (CC_LONG)pkcs12.length);
+    CC_SHA256_Update(&context, &hasPassword, sizeof(hasPassword));
+    CC_SHA256_Update(&context, pass.bytes, (CC_LONG)pass.length);
+    CC_SHA256_Final(digest, &context);
+    return [NSData dataWithBytes:digest length:sizeof(digest)];
+}
+
++ (BOOL)isExpiredEntry:(NSDictionary *)entry
+{
+    NSDate *expiration = entry[@"expiration"];
+    return [expiration isKindOfClass:NSDate.class] && expiration.timeIntervalSinceNow <= 0;
+}
+
++ (NSArray *)cachedIdentitiesWithDigest:(NSData *)digest
+{
+    @synchronized(self) {
+        NSMutableDictionary *cache = [self identityCache];
+        NSDictionary *entry = cache[digest];
+        if (entry && [self isExpiredEntry:entry]) {
+            [cache removeObjectForKey:digest];
+            return nil;
+        }
+        return entry[@"identities"];
+    }
+}
+
++ (void)cacheIdentities:(NSArray *)identities digest:(NSData *)digest
+{
+    NSMutableDictionary *entry = @{@"identities": identities}.mutableCopy;
+#if !TARGET_OS_IPHONE
+    for (NWIdentityRef identity in identities) {
+        NSDate *expiration = [self expirationWithCertificate:[self certificateWithIdentity:identity error:nil]];
+        if (expiration && (!entry[@"expiration"] || [expiration compare:entry[@"expiration"]] == NSOrderedAscending)) {
+            entry[@"expiration"] = expiration;
+        }
+    }
+#endif
+    @synchronized(self) {
+        NSMutableDictionary *cache = [self identityCache];
+        if (cache.count >= NWSecToolsCacheLimit) [self removeExpiredCachedIdentities];
+        if (cache.count >= NWSecToolsCacheLimit) [cache removeAllObjects];
+        cache[digest] = entry;
+    }
+}
+
++ (id)cachedValueWithCertificate:(NWCertificateRef)certificate key:(NSString *)key create:(id(^)(void))create
+{
+    if (!certificate) {
+        return nil;
+    }
+    @synchronized(self) {
+        id value = [[self certificateCache] objectForKey:certificate][key];
+        if (value) {
+            return value == NSNull.null ? nil : value;
+        }
+    }
+    id value = create();
+    @synchronized(self) {
+        NSMapTable *cache = [self certificateCache];
+        NSMutableDictionary *entry = [cache objectForKey:certificate];
+        if (!entry) {
+            if (cache.count >= NWSecToolsCacheLimit) [self removeExpiredCachedIdentities];
+            if (cache.count >= NWSecToolsCacheLimit) [cache removeAllObjects];
+            entry = @{}.mutableCopy;
+            [cache setObject:entry forKey:certificate];
+        }
+        entry[key] = value ?: NSNull.null;
+    }
+    return value;
+}
+
++ (void)removeCachedIdentityWithPKCS12Data:(NSData *)pkcs12 password:(NSString *)password
+{
+    NSData *digest = [self digestWithPKCS12Data:pkcs12 password:password];
+    @synchronized(self) {
+        [[self identityCache] removeObjectForKey:digest];
+    }
+}
+
++ (void)removeExpiredCachedIdentities
+{
+    @synchronized(self) {
+        NSMutableDictionary *identities = [self identityCache];
+        for (NSData *digest in identities.allKeys) {
+            if ([self isExpiredEntry:identities[digest]]) [identities removeObjectForKey:digest];
+        }
+        NSMapTable *certificates = [self certificateCache];
+        for (id certificate in certificates.keyEnumerator.allObjects) {
+            if ([self isExpiredEntry:[certificates objectForKey:certificate]]) [certificates removeObjectForKey:certificate];
+        }
+    }
+}
+
++ (void)removeAllCachedIdentities
+{
+    @synchronized(self) {
+        [[self identityCache] removeAllObjects];
+        [[self certificateCache] removeAllObjects];
+    }
+}
+
 #pragma mark - Sec wrappers
 
 + (NWCertificateRef)certificateWithData:(NSData *)data
@@ -275,7 +417,9 @@
 
 + (NSDate *)expirationWithCertificate:(NWCertificateRef)certificate
 {
-    return [self valueWithCertificate:certificate key:(__bridge id)kSecOIDInvalidityDate];
+    return [self cachedValueWithCertificate:certificate key:@"expiration" create:^id{
+        return [self valueWithCertificate:certificate key:(__bridge id)kSecOIDInvalidityDate];
+    }];
 }
 
 + (id)valueWithCertificate:(NWCertificateRef)certificate key:(id)key
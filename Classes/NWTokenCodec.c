@@ -0,0 +1,136 @@
+//
+//  NWTokenCodec.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWTokenCodec.h"
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif // __SSE2__
+
+
+#pragma mark - Scalar
+
+static const int8_t NWHexValues[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const char NWHexDigits[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+
+static int NWHexDecodeScalar(const unsigned char *hex, size_t length, uint8_t *bytes) {
+    int invalid = 0;
+    for (size_t i = 0; i < length; i++) {
+        int8_t hi = NWHexValues[hex[i * 2]];
+        int8_t lo = NWHexValues[hex[i * 2 + 1]];
+        invalid |= hi | lo;
+        bytes[i] = (uint8_t)(((hi & 0x0F) << 4) | (lo & 0x0F));
+    }
+    return invalid >= 0;
+}
+
+static void NWHexEncodeScalar(const uint8_t *bytes, size_t length, char *hex) {
+    for (size_t i = 0; i < length; i++) {
+        hex[i * 2] = NWHexDigits[bytes[i] >> 4];
+        hex[i * 2 + 1] = NWHexDigits[bytes[i] & 0x0F];
+    }
+}
+
+
+#pragma mark - SSE2
+
+#if defined(__SSE2__)
+
+// Decodes 32 hex characters into 16 bytes, returns false if any character is not hex.
+static inline int NWHexDecode16(const char *hex, uint8_t *bytes) {
+    __m128i result[2];
+    int mask = 0xFFFF;
+    for (int i = 0; i < 2; i++) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(hex + i * 16));
+        __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+        __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(-1)), _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8(-1)), _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+        mask &= _mm_movemask_epi8(_mm_or_si128(digit, alpha));
+        __m128i value = _mm_or_si128(_mm_and_si128(digit, d), _mm_and_si128(alpha, _mm_add_epi8(l, _mm_set1_epi8(10))));
+        // every 16-bit lane holds the high nibble in its low byte and the low nibble in its high byte
+        __m128i high = _mm_slli_epi16(_mm_and_si128(value, _mm_set1_epi16(0x00FF)), 4);
+        result[i] = _mm_or_si128(high, _mm_srli_epi16(value, 8));
+    }
+    _mm_storeu_si128((__m128i *)bytes, _mm_packus_epi16(result[0], result[1]));
+    return mask == 0xFFFF;
+}
+
+// Encodes 16 bytes into 32 upper case hex characters.
+static inline void NWHexEncode16(const uint8_t *bytes, char *hex) {
+    __m128i b = _mm_loadu_si128((const __m128i *)bytes);
+    __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(b, 4), nibble);
+    __m128i lo = _mm_and_si128(b, nibble);
+    __m128i digits[2] = {_mm_unpacklo_epi8(hi, lo), _mm_unpackhi_epi8(hi, lo)};
+    for (int i = 0; i < 2; i++) {
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(digits[i], _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+        __m128i ascii = _mm_add_epi8(_mm_add_epi8(digits[i], _mm_set1_epi8('0')), letter);
+        _mm_storeu_si128((__m128i *)(hex + i * 16), ascii);
+    }
+}
+
+#endif // __SSE2__
+
+
+#pragma mark - Codec
+
+int NWHexDecode(const char *hex, size_t length, uint8_t *bytes) {
+    int valid = 1;
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        valid &= NWHexDecode16(hex + i * 2, bytes + i);
+    }
+#endif // __SSE2__
+    return NWHexDecodeScalar((const unsigned char *)hex + i * 2, length - i, bytes + i) && valid;
+}
+
+void NWHexEncode(const uint8_t *bytes, size_t length, char *hex) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        NWHexEncode16(bytes + i, hex + i * 2);
+    }
+#endif // __SSE2__
+    NWHexEncodeScalar(bytes + i, length - i, hex + i * 2);
+}
+
+size_t NWHexDecodeTokens(const char *hexes, size_t stride, size_t count, uint8_t *tokens, uint8_t *valid) {
+    size_t result = 0;
+    for (size_t i = 0; i < count; i++) {
+        int v = NWHexDecode(hexes + i * stride, NWTokenSize, tokens + i * NWTokenSize);
+        if (valid) valid[i] = (uint8_t)v;
+        result += v;
+    }
+    return result;
+}
+
+void NWHexEncodeTokens(const uint8_t *tokens, size_t count, char *hexes, size_t stride) {
+    for (size_t i = 0; i < count; i++) {
+        NWHexEncode(tokens + i * NWTokenSize, NWTokenSize, hexes + i * stride);
+    }
+}
@@ -0,0 +1,37 @@
+//
+//  NWTokenCodec.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#ifndef _NWTOKENCODEC_H_
+#define _NWTOKENCODEC_H_
+
+/** Size of a binary device token in bytes, its hex representation is twice as long. */
+#define NWTokenSize 32
+
+/** Decodes 2 * length hex characters (upper or lower case) into length bytes, returns false if any character is not hex. */
+extern int NWHexDecode(const char *hex, size_t length, uint8_t *bytes);
+
+/** Encodes length bytes into 2 * length upper case hex characters, not null-terminated. */
+extern void NWHexEncode(const uint8_t *bytes, size_t length, char *hex);
+
+/** Decodes a column of count hex tokens, each 2 * NWTokenSize characters and stride bytes apart, into count * NWTokenSize bytes. Sets valid[i] (optional) to whether token i decoded and returns the number of valid tokens. */
+extern size_t NWHexDecodeTokens(const char *hexes, size_t stride, size_t count, uint8_t *tokens, uint8_t *valid);
+
+/** Encodes count binary tokens into a column of hex tokens, each 2 * NWTokenSize characters and stride bytes apart. */
+extern void NWHexEncodeTokens(const uint8_t *tokens, size_t count, char *hexes, size_t stride);
+
+#endif // _NWTOKENCODEC_H_
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
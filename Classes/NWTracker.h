@@ -0,0 +1,60 @@
+//
+//  NWTracker.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWType.h"
+#import <Foundation/Foundation.h>
+
+@class NWNotification;
+
+/** Keeps track of recently pushed notifications, so error responses can be mapped back to them.
+
+ The APNs only responds with the identifier of a failed notification. This class allows `NWHub` to look up the original notification based on that identifier. It is a fixed-capacity ring buffer indexed by the identifier modulo capacity, which makes adding, looking up and trimming notifications constant-time operations with bounded memory.
+
+ Identifiers are expected to increase by one for every notification, as they do when assigned by `NWHub`. They are treated as 32-bit numbers, the size used on the wire, and may wrap around. If more notifications are added than fit the capacity, the buffer doubles in size up to `maximumCapacity`. Beyond that the oldest ones are dropped, counted in `evicted` and the `kNWMetricTrackerEvictions` metric.
+ */
+@interface NWTracker : NSObject
+
+/** @name Properties */
+
+/** The number of notifications that fit the buffer, a power of two. */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/** The capacity up to which the buffer grows before dropping notifications. Defaults to 4M notifications, enough for 100k pushes per second over 30 seconds. */
+@property (nonatomic, assign) NSUInteger maximumCapacity;
+
+/** The number of notifications dropped while still tracked, because the maximum capacity was reached. */
+@property (nonatomic, readonly) NSUInteger evicted;
+
+/** The number of notifications currently tracked. */
+@property (nonatomic, readonly) NSUInteger count;
+
+/** @name Initialization */
+
+/** Create a tracker that initially holds capacity notifications, rounded up to a power of two. */
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/** @name Tracking */
+
+/** Track the notification under its identifier, marked with the current time. */
+- (void)addNotification:(NWNotification *)notification;
+
+/** Returns the tracked notification with this identifier, or `nil` if it is not (or no longer) tracked. */
+- (NWNotification *)notificationForIdentifier:(NSUInteger)identifier;
+
+/** Returns the number of seconds since the notification with this identifier was added, or -1 if it is not tracked. */
+- (NSTimeInterval)timeSinceAddingIdentifier:(NSUInteger)identifier;
+
+/** Returns, in order, all tracked notifications with an identifier later than this one, taking wraparound into account. */
+- (NSArray *)notificationsAfterIdentifier:(NSUInteger)identifier;
+
+/** Let go of all notifications added more than span seconds ago, returns the number removed. */
+- (NSUInteger)removeNotificationsOlderThan:(NSTimeInterval)span;
+
+/** Let go of all notifications. */
+- (void)removeAllNotifications;
+
+@end
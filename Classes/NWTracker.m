@@ -0,0 +1,198 @@
+//
+//  NWTracker.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWTracker.h"
+#import "NWNotification.h"
+#import "NWMetrics.h"
+
+
+static NSUInteger const NWTrackerDefaultCapacity = 1 << 16;
+static NSUInteger const NWTrackerDefaultMaximumCapacity = 1 << 22;
+
+static inline int64_t NWTrackerNow(void)
+{
+    return (int64_t)(NSDate.timeIntervalSinceReferenceDate * 1000);
+}
+
+@implementation NWTracker {
+    NWNotification * __strong *_notifications;
+    uint32_t *_identifiers;
+    int64_t *_stamps;
+    uint32_t _mask;
+    uint32_t _first;
+    uint32_t _next;
+}
+
+- (instancetype)init
+{
+    return [self initWithCapacity:NWTrackerDefaultCapacity];
+}
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity
+{
+    self = [super init];
+    if (self) {
+        NSUInteger size = 1;
+        while (size < capacity && size < (1UL << 31)) size <<= 1;
+        _maximumCapacity = MAX(size, NWTrackerDefaultMaximumCapacity);
+        if (![self resizeToCapacity:size]) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [self removeAllNotifications];
+    free(_notifications);
+    free(_identifiers);
+    free(_stamps);
+}
+
+#pragma mark - Tracking
+
+- (void)addNotification:(NWNotification *)notification
+{
+    uint32_t identifier = (uint32_t)notification.identifier;
+    if (!_count) {
+        _first = identifier;
+        _next = identifier;
+    }
+    if ((int32_t)(identifier - _next) >= 0) {
+        if (_count && identifier - _first >= _capacity) [self growForIdentifier:identifier];
+        while (_count && identifier - _first >= _capacity) [self evictFirst];
+        if (!_count) _first = identifier;
+        _next = identifier + 1;
+    } else if ((int32_t)(identifier - _first) < 0) {
+        if (_next - identifier > _capacity) {
+            _evicted++;
+            NWMetricsAdd(kNWMetricTrackerEvictions, 1);
+            return;
+        }
+        _first = identifier;
+    }
+    uint32_t slot = identifier & _mask;
+    if (!_notifications[slot]) {
+        _count++;
+        NWMetricsAdd(kNWMetricInFlight, 1);
+    }
+    _notifications[slot] = notification;
+    _identifiers[slot] = identifier;
+    _stamps[slot] = NWTrackerNow();
+}
+
+- (NWNotification *)notificationForIdentifier:(NSUInteger)identifier
+{
+    uint32_t slot = (uint32_t)identifier & _mask;
+    return _identifiers[slot] == (uint32_t)identifier ? _notifications[slot] : nil;
+}
+
+- (NSTimeInterval)timeSinceAddingIdentifier:(NSUInteger)identifier
+{
+    uint32_t slot = (uint32_t)identifier & _mask;
+    if (!_notifications[slot] || _identifiers[slot] != (uint32_t)identifier) {
+        return -1;
+    }
+    return (NWTrackerNow() - _stamps[slot]) / 1000.0;
+}
+
+- (NSArray *)notificationsAfterIdentifier:(NSUInteger)identifier
+{
+    NSMutableArray *result = @[].mutableCopy;
+    uint32_t i = (uint32_t)identifier + 1;
+    if ((int32_t)(i - _first) < 0) i = _first;
+    for (; _count && (int32_t)(_next - i) > 0; i++) {
+        NWNotification *notification = [self notificationForIdentifier:i];
+        if (notification) [result addObject:notification];
+    }
+    return result;
+}
+
+- (NSUInteger)removeNotificationsOlderThan:(NSTimeInterval)span
+{
+    int64_t before = NWTrackerNow() - (int64_t)(span * 1000);
+    NSUInteger count = _count;
+    while (_count) {
+        uint32_t slot = _first & _mask;
+        if (_notifications[slot] && _identifiers[slot] == _first && _stamps[slot] >= before) {
+            break;
+        }
+        [self removeFirst];
+    }
+    return count - _count;
+}
+
+- (void)removeAllNotifications
+{
+    while (_count) [self removeFirst];
+}
+
+- (BOOL)removeFirst
+{
+    uint32_t slot = _first & _mask;
+    BOOL removed = _notifications[slot] && _identifiers[slot] == _first;
+    if (removed) {
+        _notifications[slot] = nil;
+        _count--;
+        NWMetricsAdd(kNWMetricInFlight, -1);
+    }
+    _first++;
+    return removed;
+}
+
+- (void)evictFirst
+{
+    if ([self removeFirst]) {
+        _evicted++;
+        NWMetricsAdd(kNWMetricTrackerEvictions, 1);
+    }
+}
+
+#pragma mark - Growing
+
+- (void)growForIdentifier:(uint32_t)identifier
+{
+    NSUInteger capacity = _capacity;
+    while (identifier - _first >= capacity && capacity < _maximumCapacity) capacity <<= 1;
+    // a jump beyond the maximum evicts everything anyway, no need to grow for that
+    if (identifier - _first < capacity) [self resizeToCapacity:capacity];
+}
+
+- (BOOL)resizeToCapacity:(NSUInteger)capacity
+{
+    NWNotification * __strong *notifications = (NWNotification * __strong *)calloc(capacity, sizeof(NWNotification *));
+    uint32_t *identifiers = calloc(capacity, sizeof(uint32_t));
+    int64_t *stamps = calloc(capacity, sizeof(int64_t));
+    if (!notifications || !identifiers || !stamps) {
+        free(notifications);
+        free(identifiers);
+        free(stamps);
+        return NO;
+    }
+    uint32_t mask = (uint32_t)(capacity - 1);
+    for (uint32_t i = _first; _count && i != _next; i++) {
+        uint32_t slot = i & _mask;
+        if (_notifications[slot] && _identifiers[slot] == i) {
+            notifications[i & mask] = _notifications[slot];
+            identifiers[i & mask] = i;
+            stamps[i & mask] = _stamps[slot];
+            _notifications[slot] = nil;
+        }
+    }
+    free(_notifications);
+    free(_identifiers);
+    free(_stamps);
+    _notifications = notifications;
+    _identifiers = identifiers;
+    _stamps = stamps;
+    _capacity = capacity;
+    _mask = mask;
+    return YES;
+}
+
+@end
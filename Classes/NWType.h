@@ -79,6 +79,14 @@ typedef NS_ENUM(NSInteger, NWError) {
     kNWErrorAPNShutdown                        =  -10,
     /** APN unknown error code. */
     kNWErrorAPNUnknownErrorCode                =  -11,
+    /** APN device token no longer active. */
+    kNWErrorAPNUnregistered                    =  -12,
+    /** APN topic not allowed. */
+    kNWErrorAPNBadTopic                        =  -13,
+    /** APN certificate not accepted. */
+    kNWErrorAPNBadCertificate                  =  -14,
+    /** APN too many requests. */
+    kNWErrorAPNTooManyRequests                 =  -15,
     
     /** Push response command unknown. */
     kNWErrorPushResponseCommand                = -107,
@@ -86,6 +94,18 @@ typedef NS_ENUM(NSInteger, NWError) {
     kNWErrorPushNotConnected                   = -111,
     /** Push not fully sent. */
     kNWErrorPushWriteFail                      = -112,
+    /** Push buffer too small for notification. */
+    kNWErrorPushBufferSize                     = -113,
+    /** Push queue full, try again later. */
+    kNWErrorPushQueueFull                      = -114,
+    /** Push payload is not a JSON object or too long. */
+    kNWErrorPushInvalidPayload                 = -115,
+    /** Push notification expired before sending. */
+    kNWErrorPushExpired                        = -116,
+    /** Journal file cannot be opened or mapped. */
+    kNWErrorJournalOpen                        = -117,
+    /** Journal full, acknowledge frames first. */
+    kNWErrorJournalFull                        = -118,
     
     /** Feedback data length unexpected. */
     kNWErrorFeedbackLength                     = -108,
@@ -102,6 +122,8 @@ typedef NS_ENUM(NSInteger, NWError) {
     kNWErrorSocketFileControl                  = -220,
     /** Socket options cannot be set. */
     kNWErrorSocketOptions                      = -221,
+    /** Socket connecting timeout. */
+    kNWErrorSocketConnectTimeout               = -235,
     
     /** SSL connection cannot be set. */
     kNWErrorSSLConnection                      = -204,
@@ -67,10 +67,20 @@ NSString * descriptionForCertType(NWCertType type)
         case kNWErrorAPNUnknownReason                  : return @"APN unknown reason";
         case kNWErrorAPNShutdown                       : return @"APN shutdown";
         case kNWErrorAPNUnknownErrorCode               : return @"APN unknown error code";
+        case kNWErrorAPNUnregistered                   : return @"APN device token no longer active";
+        case kNWErrorAPNBadTopic                       : return @"APN topic not allowed";
+        case kNWErrorAPNBadCertificate                 : return @"APN certificate not accepted";
+        case kNWErrorAPNTooManyRequests                : return @"APN too many requests";
             
         case kNWErrorPushResponseCommand               : return @"Push response command unknown";
         case kNWErrorPushNotConnected                  : return @"Push reconnect requires connection";
         case kNWErrorPushWriteFail                     : return @"Push not fully sent";
+        case kNWErrorPushBufferSize                    : return @"Push buffer too small for notification";
+        case kNWErrorPushQueueFull                     : return @"Push queue full, try again later";
+        case kNWErrorPushInvalidPayload                : return @"Push payload is not a JSON object or too long";
+        case kNWErrorPushExpired                       : return @"Push notification expired before sending";
+        case kNWErrorJournalOpen                       : return @"Journal file cannot be opened or mapped";
+        case kNWErrorJournalFull                       : return @"Journal full, acknowledge frames first";
             
         case kNWErrorFeedbackLength                    : return @"Feedback data length unexpected";
         case kNWErrorFeedbackTokenLength               : return @"Feedback token length unexpected";
@@ -80,6 +90,7 @@ NSString * descriptionForCertType(NWCertType type)
         case kNWErrorSocketConnect                     : return @"Socket connecting failed";
         case kNWErrorSocketFileControl                 : return @"Socket file control failed";
         case kNWErrorSocketOptions                     : return @"Socket options cannot be set";
+        case kNWErrorSocketConnectTimeout              : return @"Socket connecting timeout";
             
         case kNWErrorSSLConnection                     : return @"SSL connection cannot be set";
         case kNWErrorSSLContext                        : return @"SSL context cannot be created";
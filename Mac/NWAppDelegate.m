@@ -117,7 +117,7 @@
 {
     dispatch_async(dispatch_get_main_queue(), ^{
         //NSLog(@"failed notification: %@ %@ %lu %lu %lu", notification.payload, notification.token, notification.identifier, notification.expires, notification.priority);
-        NWLogWarn(@"Notification error: %@", error.localizedDescription);
+        NWLogWarnMax(10, @"Notification error: %@", error.localizedDescription);
     });
 }
 
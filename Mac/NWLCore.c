@@ -13,6 +13,14 @@
 #include <signal.h>
 #include <unistd.h>
 #include <math.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #import <CoreFoundation/CFDate.h>
 
 #pragma mark - Constants and statics
@@ -36,28 +44,147 @@ typedef struct {
     void *info;
 } NWLPrinter;
 
-typedef struct {
+typedef struct NWLPrinterList {
     int count;
     NWLPrinter elements[kNWLPrinterListSize];
+    // calls in progress that use this list, and the list it replaced
+    _Atomic(int) users;
+    struct NWLPrinterList *previous;
 } NWLPrinterList;
 
 #define NWLDefaultPrinterFunction NWLStderrPrinter
 #define NWLDefaultPrinterName "default"
 #define NWLDefaultFilterTag "warn"
 #define NWLDefaultFilterAction kNWLAction_print
-static NWLFilterList NWLFilters = {1, {NULL, NWLDefaultFilterTag, NULL, NULL, NULL, NWLDefaultFilterAction}};
-static NWLPrinterList NWLPrinters = {1, {NWLDefaultPrinterName, NWLDefaultPrinterFunction, NULL}};
+static NWLFilterList NWLInitialFilters = {1, {NULL, NWLDefaultFilterTag, NULL, NULL, NULL, NWLDefaultFilterAction}};
+static NWLPrinterList NWLInitialPrinters = {1, {NWLDefaultPrinterName, NWLDefaultPrinterFunction, NULL}};
 static CFTimeInterval NWLTimeOffset = 0;
 
+// The filter and printer lists are copy-on-write: changes are made to a copy, which is then published atomically.
+// Readers never lock, so replaced lists are never freed; they are small and configuration changes are rare.
+// Printer calls count themselves in the list they use, so removing a printer can wait until no call is inside it.
+static _Atomic(NWLFilterList *) NWLFilters = &NWLInitialFilters;
+static _Atomic(NWLPrinterList *) NWLPrinters = &NWLInitialPrinters;
+static pthread_mutex_t NWLConfigLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define NWLRingSize (64 * 1024)
+#define NWLRecordSkip UINT32_MAX
+#define NWLMessageMaxLength (NWLRingSize / 8)
+#define NWLBatchSize 64
+static const double kNWLDrainInterval = 0.01;
+
+// A line queued in async mode, followed by its message bytes.
+typedef struct {
+    uint32_t size;
+    uint32_t length;
+    NWLContext context;
+} NWLRecord;
+
+// A single-producer, single-consumer queue of records, owned by one thread at a time and drained by the drainer.
+typedef struct NWLRing {
+    struct NWLRing *next;
+    _Atomic(int) owned;
+    _Atomic(size_t) head;
+    _Atomic(size_t) tail;
+    _Atomic(unsigned long) dropped;
+    unsigned long reported;
+    char bytes[NWLRingSize];
+} NWLRing;
+
+static _Atomic(int) NWLAsync = 0;
+static _Atomic(NWLRing *) NWLRings = NULL;
+static _Thread_local NWLRing *NWLThreadRing = NULL;
+static pthread_key_t NWLRingKey;
+static pthread_once_t NWLRingOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t NWLDrainLock = PTHREAD_MUTEX_INITIALIZER;
+static dispatch_source_t NWLDrainTimer = NULL;
+
+static void NWLEnqueue(NWLContext context, CFStringRef message);
+
+static const double kNWLReportInterval = 2;
+
+// Rate-limited log statements are registered on first use, to report their suppressed lines periodically.
+static NWLLimit *NWLLimits = NULL;
+static dispatch_source_t NWLReportTimer = NULL;
+
+
+#pragma mark - Configuration lists
+
+static NWLFilterList *NWLCopyFilters(void) {
+    NWLFilterList *result = malloc(sizeof(NWLFilterList));
+    *result = *atomic_load_explicit(&NWLFilters, memory_order_acquire);
+    return result;
+}
+
+static NWLPrinterList *NWLCopyPrinters(void) {
+    NWLPrinterList *current = atomic_load_explicit(&NWLPrinters, memory_order_acquire);
+    NWLPrinterList *result = malloc(sizeof(NWLPrinterList));
+    result->count = current->count;
+    memcpy(result->elements, current->elements, sizeof(result->elements));
+    atomic_init(&result->users, 0);
+    result->previous = current;
+    return result;
+}
+
+// Every log statement caches its action together with the generation it was resolved in.
+unsigned int NWLFilterGeneration = kNWLSiteActionMask + 1;
+
+static void NWLPublishFilters(NWLFilterList *filters) {
+    atomic_store_explicit(&NWLFilters, filters, memory_order_release);
+    unsigned int generation = __atomic_load_n(&NWLFilterGeneration, __ATOMIC_RELAXED) + kNWLSiteActionMask + 1;
+    if (!generation) generation += kNWLSiteActionMask + 1;
+    __atomic_store_n(&NWLFilterGeneration, generation, __ATOMIC_RELEASE);
+}
+
+static void NWLPublishPrinters(NWLPrinterList *printers) {
+    atomic_store(&NWLPrinters, printers);
+}
+
+// Returns the current list, counted as in use until released. The list is checked again after counting, so a
+// change published in between is either seen here, or sees this call in the count.
+static NWLPrinterList *NWLAcquirePrinters(void) {
+    for (;;) {
+        NWLPrinterList *printers = atomic_load(&NWLPrinters);
+        atomic_fetch_add(&printers->users, 1);
+        if (atomic_load(&NWLPrinters) == printers) return printers;
+        atomic_fetch_sub_explicit(&printers->users, 1, memory_order_release);
+    }
+}
+
+// Waits for the calls that still use a list replaced before printers was published, and with it a removed printer.
+static void NWLWaitForPrinters(const NWLPrinterList *printers) {
+    for (NWLPrinterList *list = printers->previous; list; list = list->previous) {
+        while (atomic_load(&list->users)) sched_yield();
+    }
+}
+
 
 #pragma mark - Printing
 
 void NWLForwardToPrinters(NWLContext context, CFStringRef message) {
-    for (int i = 0; i < NWLPrinters.count; i++) {
-        NWLPrinter *printer = &NWLPrinters.elements[i];
+    NWLPrinterList *printers = NWLAcquirePrinters();
+    for (int i = 0; i < printers->count; i++) {
+        const NWLPrinter *printer = &printers->elements[i];
         void(*func)(NWLContext, CFStringRef, void *) = printer->func;
         func(context, message, printer->info);
     }
+    atomic_fetch_sub_explicit(&printers->users, 1, memory_order_release);
+}
+
+static void NWLForwardMessage(NWLContext context, CFStringRef message, NWLAction action) {
+    if (atomic_load_explicit(&NWLAsync, memory_order_relaxed)) {
+        NWLEnqueue(context, message);
+        if (action == kNWLAction_break) {
+            NWLFlush();
+            NWLBreakInDebugger();
+        }
+        return;
+    }
+    switch (action) {
+        case kNWLAction_print: NWLForwardToPrinters(context, message); break;
+        case kNWLAction_break: NWLForwardToPrinters(context, message); NWLBreakInDebugger(); break;
+        default: CFShow(message); break;
+    }
 }
 
 void NWLForwardWithoutFilter(NWLContext context, CFStringRef format, ...) {
@@ -65,7 +192,7 @@ void NWLForwardWithoutFilter(NWLContext context, CFStringRef format, ...) {
     va_start(arglist, format);
     CFStringRef message = CFStringCreateWithFormatAndArguments(NULL, 0, format, arglist);
     va_end(arglist);
-    NWLForwardToPrinters(context, message);
+    NWLForwardMessage(context, message, kNWLAction_print);
     CFRelease(message);
 }
 
@@ -76,45 +203,87 @@ void NWLForwardWithFilter(NWLContext context, CFStringRef format, ...) {
         va_start(arglist, format);
         CFStringRef message = CFStringCreateWithFormatAndArguments(NULL, 0, format, arglist);
         va_end(arglist);
-        switch (type) {
-            case kNWLAction_print: NWLForwardToPrinters(context, message); break;
-            case kNWLAction_break: NWLForwardToPrinters(context, message); NWLBreakInDebugger(); break;
-            default: CFShow(message); break;
-        }
+        NWLForwardMessage(context, message, type);
+        CFRelease(message);
+    }
+}
+
+static NWLAction NWLSiteAction(unsigned int *site, NWLContext context) {
+    unsigned int state = __atomic_load_n(site, __ATOMIC_RELAXED);
+    unsigned int generation = __atomic_load_n(&NWLFilterGeneration, __ATOMIC_ACQUIRE);
+    NWLAction type = state & kNWLSiteActionMask;
+    if ((state & ~kNWLSiteActionMask) != generation) {
+        type = NWLMatchingActionForContext(context);
+        __atomic_store_n(site, generation | type, __ATOMIC_RELAXED);
+    }
+    return type;
+}
+
+void NWLForwardWithSite(unsigned int *site, NWLContext context, CFStringRef format, ...) {
+    NWLAction type = NWLSiteAction(site, context);
+    if (type) {
+        va_list arglist;
+        va_start(arglist, format);
+        CFStringRef message = CFStringCreateWithFormatAndArguments(NULL, 0, format, arglist);
+        va_end(arglist);
+        NWLForwardMessage(context, message, type);
         CFRelease(message);
     }
 }
 
 int NWLAddPrinter(const char *name, void(*func)(NWLContext, CFStringRef, void *), void *info) {
-    int count = NWLPrinters.count;
+    int result = false;
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLPrinterList *printers = NWLCopyPrinters();
+    int count = printers->count;
     if (count < kNWLPrinterListSize) {
         NWLPrinter printer = {name, func, info};
-        NWLPrinters.elements[count] = printer;
-        NWLPrinters.count = count + 1;
-        return true;
+        printers->elements[count] = printer;
+        printers->count = count + 1;
+        NWLPublishPrinters(printers);
+        result = true;
+    } else {
+        free(printers);
     }
-    return false;
+    pthread_mutex_unlock(&NWLConfigLock);
+    return result;
 }
 
 void * NWLRemovePrinter(const char *name) {
-    for (int i = NWLPrinters.count - 1; i >= 0; i--) {
-        NWLPrinter *p = &NWLPrinters.elements[i];
+    void *result = NULL;
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLPrinterList *printers = NWLCopyPrinters();
+    for (int i = printers->count - 1; i >= 0; i--) {
+        NWLPrinter *p = &printers->elements[i];
         const char *n = p->name;
         if (n == name || (n && name && !strcasecmp(n, name))) {
-            int count = NWLPrinters.count;
+            int count = printers->count;
             if (count > 0) {
-                void *info = p->info;
-                NWLPrinters.count = count - 1;
-                NWLPrinters.elements[i] = NWLPrinters.elements[count - 1];
-                return info;
+                result = p->info;
+                printers->count = count - 1;
+                printers->elements[i] = printers->elements[count - 1];
+                break;
             }
         }
     }
-    return NULL;
+    NWLPublishPrinters(printers);
+    pthread_mutex_unlock(&NWLConfigLock);
+    // wait for a drain or a synchronous call that may still be using the removed printer
+    pthread_mutex_lock(&NWLDrainLock);
+    pthread_mutex_unlock(&NWLDrainLock);
+    NWLWaitForPrinters(printers);
+    return result;
 }
 
 void NWLRemoveAllPrinters(void) {
-    NWLPrinters.count = 0;
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLPrinterList *printers = NWLCopyPrinters();
+    printers->count = 0;
+    NWLPublishPrinters(printers);
+    pthread_mutex_unlock(&NWLConfigLock);
+    pthread_mutex_lock(&NWLDrainLock);
+    pthread_mutex_unlock(&NWLDrainLock);
+    NWLWaitForPrinters(printers);
 }
 
 void NWLAddDefaultPrinter(void) {
@@ -126,49 +295,32 @@ void NWLRestoreDefaultPrinters(void) {
     NWLAddDefaultPrinter();
 }
 
-void NWLStderrPrinter(NWLContext context, CFStringRef message, void *info) {
-    // init io vector
-    struct iovec iov[16];
-    int i = 0;
-    iov[i].iov_base = "[";
-    iov[i++].iov_len = 1;
-
-    // add time
+static int NWLStderrPrefix(NWLContext context, char *buffer, int size) {
     int hour = 0, minute = 0, second = 0, micro = 0;
     NWLClock(context.time, &hour, &minute, &second, &micro);
-    char timeBuffer[16];
-    int timeLength = snprintf(timeBuffer, sizeof(timeBuffer), "%02i:%02i:%02i.%06i", hour, minute, second, micro);
-    iov[i].iov_base = timeBuffer;
-    iov[i++].iov_len = sizeof(timeBuffer) - 1 < timeLength ? sizeof(timeBuffer) - 1 : timeLength;
-
-    // add context
+    int length = snprintf(buffer, size, "[%02i:%02i:%02i.%06i", hour, minute, second, micro);
+#define _NWL_APPEND_(_fmt, ...) do {if (length < size) length += snprintf(buffer + length, size - length, _fmt, ##__VA_ARGS__);} while (0)
     if (context.lib && *context.lib) {
-        iov[i].iov_base = " ";
-        iov[i++].iov_len = 1;
-        iov[i].iov_base = (void *)context.lib;
-        iov[i++].iov_len = strnlen(context.lib, 32);
+        _NWL_APPEND_(" %.32s", context.lib);
     }
     if (context.file && *context.file) {
-        iov[i].iov_base = " ";
-        iov[i++].iov_len = 1;
-        iov[i].iov_base = (void *)context.file;
-        iov[i++].iov_len = strnlen(context.file, 32);
-        iov[i].iov_base = ":";
-        iov[i++].iov_len = 1;
-        char lineBuffer[10];
-        int lineLength = snprintf(lineBuffer, sizeof(lineBuffer), context.line < 1000 ? "%03u" : "%06u", context.line);
-        iov[i].iov_base = lineBuffer;
-        iov[i++].iov_len = sizeof(lineBuffer) - 1 < lineLength ? sizeof(lineBuffer) - 1 : lineLength;
+        _NWL_APPEND_(context.line < 1000 ? " %.32s:%03u" : " %.32s:%06u", context.file, context.line);
     }
     if (context.tag && *context.tag) {
-        iov[i].iov_base = "] [";
-        iov[i++].iov_len = 3;
-        iov[i].iov_base = (void *)context.tag;
-        iov[i++].iov_len = strnlen(context.tag, 32);
+        _NWL_APPEND_("] [%.32s", context.tag);
     }
+    _NWL_APPEND_("] ");
+#undef _NWL_APPEND_
+    return length < size ? length : size - 1;
+}
 
-    iov[i].iov_base = "] ";
-    iov[i++].iov_len = 2;
+void NWLStderrPrinter(NWLContext context, CFStringRef message, void *info) {
+    // init io vector with prefix
+    struct iovec iov[4];
+    int i = 0;
+    char prefixBuffer[160];
+    iov[i].iov_base = prefixBuffer;
+    iov[i++].iov_len = NWLStderrPrefix(context, prefixBuffer, sizeof(prefixBuffer));
 
     CFRange range = CFRangeMake(0, message ? CFStringGetLength(message) : 0);
     if (range.length) {
@@ -200,14 +352,564 @@ void NWLStderrPrinter(NWLContext context, CFStringRef message, void *info) {
     }
 }
 
+// Prints a batch of queued lines to stderr with a single writev.
+static void NWLStderrPrintRecords(const NWLRecord **records, int count) {
+    struct iovec iov[NWLBatchSize * 3];
+    char prefixBuffer[NWLBatchSize][160];
+    int i = 0;
+    for (int r = 0; r < count; r++) {
+        iov[i].iov_base = prefixBuffer[r];
+        iov[i++].iov_len = NWLStderrPrefix(records[r]->context, prefixBuffer[r], sizeof(prefixBuffer[r]));
+        iov[i].iov_base = (void *)(records[r] + 1);
+        iov[i++].iov_len = records[r]->length;
+        iov[i].iov_base = "\n";
+        iov[i++].iov_len = 1;
+    }
+    writev(STDERR_FILENO, iov, i);
+}
+
+
+#pragma mark - Async
+
+static void NWLRingRelease(void *ring) {
+    atomic_store(&((NWLRing *)ring)->owned, 0);
+}
+
+static void NWLRingKeyCreate(void) {
+    pthread_key_create(&NWLRingKey, NWLRingRelease);
+}
+
+// Returns the ring of the current thread, taking over the ring of an exited thread if there is one.
+static NWLRing *NWLRingForThread(void) {
+    NWLRing *ring = NWLThreadRing;
+    if (ring) {
+        return ring;
+    }
+    pthread_once(&NWLRingOnce, NWLRingKeyCreate);
+    for (ring = atomic_load(&NWLRings); ring; ring = ring->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&ring->owned, &expected, 1)) break;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(NWLRing));
+        atomic_init(&ring->owned, 1);
+        ring->next = atomic_load(&NWLRings);
+        while (!atomic_compare_exchange_weak(&NWLRings, &ring->next, ring));
+    }
+    pthread_setspecific(NWLRingKey, ring);
+    NWLThreadRing = ring;
+    return ring;
+}
+
+static int NWLRingPush(NWLRing *ring, NWLContext context, const char *bytes, uint32_t length) {
+    size_t size = (sizeof(NWLRecord) + length + 7) & ~(size_t)7;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t offset = head % NWLRingSize;
+    size_t pad = NWLRingSize - offset < size ? NWLRingSize - offset : 0;
+    if (head + pad + size - tail > NWLRingSize) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    if (pad) {
+        NWLRecord *skip = (NWLRecord *)(ring->bytes + offset);
+        skip->size = (uint32_t)pad;
+        skip->length = NWLRecordSkip;
+        offset = 0;
+    }
+    NWLRecord *record = (NWLRecord *)(ring->bytes + offset);
+    record->size = (uint32_t)size;
+    record->length = length;
+    record->context = context;
+    memcpy(record + 1, bytes, length);
+    atomic_store_explicit(&ring->head, head + pad + size, memory_order_release);
+    return true;
+}
+
+// Queues the UTF-8 bytes of the message, without any system call.
+static void NWLEnqueue(NWLContext context, CFStringRef message) {
+    char buffer[1024];
+    char *bytes = buffer;
+    CFRange range = CFRangeMake(0, message ? CFStringGetLength(message) : 0);
+    CFIndex length = 0;
+    CFIndex converted = CFStringGetBytes(message, range, kCFStringEncodingUTF8, '?', false, (UInt8 *)buffer, sizeof(buffer), &length);
+    if (converted < range.length) {
+        CFStringGetBytes(message, range, kCFStringEncodingUTF8, '?', false, NULL, 0, &length);
+        if (length > NWLMessageMaxLength) length = NWLMessageMaxLength;
+        bytes = malloc(length);
+        CFStringGetBytes(message, range, kCFStringEncodingUTF8, '?', false, (UInt8 *)bytes, length, &length);
+    }
+    NWLRingPush(NWLRingForThread(), context, bytes, (uint32_t)length);
+    if (bytes != buffer) free(bytes);
+}
+
+static void NWLForwardRecords(const NWLPrinterList *printers, const NWLRecord **records, int count) {
+    for (int i = 0; i < printers->count; i++) {
+        const NWLPrinter *printer = &printers->elements[i];
+        if (printer->func == NWLStderrPrinter) {
+            NWLStderrPrintRecords(records, count);
+            continue;
+        }
+        for (int r = 0; r < count; r++) {
+            // printers may keep the message after returning, e.g. in a dispatch_async, while the ring slot is reused
+            CFStringRef message = CFStringCreateWithBytes(NULL, (const UInt8 *)(records[r] + 1), records[r]->length, kCFStringEncodingUTF8, false);
+            printer->func(records[r]->context, message, printer->info);
+            if (message) CFRelease(message);
+        }
+    }
+}
+
+static void NWLDrainRing(NWLRing *ring, const NWLPrinterList *printers) {
+    const NWLRecord *records[NWLBatchSize];
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail != head) {
+        int count = 0;
+        size_t end = tail;
+        while (end != head && count < NWLBatchSize) {
+            const NWLRecord *record = (const NWLRecord *)(ring->bytes + end % NWLRingSize);
+            if (record->length != NWLRecordSkip) records[count++] = record;
+            end += record->size;
+        }
+        if (count) NWLForwardRecords(printers, records, count);
+        tail = end;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->reported) {
+        NWLContext context = {"warn", "NWLogging", NULL, 0, NULL, NWLTime()};
+        CFStringRef message = CFStringCreateWithFormat(NULL, 0, CFSTR("Dropped %lu log lines, queue full"), dropped - ring->reported);
+        NWLForwardToPrinters(context, message);
+        CFRelease(message);
+        ring->reported = dropped;
+    }
+}
+
+void NWLFlush(void) {
+    pthread_mutex_lock(&NWLDrainLock);
+    const NWLPrinterList *printers = atomic_load_explicit(&NWLPrinters, memory_order_acquire);
+    for (NWLRing *ring = atomic_load(&NWLRings); ring; ring = ring->next) {
+        NWLDrainRing(ring, printers);
+    }
+    pthread_mutex_unlock(&NWLDrainLock);
+}
+
+void NWLSetAsync(int async) {
+    pthread_mutex_lock(&NWLConfigLock);
+    if (!NWLDrainTimer) {
+        dispatch_queue_t queue = dispatch_queue_create("NWLogging.drain", DISPATCH_QUEUE_SERIAL);
+        NWLDrainTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        uint64_t interval = (uint64_t)(kNWLDrainInterval * NSEC_PER_SEC);
+        dispatch_source_set_timer(NWLDrainTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+        dispatch_source_set_event_handler(NWLDrainTimer, ^{
+            NWLFlush();
+        });
+    }
+    int was = atomic_exchange(&NWLAsync, !!async);
+    if (async && !was) dispatch_resume(NWLDrainTimer);
+    if (!async && was) dispatch_suspend(NWLDrainTimer);
+    pthread_mutex_unlock(&NWLConfigLock);
+    if (!async) NWLFlush();
+}
+
+int NWLIsAsync(void) {
+    return atomic_load(&NWLAsync);
+}
+
+
+#pragma mark - Rate limiting
+
+static void NWLRegisterLimit(NWLLimit *limit, NWLContext context) {
+    unsigned int expected = 0;
+    if (!__atomic_compare_exchange_n(&limit->registered, &expected, 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    limit->context = context;
+    NWLLimit *head = __atomic_load_n(&NWLLimits, __ATOMIC_RELAXED);
+    do {
+        limit->next = head;
+    } while (!__atomic_compare_exchange_n(&NWLLimits, &head, limit, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    pthread_mutex_lock(&NWLConfigLock);
+    if (!NWLReportTimer) {
+        dispatch_queue_t queue = dispatch_queue_create("NWLogging.report", DISPATCH_QUEUE_SERIAL);
+        NWLReportTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        uint64_t interval = (uint64_t)(kNWLReportInterval * NSEC_PER_SEC);
+        dispatch_source_set_timer(NWLReportTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+        dispatch_source_set_event_handler(NWLReportTimer, ^{
+            NWLReportSuppressed();
+        });
+        dispatch_resume(NWLReportTimer);
+    }
+    pthread_mutex_unlock(&NWLConfigLock);
+}
+
+// Counts the hit and tells if it should be forwarded, without locking.
+static int NWLLimitAllows(NWLLimit *limit, double time) {
+    if (limit->every > 1 && __atomic_fetch_add(&limit->hits, 1, __ATOMIC_RELAXED) % limit->every) {
+        return false;
+    }
+    if (limit->max) {
+        // the window holds the current second in the upper and the number of lines forwarded in it in the lower 32 bits
+        unsigned long long second = (unsigned long long)time;
+        unsigned long long window = __atomic_load_n(&limit->window, __ATOMIC_RELAXED), next;
+        do {
+            if (window >> 32 != second) {
+                next = second << 32 | 1;
+            } else if ((window & UINT32_MAX) < limit->max) {
+                next = window + 1;
+            } else {
+                return false;
+            }
+        } while (!__atomic_compare_exchange_n(&limit->window, &window, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+    return true;
+}
+
+void NWLForwardWithLimit(NWLLimit *limit, NWLContext context, CFStringRef format, ...) {
+    NWLAction type = NWLSiteAction(&limit->site, context);
+    if (!type) {
+        return;
+    }
+    if (!__atomic_load_n(&limit->registered, __ATOMIC_RELAXED)) {
+        NWLRegisterLimit(limit, context);
+    }
+    if (!NWLLimitAllows(limit, context.time)) {
+        __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    va_list arglist;
+    va_start(arglist, format);
+    CFStringRef message = CFStringCreateWithFormatAndArguments(NULL, 0, format, arglist);
+    va_end(arglist);
+    unsigned long long suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+    if (suppressed) {
+        CFStringRef m = CFStringCreateWithFormat(NULL, 0, CFSTR("%@  (suppressed %llu)"), message, suppressed);
+        CFRelease(message);
+        message = m;
+    }
+    NWLForwardMessage(context, message, type);
+    CFRelease(message);
+}
+
+void NWLReportSuppressed(void) {
+    for (NWLLimit *limit = __atomic_load_n(&NWLLimits, __ATOMIC_ACQUIRE); limit; limit = limit->next) {
+        if (!__atomic_load_n(&limit->suppressed, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        NWLContext context = limit->context;
+        context.time = NWLTime();
+        if (!NWLSiteAction(&limit->site, context)) {
+            continue;
+        }
+        unsigned long long suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed) {
+            CFStringRef message = CFStringCreateWithFormat(NULL, 0, CFSTR("Suppressed %llu log lines"), suppressed);
+            NWLForwardMessage(context, message, kNWLAction_print);
+            CFRelease(message);
+        }
+    }
+}
+
+
+#pragma mark - Flight recorder
+
+#define NWLFlightMagic "NWLFR001"
+#define NWLFlightHeaderSize 4096
+#define NWLFlightMinSize (64 * 1024)
+#define NWLFlightMessageMaxLength 1024
+#define NWLInternSize 1024
+
+// The file starts with this header, followed by the string table and the record ring.
+typedef struct {
+    char magic[8];
+    uint64_t size;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    _Atomic(uint64_t) stringsUsed;
+    uint64_t ringOffset;
+    uint64_t ringSize;
+    _Atomic(uint64_t) head;
+    _Atomic(uint32_t) nextId;
+} NWLFlightHeader;
+
+// An interned string in the string table, followed by its bytes and padded to 8 bytes.
+typedef struct {
+    uint32_t id;
+    uint32_t length;
+} NWLFlightString;
+
+// A log line in the ring, followed by its message bytes. The position is written last and marks the record complete.
+typedef struct {
+    _Atomic(uint64_t) position;
+    uint32_t size;
+    uint32_t length;
+    double time;
+    uint32_t line;
+    uint32_t ids[4];
+} NWLFlightRecord;
+
+typedef struct {
+    int fd;
+    NWLFlightHeader *header;
+    char *strings;
+    char *ring;
+    pthread_mutex_t lock;
+    _Atomic(const char *) keys[NWLInternSize];
+    _Atomic(uint32_t) ids[NWLInternSize];
+    // the strings in the file by content, under the lock, so a reopened file reuses them instead of filling up
+    uint64_t offsets[NWLInternSize];
+} NWLFlightRecorder;
+
+static size_t NWLFlightStringSlot(const char *bytes, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length; i++) hash = (hash ^ (unsigned char)bytes[i]) * 16777619u;
+    return hash & (NWLInternSize - 1);
+}
+
+// Returns the slot of the string with these bytes in the content table, or of the empty slot where it goes.
+static size_t NWLFlightStringFind(NWLFlightRecorder *recorder, const char *bytes, uint32_t length, uint32_t *id) {
+    size_t slot = NWLFlightStringSlot(bytes, length);
+    for (size_t i = 0; i < NWLInternSize; i++, slot = (slot + 1) & (NWLInternSize - 1)) {
+        if (!recorder->offsets[slot]) {
+            break;
+        }
+        const NWLFlightString *entry = (const NWLFlightString *)(recorder->strings + recorder->offsets[slot] - 1);
+        if (entry->length == length && !memcmp(entry + 1, bytes, length)) {
+            *id = entry->id;
+            return slot;
+        }
+    }
+    *id = 0;
+    return slot;
+}
+
+// Fills the content table from the string table of the file, dropping a torn entry at the end.
+static void NWLFlightStringsLoad(NWLFlightRecorder *recorder) {
+    NWLFlightHeader *header = recorder->header;
+    uint64_t used = atomic_load(&header->stringsUsed), offset = 0;
+    if (used > header->stringsSize) used = 0;
+    while (offset + sizeof(NWLFlightString) <= used) {
+        const NWLFlightString *entry = (const NWLFlightString *)(recorder->strings + offset);
+        uint64_t size = (sizeof(NWLFlightString) + entry->length + 7) & ~(uint64_t)7;
+        if (!entry->id || entry->id >= atomic_load(&header->nextId) || size > used - offset) {
+            break;
+        }
+        uint32_t id = 0;
+        size_t slot = NWLFlightStringFind(recorder, (const char *)(entry + 1), entry->length, &id);
+        if (!id && !recorder->offsets[slot]) recorder->offsets[slot] = offset + 1;
+        offset += size;
+    }
+    atomic_store(&header->stringsUsed, offset);
+}
+
+void *NWLFlightRecorderOpen(const char *path, size_t size) {
+    size &= ~(size_t)7;
+    if (!path || size < NWLFlightMinSize) {
+        return NULL;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    int resize = fstat(fd, &st) || st.st_size != (off_t)size;
+    if (resize && ftruncate(fd, size)) {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    NWLFlightHeader *header = base;
+    if (resize || memcmp(header->magic, NWLFlightMagic, sizeof(header->magic)) || header->size != size) {
+        memset(header, 0, NWLFlightHeaderSize);
+        header->size = size;
+        header->stringsOffset = NWLFlightHeaderSize;
+        header->stringsSize = (size / 8) & ~(uint64_t)7;
+        header->ringOffset = header->stringsOffset + header->stringsSize;
+        header->ringSize = size - header->ringOffset;
+        atomic_store(&header->nextId, 1);
+        memcpy(header->magic, NWLFlightMagic, sizeof(header->magic));
+    }
+    NWLFlightRecorder *recorder = calloc(1, sizeof(NWLFlightRecorder));
+    recorder->fd = fd;
+    recorder->header = header;
+    recorder->strings = (char *)base + header->stringsOffset;
+    recorder->ring = (char *)base + header->ringOffset;
+    pthread_mutex_init(&recorder->lock, NULL);
+    NWLFlightStringsLoad(recorder);
+    return recorder;
+}
+
+void NWLFlightRecorderClose(void *info) {
+    NWLFlightRecorder *recorder = info;
+    if (recorder) {
+        munmap(recorder->header, recorder->header->size);
+        close(recorder->fd);
+        pthread_mutex_destroy(&recorder->lock);
+        free(recorder);
+    }
+}
+
+// Returns the id of a context string, keyed by its address, or 0 if it is NULL or the tables are full.
+static uint32_t NWLFlightIntern(NWLFlightRecorder *recorder, const char *string) {
+    if (!string) {
+        return 0;
+    }
+    size_t start = ((uintptr_t)string >> 3) * 2654435761u;
+    for (size_t i = 0; i < NWLInternSize; i++) {
+        size_t slot = (start + i) & (NWLInternSize - 1);
+        const char *key = atomic_load_explicit(&recorder->keys[slot], memory_order_acquire);
+        if (key == string) {
+            return atomic_load_explicit(&recorder->ids[slot], memory_order_relaxed);
+        }
+        if (key) {
+            continue;
+        }
+        pthread_mutex_lock(&recorder->lock);
+        key = atomic_load_explicit(&recorder->keys[slot], memory_order_relaxed);
+        uint32_t id = 0;
+        if (!key) {
+            NWLFlightHeader *header = recorder->header;
+            uint32_t length = (uint32_t)strnlen(string, 256);
+            uint64_t used = atomic_load_explicit(&header->stringsUsed, memory_order_relaxed);
+            uint64_t size = (sizeof(NWLFlightString) + length + 7) & ~(uint64_t)7;
+            size_t stored = NWLFlightStringFind(recorder, string, length, &id);
+            if (!id && !recorder->offsets[stored] && used + size <= header->stringsSize) {
+                id = atomic_fetch_add(&header->nextId, 1);
+                NWLFlightString *entry = (NWLFlightString *)(recorder->strings + used);
+                entry->id = id;
+                entry->length = length;
+                memcpy(entry + 1, string, length);
+                atomic_store_explicit(&header->stringsUsed, used + size, memory_order_release);
+                recorder->offsets[stored] = used + 1;
+            }
+            atomic_store_explicit(&recorder->ids[slot], id, memory_order_relaxed);
+            atomic_store_explicit(&recorder->keys[slot], string, memory_order_release);
+        }
+        pthread_mutex_unlock(&recorder->lock);
+        if (key && key != string) {
+            continue;
+        }
+        return key ? atomic_load_explicit(&recorder->ids[slot], memory_order_relaxed) : id;
+    }
+    return 0;
+}
+
+void NWLFlightRecorderPrinter(NWLContext context, CFStringRef message, void *info) {
+    NWLFlightRecorder *recorder = info;
+    if (!recorder) {
+        return;
+    }
+    unsigned char buffer[NWLFlightMessageMaxLength];
+    CFIndex length = 0;
+    CFRange range = CFRangeMake(0, message ? CFStringGetLength(message) : 0);
+    if (range.length) CFStringGetBytes(message, range, kCFStringEncodingUTF8, '?', false, buffer, sizeof(buffer), &length);
+    uint32_t ids[4] = {NWLFlightIntern(recorder, context.tag), NWLFlightIntern(recorder, context.lib), NWLFlightIntern(recorder, context.file), NWLFlightIntern(recorder, context.function)};
+    NWLFlightHeader *header = recorder->header;
+    uint64_t ringSize = header->ringSize;
+    uint32_t size = (uint32_t)((sizeof(NWLFlightRecord) + length + 7) & ~(size_t)7);
+    for (;;) {
+        uint64_t position = atomic_fetch_add_explicit(&header->head, size, memory_order_relaxed);
+        uint64_t offset = position % ringSize;
+        NWLFlightRecord *record = (NWLFlightRecord *)(recorder->ring + offset);
+        if (ringSize - offset < size) {
+            // the reservation crosses the end of the ring, mark it as skipped and try again
+            if (ringSize - offset >= sizeof(NWLFlightRecord)) {
+                record->size = size;
+                record->length = NWLRecordSkip;
+                atomic_store_explicit(&record->position, position, memory_order_release);
+            }
+            continue;
+        }
+        record->size = size;
+        record->length = (uint32_t)length;
+        record->time = context.time;
+        record->line = context.line;
+        memcpy(record->ids, ids, sizeof(ids));
+        memcpy(record + 1, buffer, length);
+        atomic_store_explicit(&record->position, position, memory_order_release);
+        return;
+    }
+}
+
+int NWLFlightRecorderDecode(const char *path, int out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    void *base = fstat(fd, &st) || st.st_size < NWLFlightMinSize ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    NWLFlightHeader *header = base;
+    if (memcmp(header->magic, NWLFlightMagic, sizeof(header->magic)) || header->size != (uint64_t)st.st_size || header->ringOffset + header->ringSize > header->size) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    // collect interned strings, null-terminated
+    uint32_t count = atomic_load(&header->nextId);
+    char **strings = calloc(count ? count : 1, sizeof(char *));
+    uint64_t used = atomic_load(&header->stringsUsed);
+    for (uint64_t offset = 0; offset + sizeof(NWLFlightString) <= used && used <= header->stringsSize;) {
+        const NWLFlightString *entry = (const NWLFlightString *)((char *)base + header->stringsOffset + offset);
+        if (entry->id < count && offset + sizeof(NWLFlightString) + entry->length <= used) {
+            strings[entry->id] = strndup((const char *)(entry + 1), entry->length);
+        }
+        offset += (sizeof(NWLFlightString) + entry->length + 7) & ~(uint64_t)7;
+    }
+#define _NWL_STRING_(_id) ((_id) < count ? strings[_id] : NULL)
+
+    // walk the last lap of the ring, skipping incomplete records
+    const char *ring = (const char *)base + header->ringOffset;
+    uint64_t ringSize = header->ringSize;
+    uint64_t head = atomic_load(&header->head);
+    uint64_t position = head > ringSize ? (head - ringSize + 7) & ~(uint64_t)7 : 0;
+    int result = 0;
+    while (position + sizeof(NWLFlightRecord) <= head) {
+        uint64_t offset = position % ringSize;
+        const NWLFlightRecord *record = (const NWLFlightRecord *)(ring + offset);
+        if (ringSize - offset < sizeof(NWLFlightRecord) || atomic_load_explicit((_Atomic(uint64_t) *)&record->position, memory_order_acquire) != position || record->size < sizeof(NWLFlightRecord)) {
+            position += 8;
+            continue;
+        }
+        if (record->length != NWLRecordSkip && ringSize - offset >= record->size && record->length <= record->size - sizeof(NWLFlightRecord)) {
+            NWLContext context = {_NWL_STRING_(record->ids[0]), _NWL_STRING_(record->ids[1]), _NWL_STRING_(record->ids[2]), record->line, _NWL_STRING_(record->ids[3]), record->time};
+            char prefix[160];
+            struct iovec iov[3];
+            iov[0].iov_base = prefix;
+            iov[0].iov_len = NWLStderrPrefix(context, prefix, sizeof(prefix));
+            iov[1].iov_base = (void *)(record + 1);
+            iov[1].iov_len = record->length;
+            iov[2].iov_base = "\n";
+            iov[2].iov_len = 1;
+            writev(out, iov, 3);
+            result++;
+        }
+        position += record->size;
+    }
+#undef _NWL_STRING_
+
+    for (uint32_t i = 0; i < count; i++) free(strings[i]);
+    free(strings);
+    munmap(base, st.st_size);
+    return result;
+}
+
 
 #pragma mark - Filtering
 
 NWLAction NWLMatchingActionForContext(NWLContext context) {
+    const NWLFilterList *filters = atomic_load_explicit(&NWLFilters, memory_order_acquire);
     NWLAction result = kNWLAction_none;
     int bestScore = 0;
-    for (int i = 0; i < NWLFilters.count; i++) {
-        NWLFilter *filter = &NWLFilters.elements[i];
+    for (int i = 0; i < filters->count; i++) {
+        const NWLFilter *filter = &filters->elements[i];
         if (result < filter->action) {
             int score = 0;
             const char *s = NULL;
@@ -225,21 +927,21 @@ NWLAction NWLMatchingActionForContext(NWLContext context) {
     return result;
 }
 
-static int NWLAddFilter1(NWLFilter *filter) {
+static int NWLAddFilter1(NWLFilterList *filters, NWLFilter *filter) {
     if (filter->action != kNWLAction_none) {
-        int count = NWLFilters.count;
+        int count = filters->count;
         if (count < kNWLFilterListSize) {
-            NWLFilters.elements[count] = *filter;
-            NWLFilters.count = count + 1;
+            filters->elements[count] = *filter;
+            filters->count = count + 1;
             return true;
         }
     }
     return false;
 }
 
-static NWLAction NWLHasFilter1(NWLFilter *filter) {
-    for (int i = 0; i < NWLFilters.count; i++) {
-        NWLFilter *m = &NWLFilters.elements[i];
+static NWLAction NWLHasFilter1(const NWLFilterList *filters, NWLFilter *filter) {
+    for (int i = 0; i < filters->count; i++) {
+        const NWLFilter *m = &filters->elements[i];
         int j = 1;
         for (; j < kNWLProperty_count; j++) {
             const char *a = filter->properties[j];
@@ -253,40 +955,40 @@ static NWLAction NWLHasFilter1(NWLFilter *filter) {
     return kNWLAction_none;
 }
 
-static int NWLRemoveFilter1(NWLFilter *filter) {
+static int NWLRemoveFilter1(NWLFilterList *filters, NWLFilter *filter) {
     int result = 0;
-    for (int i = 0; i < NWLFilters.count; i++) {
-        NWLFilter *m = &NWLFilters.elements[i];
+    for (int i = 0; i < filters->count; i++) {
+        NWLFilter *m = &filters->elements[i];
         int j = 1;
         for (; j < kNWLProperty_count; j++) {
             const char *a = filter->properties[j];
             const char *b = m->properties[j];
             if (a != b && (!a || !b || strcasecmp(a, b))) break;
         }
-        int count = NWLFilters.count;
+        int count = filters->count;
         if (j == kNWLProperty_count && count > 0) {
-            NWLFilters.count = count - 1;
-            NWLFilters.elements[i--] = NWLFilters.elements[count - 1];
+            filters->count = count - 1;
+            filters->elements[i--] = filters->elements[count - 1];
             result++;
         }
     }
     return result;
 }
 
-static int NWLRemoveMatchingFilters1(NWLFilter *filter) {
+static int NWLRemoveMatchingFilters1(NWLFilterList *filters, NWLFilter *filter) {
     int result = 0;
-    for (int i = 0; i < NWLFilters.count; i++) {
-        NWLFilter *m = &NWLFilters.elements[i];
+    for (int i = 0; i < filters->count; i++) {
+        NWLFilter *m = &filters->elements[i];
         int j = 1;
         for (; j < kNWLProperty_count; j++) {
             const char *a = filter->properties[j];
             const char *b = m->properties[j];
             if (a && (!b || strcasecmp(a, b))) break;
         }
-        int count = NWLFilters.count;
+        int count = filters->count;
         if (j == kNWLProperty_count && count > 0) {
-            NWLFilters.count = count - 1;
-            NWLFilters.elements[i--] = NWLFilters.elements[count - 1];
+            filters->count = count - 1;
+            filters->elements[i--] = filters->elements[count - 1];
             result++;
         }
     }
@@ -295,25 +997,37 @@ static int NWLRemoveMatchingFilters1(NWLFilter *filter) {
 
 int NWLAddFilter(const char *tag, const char *lib, const char *file, const char *function, NWLAction action) {
     NWLFilter filter = {NULL, tag, lib, file, function, action};
-    NWLRemoveFilter1(&filter);
-    int result = NWLAddFilter1(&filter);
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLFilterList *filters = NWLCopyFilters();
+    NWLRemoveFilter1(filters, &filter);
+    int result = NWLAddFilter1(filters, &filter);
+    NWLPublishFilters(filters);
+    pthread_mutex_unlock(&NWLConfigLock);
     return result;
 }
 
 NWLAction NWLHasFilter(const char *tag, const char *lib, const char *file, const char *function) {
     NWLFilter filter = {NULL, tag, lib, file, function, kNWLAction_none};
-    NWLAction result = NWLHasFilter1(&filter);
+    NWLAction result = NWLHasFilter1(atomic_load_explicit(&NWLFilters, memory_order_acquire), &filter);
     return result;
 }
 
 int NWLRemoveMatchingFilters(const char *tag, const char *lib, const char *file, const char *function) {
     NWLFilter filter = {NULL, tag, lib, file, function, kNWLAction_none};
-    int result = NWLRemoveMatchingFilters1(&filter);
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLFilterList *filters = NWLCopyFilters();
+    int result = NWLRemoveMatchingFilters1(filters, &filter);
+    NWLPublishFilters(filters);
+    pthread_mutex_unlock(&NWLConfigLock);
     return result;
 }
 
 void NWLRemoveAllFilters(void) {
-    NWLFilters.count = 0;
+    pthread_mutex_lock(&NWLConfigLock);
+    NWLFilterList *filters = NWLCopyFilters();
+    filters->count = 0;
+    NWLPublishFilters(filters);
+    pthread_mutex_unlock(&NWLConfigLock);
 }
 
 void NWLAddDefaultFilter(void) {
@@ -364,8 +1078,10 @@ void NWLClock(double time, int *hour, int *minute, int *second, int *micro) {
 
 int NWLAboutString(char *buffer, int size) {
     int s = size;
-    for (int i = 0; i < NWLFilters.count; i++) {
-        NWLFilter *filter = &NWLFilters.elements[i];
+    const NWLFilterList *filters = atomic_load_explicit(&NWLFilters, memory_order_acquire);
+    const NWLPrinterList *printers = atomic_load_explicit(&NWLPrinters, memory_order_acquire);
+    for (int i = 0; i < filters->count; i++) {
+        const NWLFilter *filter = &filters->elements[i];
 #define _NWL_ABOUT_ACTION_(_action) do {if (filter->action == kNWLAction_##_action) {_NWL_PRINT_(buffer, s, "   action       : "#_action);}} while (0)
         _NWL_ABOUT_ACTION_(print);
         _NWL_ABOUT_ACTION_(break);
@@ -377,11 +1093,12 @@ int NWLAboutString(char *buffer, int size) {
         _NWL_ABOUT_PROP_(function);
         _NWL_PRINT_(buffer, s, "\n");
     }
-    for (int i = 0; i < NWLPrinters.count; i++) {
-        NWLPrinter *p = &NWLPrinters.elements[i];
+    for (int i = 0; i < printers->count; i++) {
+        const NWLPrinter *p = &printers->elements[i];
         _NWL_PRINT_(buffer, s, "   printer      : %s\n", p->name);
     }
     _NWL_PRINT_(buffer, s, "   time-offset  : %f\n", NWLTimeOffset);
+    _NWL_PRINT_(buffer, s, "   async        : %s\n", NWLIsAsync() ? "YES" : "NO");
     return size - s;
 }
 
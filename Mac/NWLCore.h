@@ -72,6 +72,24 @@ extern "C" {
 /** Log on a custom tag, which can be activated using NWLPrintTag(tag). */
 #define NWLogTag(_tag, _format, ...)             NWLLogWithFilter((#_tag), NWL_LIB_STR, _format, ##__VA_ARGS__)
 
+/** Log on the 'info' tag on the first and every nth hit after that, n must be a constant. */
+#define NWLogInfoEvery(_n, _format, ...)         NWLLogWithLimit("info", NWL_LIB_STR, (_n), 0, _format, ##__VA_ARGS__)
+
+/** Log on the 'info' tag at most k times per second, k must be a constant. */
+#define NWLogInfoMax(_k, _format, ...)           NWLLogWithLimit("info", NWL_LIB_STR, 0, (_k), _format, ##__VA_ARGS__)
+
+/** Log on the 'warn' tag on the first and every nth hit after that, n must be a constant. */
+#define NWLogWarnEvery(_n, _format, ...)         NWLLogWithLimit("warn", NWL_LIB_STR, (_n), 0, _format, ##__VA_ARGS__)
+
+/** Log on the 'warn' tag at most k times per second, k must be a constant. */
+#define NWLogWarnMax(_k, _format, ...)           NWLLogWithLimit("warn", NWL_LIB_STR, 0, (_k), _format, ##__VA_ARGS__)
+
+/** Log on a custom tag on the first and every nth hit after that, n must be a constant. */
+#define NWLogTagEvery(_tag, _n, _format, ...)    NWLLogWithLimit((#_tag), NWL_LIB_STR, (_n), 0, _format, ##__VA_ARGS__)
+
+/** Log on a custom tag at most k times per second, k must be a constant. */
+#define NWLogTagMax(_tag, _k, _format, ...)      NWLLogWithLimit((#_tag), NWL_LIB_STR, 0, (_k), _format, ##__VA_ARGS__)
+
 /** Convenient assert and error macros. */
 #define NWAssert(_condition)                     NWLogWarnIfNot((_condition), @"Expected true condition '"#_condition@"' in %s:%i", _NWL_FILE_, __LINE__)
 #define NWAssertMainThread()                     NWLogWarnIfNot(_NWL_MAIN_THREAD_, @"Expected running on main thread in %s:%i", _NWL_FILE_, __LINE__)
@@ -105,13 +123,28 @@ extern "C" {
 
 #define NWLLogWithoutFilter(_tag, _lib, _fmt, ...) NWLLogWithoutFilter_(_tag, _lib, _fmt, ##__VA_ARGS__)
 #define NWLLogWithFilter(_tag, _lib, _fmt, ...) NWLLogWithFilter_(_tag, _lib, _fmt, ##__VA_ARGS__)
+#define NWLLogWithLimit(_tag, _lib, _every, _max, _fmt, ...) NWLLogWithLimit_(_tag, _lib, _every, _max, _fmt, ##__VA_ARGS__)
     
 #if NWL_ACTIVE
 #define NWLLogWithoutFilter_(_tag, _lib, _fmt, ...) NWLForwardWithoutFilter((NWLContext){_tag, _lib, _NWL_FILE_, __LINE__, __PRETTY_FUNCTION__, NWLTime()}, _NWL_CFSTRING_(_fmt), ##__VA_ARGS__)
-#define NWLLogWithFilter_(_tag, _lib, _fmt, ...) NWLForwardWithFilter((NWLContext){_tag, _lib, _NWL_FILE_, __LINE__, __PRETTY_FUNCTION__, NWLTime()}, _NWL_CFSTRING_(_fmt), ##__VA_ARGS__)
+#define NWLLogWithFilter_(_tag, _lib, _fmt, ...) do {\
+        static unsigned int _nwl_site_ = 0;\
+        unsigned int _nwl_state_ = __atomic_load_n(&_nwl_site_, __ATOMIC_RELAXED);\
+        if ((_nwl_state_ & ~kNWLSiteActionMask) != __atomic_load_n(&NWLFilterGeneration, __ATOMIC_RELAXED) || (_nwl_state_ & kNWLSiteActionMask)) {\
+            NWLForwardWithSite(&_nwl_site_, (NWLContext){_tag, _lib, _NWL_FILE_, __LINE__, __PRETTY_FUNCTION__, NWLTime()}, _NWL_CFSTRING_(_fmt), ##__VA_ARGS__);\
+        }\
+    } while (0)
+#define NWLLogWithLimit_(_tag, _lib, _every, _max, _fmt, ...) do {\
+        static NWLLimit _nwl_limit_ = {0, (_every), (_max)};\
+        unsigned int _nwl_state_ = __atomic_load_n(&_nwl_limit_.site, __ATOMIC_RELAXED);\
+        if ((_nwl_state_ & ~kNWLSiteActionMask) != __atomic_load_n(&NWLFilterGeneration, __ATOMIC_RELAXED) || (_nwl_state_ & kNWLSiteActionMask)) {\
+            NWLForwardWithLimit(&_nwl_limit_, (NWLContext){_tag, _lib, _NWL_FILE_, __LINE__, __PRETTY_FUNCTION__, NWLTime()}, _NWL_CFSTRING_(_fmt), ##__VA_ARGS__);\
+        }\
+    } while (0)
 #else // NWL_ACTIVE
 #define NWLLogWithoutFilter_(_tag, _lib, _fmt, ...) do {} while (0)
 #define NWLLogWithFilter_(_tag, _lib, _fmt, ...) do {} while (0)
+#define NWLLogWithLimit_(_tag, _lib, _every, _max, _fmt, ...) do {} while (0)
 #endif // NWL_ACTIVE
 
 
@@ -145,6 +178,19 @@ typedef struct {
     double time;
 } NWLContext;
 
+/** The state of a rate-limited log statement, one per call site. */
+typedef struct NWLLimit {
+    unsigned int site;
+    unsigned int every;
+    unsigned int max;
+    unsigned int registered;
+    unsigned long long hits;
+    unsigned long long window;
+    unsigned long long suppressed;
+    NWLContext context;
+    struct NWLLimit *next;
+} NWLLimit;
+
 
 #pragma mark - Configuration
 
@@ -154,10 +200,20 @@ extern void NWLForwardWithoutFilter(NWLContext context, CFStringRef format, ...)
 /** Looks for the best-matching filter and performs the associated action. */
 extern void NWLForwardWithFilter(NWLContext context, CFStringRef format, ...) CF_FORMAT_FUNCTION(2,3);
 
+/** Looks up the action in the cache of a log statement, which is resolved again if the filters changed since, and performs it. */
+extern void NWLForwardWithSite(unsigned int *site, NWLContext context, CFStringRef format, ...) CF_FORMAT_FUNCTION(3,4);
+
+/** Like NWLForwardWithSite, but only forwards the lines allowed by the limit of the log statement. Suppressed lines are counted, not formatted, and reported with the next line that is forwarded. */
+extern void NWLForwardWithLimit(NWLLimit *limit, NWLContext context, CFStringRef format, ...) CF_FORMAT_FUNCTION(3,4);
+
+/** Incremented by four on every change to the filters, the lower bits of a site cache hold the action. */
+extern unsigned int NWLFilterGeneration;
+#define kNWLSiteActionMask 3u
+
 /** Forward printing of line to printers, return true if added. */
 extern int NWLAddPrinter(const char *name, void(*)(NWLContext, CFStringRef, void *), void *info);
 
-/** Remove a printer, returns info of the printer. */
+/** Remove a printer, returns info of the printer. Returns once no other thread is inside the printer, so info can be freed. Do not call from within a printer. */
 extern void * NWLRemovePrinter(const char *name);
 
 /** Clear the printer list. */
@@ -172,6 +228,30 @@ extern void NWLAddDefaultPrinter(void);
 /** Formatter tailored for debugging, with format: "[hr:mn:sc:micros Library File:line] [tag] message", to stderr. */
 extern void NWLStderrPrinter(NWLContext context, CFStringRef message, void *info);
 
+/** Opens or creates a flight recorder file of size bytes, to be passed as info to NWLFlightRecorderPrinter. Returns NULL on failure. An existing file of the same size is appended to, so the records of a crashed process are kept. */
+extern void *NWLFlightRecorderOpen(const char *path, size_t size);
+
+/** Closes a flight recorder, remove its printer first. */
+extern void NWLFlightRecorderClose(void *recorder);
+
+/** Appends compact binary records to a memory-mapped ring file, which can be rendered as text with NWLFlightRecorderDecode. A record holds the time, line, ids of the interned context strings and the message, truncated to 1 KB. Writing is a memcpy, safe to call from any thread. Add with NWLAddPrinter("flight", NWLFlightRecorderPrinter, NWLFlightRecorderOpen(path, size)). */
+extern void NWLFlightRecorderPrinter(NWLContext context, CFStringRef message, void *recorder);
+
+/** Renders the records of a flight recorder file to file descriptor out, oldest first and in the format of the stderr printer. Returns the number of records, or -1 if the file could not be read. */
+extern int NWLFlightRecorderDecode(const char *path, int out);
+
+/** Switch asynchronous printing on or off. When on, log statements only format their message and queue it on a per-thread ring, without locking or system calls. A background queue forwards queued lines to the printers in batches, the stderr printer writes each batch with a single writev. Context strings must outlive the log call, which they do when logging with the macros. Lines are dropped (and counted) when a ring is full. */
+extern void NWLSetAsync(int async);
+
+/** Tells if printing is asynchronous. */
+extern int NWLIsAsync(void);
+
+/** Forward all queued lines to the printers, returns after they have been printed. */
+extern void NWLFlush(void);
+
+/** Prints a line for every rate-limited log statement that suppressed lines since it last printed. Called periodically once such a statement is hit, call before exit to report the remainder. */
+extern void NWLReportSuppressed(void);
+
 
 /** Tests context (like lib and file name) and returns the matching action. */
 extern NWLAction NWLMatchingActionForContext(NWLContext context);
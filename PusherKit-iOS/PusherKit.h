@@ -21,3 +21,14 @@ FOUNDATION_EXPORT const unsigned char PusherKit_iOSVersionString[];
 #import <PusherKit/NWSSLConnection.h>
 #import <PusherKit/NWSecTools.h>
 #import <PusherKit/NWPushFeedback.h>
+#import <PusherKit/NWTokenCodec.h>
+#import <PusherKit/NWTracker.h>
+#import <PusherKit/NWPusherPool.h>
+#import <PusherKit/NWHTTP2Pusher.h>
+#import <PusherKit/NWPushQueue.h>
+#import <PusherKit/NWJSONScanner.h>
+#import <PusherKit/NWResolver.h>
+#import <PusherKit/NWPushScheduler.h>
+#import <PusherKit/NWPacer.h>
+#import <PusherKit/NWMetrics.h>
+#import <PusherKit/NWJournal.h>
@@ -0,0 +1,83 @@
+//
+//  NWFanOutBenchmark.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+#include "NWTokenCodec.h"
+
+// Per-token cost of a broadcast of one payload, from hex tokens to bytes handed to the connection. The connection discards what it is given, so TLS and network are left out. Compares a notification and write per token (as NWHub did before), a notification per token with batched writes, and the fan-out that stamps tokens into a frame template.
+
+static NSUInteger const NWBenchmarkTokens = 200000;
+
+static void NWReport(NSString *name, double seconds, NWSinkConnection *connection, double baseline)
+{
+    printf("%-24s %8.1f ns/token %8.2f M tokens/s %9lu writes", name.UTF8String, seconds * 1e9 / NWBenchmarkTokens, NWBenchmarkTokens / seconds * 1e-6, (unsigned long)connection.writes);
+    if (baseline > 0) printf("  %6.1fx", baseline / seconds);
+    printf("\n");
+    NWTestEqual(connection.bytes % NWBenchmarkTokens, 0);
+}
+
+static NWPusher *NWSinkPusher(void)
+{
+    NWPusher *pusher = [[NWPusher alloc] init];
+    pusher.connection = [[NWSinkConnection alloc] init];
+    return pusher;
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NSString *payload = @"{\"aps\":{\"alert\":\"Breaking news: benchmark completes\",\"sound\":\"default\",\"badge\":1}}";
+        NSMutableArray *tokens = @[].mutableCopy;
+        uint8_t bytes[32];
+        char hex[64];
+        for (NSUInteger i = 0; i < NWBenchmarkTokens; i++) {
+            for (NSUInteger j = 0; j < sizeof(bytes); j++) bytes[j] = (uint8_t)arc4random();
+            NWHexEncode(bytes, sizeof(bytes), hex);
+            [tokens addObject:[[NSString alloc] initWithBytes:hex length:sizeof(hex) encoding:NSASCIIStringEncoding]];
+        }
+
+        NWPusher *pusher = NWSinkPusher();
+        double start = NWTestSeconds();
+        for (NSUInteger i = 0; i < NWBenchmarkTokens; i++) {
+            @autoreleasepool {
+                NWNotification *notification = [[NWNotification alloc] initWithPayload:payload token:tokens[i] identifier:i + 1 expiration:nil priority:0];
+                NWTestAssert([pusher pushNotification:notification type:kNWNotificationType2 error:nil]);
+            }
+        }
+        double single = NWTestSeconds() - start;
+        NWReport(@"notification per token", single, (NWSinkConnection *)pusher.connection, 0);
+
+        pusher = NWSinkPusher();
+        start = NWTestSeconds();
+        @autoreleasepool {
+            NSData *payloadData = [payload dataUsingEncoding:NSUTF8StringEncoding];
+            NSArray *tokenDatas = [NWNotification dataFromHexes:tokens];
+            NSMutableArray *notifications = [[NSMutableArray alloc] initWithCapacity:NWBenchmarkTokens];
+            for (NSUInteger i = 0; i < NWBenchmarkTokens; i++) {
+                [notifications addObject:[[NWNotification alloc] initWithPayloadData:payloadData tokenData:tokenDatas[i] identifier:i + 1 expirationStamp:0 addExpiration:NO priority:0]];
+            }
+            NWTestAssert([pusher pushNotifications:notifications type:kNWNotificationType2 error:nil]);
+        }
+        double batched = NWTestSeconds() - start;
+        NWReport(@"batched writes", batched, (NWSinkConnection *)pusher.connection, single);
+
+        pusher = NWSinkPusher();
+        start = NWTestSeconds();
+        @autoreleasepool {
+            NSData *payloadData = [payload dataUsingEncoding:NSUTF8StringEncoding];
+            NSArray *tokenDatas = [NWNotification dataFromHexes:tokens];
+            NWNotification *template = [[NWNotification alloc] initWithPayloadData:payloadData tokenData:tokenDatas[0] identifier:1 expirationStamp:0 addExpiration:NO priority:0];
+            NWTestEqual([pusher pushNotification:template tokenDatas:tokenDatas type:kNWNotificationType2 error:nil], NWBenchmarkTokens);
+        }
+        double fanOut = NWTestSeconds() - start;
+        NWReport(@"fan-out", fanOut, (NWSinkConnection *)pusher.connection, single);
+    }
+    return NWTestFinish("NWFanOutBenchmark");
+}
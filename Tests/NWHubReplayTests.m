@@ -0,0 +1,146 @@
+//
+//  NWHubReplayTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Pushes notifications with identifiers that wrap around 32 bits, answers with an error response on one of them,
+//  and checks the hub replays those after it in order, with their tracker entries left as they were, also when the
+//  connection drops in the middle of the replay.
+//
+
+#import "NWHub.h"
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWTracker.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+#include <unistd.h>
+
+static NSUInteger const NWTestCount = 10;
+
+@interface NWReplayTestDelegate : NSObject <NWHubDelegate>
+@property (nonatomic, readonly) NSMutableArray *failed;
+@end
+
+@implementation NWReplayTestDelegate
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _failed = @[].mutableCopy;
+    }
+    return self;
+}
+
+- (void)notification:(NWNotification *)notification didFailWithError:(NSError *)error
+{
+    [_failed addObject:@[@(notification.identifier), @(error.code)]];
+}
+
+@end
+
+static uint32_t NWTestRead32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// The identifiers of the whole frames in range of data, in the order written.
+static NSArray *NWTestIdentifiers(NSData *data, NSRange range)
+{
+    NSMutableArray *identifiers = @[].mutableCopy;
+    const uint8_t *bytes = (const uint8_t *)data.bytes + range.location;
+    for (NSUInteger offset = 0; offset + 5 <= range.length && offset + 5 + NWTestRead32(bytes + offset + 1) <= range.length;) {
+        const uint8_t *p = bytes + offset;
+        const uint8_t *end = p + 5 + NWTestRead32(p + 1);
+        for (const uint8_t *item = p + 5; item < end; item += 3 + (item[1] << 8 | item[2])) {
+            if (item[0] == 3) [identifiers addObject:@(NWTestRead32(item + 3))];
+        }
+        offset = end - bytes;
+    }
+    return identifiers;
+}
+
+// Pushes the notifications starting just before the wrap, and hands the hub a fresh connection that reports the third one failed.
+static NSArray *NWTestPush(NWHub *hub, NWSinkConnection **connection)
+{
+    NSData *payload = [@"{\"aps\":{\"alert\":\"replay\"}}" dataUsingEncoding:NSUTF8StringEncoding];
+    NSMutableArray *notifications = @[].mutableCopy;
+    for (NSUInteger i = 0; i < NWTestCount; i++) {
+        uint8_t token[32] = {(uint8_t)i};
+        NSData *tokenData = [NSData dataWithBytes:token length:sizeof(token)];
+        [notifications addObject:[[NWNotification alloc] initWithPayloadData:payload tokenData:tokenData identifier:0 expirationStamp:0 addExpiration:NO priority:0]];
+    }
+    hub.replay = YES;
+    hub.index = UINT32_MAX - 4;
+    hub.pusher.connection = [[NWSinkConnection alloc] init];
+    NWTestEqual([hub pushBatch:notifications], 0);
+    uint32_t expected[NWTestCount] = {UINT32_MAX - 4, UINT32_MAX - 3, UINT32_MAX - 2, UINT32_MAX - 1, UINT32_MAX, 1, 2, 3, 4, 5};
+    for (NSUInteger i = 0; i < NWTestCount; i++) NWTestEqual([notifications[i] identifier], expected[i]);
+    usleep(100000);
+
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    uint8_t response[6] = {8, 8, 0xFF, 0xFF, 0xFF, 0xFD};
+    sink.response = [NSData dataWithBytes:response length:sizeof(response)];
+    sink.keepsData = YES;
+    hub.pusher.connection = sink;
+    *connection = sink;
+    return notifications;
+}
+
+static void NWTestReplayWrap(void)
+{
+    NWReplayTestDelegate *delegate = [[NWReplayTestDelegate alloc] init];
+    NWHub *hub = [[NWHub alloc] initWithDelegate:delegate];
+    NWSinkConnection *sink = nil;
+    NSArray *notifications = NWTestPush(hub, &sink);
+
+    NWNotification *failed = nil;
+    NWTestAssert([hub readFailed:&failed autoReconnect:YES error:nil]);
+    NWTestAssert(failed == notifications[2]);
+    NWTestEqual(sink.connects, 1);
+    NSUInteger frame = [notifications[0] lengthWithType:hub.type];
+    NWTestEqual(sink.data.length, 7 * frame);
+    NSArray *identifiers = NWTestIdentifiers(sink.data, NSMakeRange(0, sink.data.length));
+    NWTestAssert([identifiers isEqualToArray:(@[@(UINT32_MAX - 1), @(UINT32_MAX), @1, @2, @3, @4, @5])]);
+    NWTestEqual(delegate.failed.count, 1);
+    NWTestEqual([delegate.failed[0][1] integerValue], kNWErrorAPNInvalidTokenContent);
+
+    // replayed notifications are still tracked once, from their first push
+    NWTestEqual(hub.tracker.count, NWTestCount);
+    NWTestAssert([hub.tracker notificationForIdentifier:1] == notifications[5]);
+    NWTestAssert([hub.tracker timeSinceAddingIdentifier:1] >= 0.09);
+    NWTestAssert([hub.tracker timeSinceAddingIdentifier:UINT32_MAX] >= 0.09);
+}
+
+static void NWTestReplayCut(void)
+{
+    NWReplayTestDelegate *delegate = [[NWReplayTestDelegate alloc] init];
+    NWHub *hub = [[NWHub alloc] initWithDelegate:delegate];
+    NWSinkConnection *sink = nil;
+    NSArray *notifications = NWTestPush(hub, &sink);
+    NSUInteger frame = [notifications[0] lengthWithType:hub.type];
+    sink.writeLimit = 2 * frame + frame / 2;
+
+    // the write cut off the third frame, so the hub reconnects again and continues with the fourth
+    NWTestAssert([hub readFailed:NULL autoReconnect:YES error:nil]);
+    NWTestEqual(sink.connects, 2);
+    NWTestEqual(sink.data.length, 6 * frame + frame / 2);
+    NSArray *before = NWTestIdentifiers(sink.data, NSMakeRange(0, 2 * frame));
+    NWTestAssert([before isEqualToArray:(@[@(UINT32_MAX - 1), @(UINT32_MAX)])]);
+    NSArray *after = NWTestIdentifiers(sink.data, NSMakeRange(2 * frame + frame / 2, 4 * frame));
+    NWTestAssert([after isEqualToArray:(@[@2, @3, @4, @5])]);
+    NWTestEqual(delegate.failed.count, 2);
+    NWTestAssert([delegate.failed.lastObject isEqualToArray:(@[@1, @(kNWErrorWriteDroppedByServer)])]);
+    NWTestEqual(hub.tracker.count, NWTestCount);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestReplayWrap();
+        NWTestReplayCut();
+    }
+    return NWTestFinish("NWHubReplayTests");
+}
@@ -0,0 +1,95 @@
+//
+//  NWJSONScannerTests.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWTest.h"
+#include "NWJSONScanner.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// Validates a copy without terminating null, so reading past the end would be noticed by a memory checker.
+static int NWValidate(const char *json, int object) {
+    size_t length = strlen(json);
+    char *copy = malloc(length ? length : 1);
+    memcpy(copy, json, length);
+    int valid = NWJSONValidate(copy, length, object);
+    free(copy);
+    return valid;
+}
+
+static void NWTestValid(void) {
+    const char *valid[] = {
+        "{}", " { } ", "[]", "0", "-0", "1.5e+10", "-12.0E-3", "\"\"", "true", "false", "null",
+        "{\"aps\":{\"alert\":\"Hello\",\"badge\":1,\"sound\":\"default\"}}",
+        "{\"a\":[1,2,{\"b\":[]},null,true,false,\"c\"],\"d\":{}}",
+        "{\"escaped\":\"\\\" \\\\ \\/ \\b \\f \\n \\r \\t \\u00e9 \\uD83D\\uDE00\"}",
+        "{\"utf8\":\"caf\xc3\xa9 \xf0\x9f\x98\x80\"}",
+        "\t\r\n[ 1 , 2 ]\n",
+    };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        NWTestAssert(NWValidate(valid[i], 0));
+    }
+}
+
+static void NWTestInvalid(void) {
+    const char *invalid[] = {
+        "", " ", "{", "}", "[1,]", "{\"a\":1,}", "{\"a\"}", "{\"a\" 1}", "{a:1}", "[1 2]", "01", "1.", ".5", "1e", "-",
+        "+1", "tru", "nul", "falsey", "\"open", "\"\\x\"", "\"\\u12\"", "\"\\u12g4\"", "\"tab\there\"", "{} {}", "[}", "{]",
+        "{\"a\":1}}", "[[]", "\"\\",
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        NWTestAssert(!NWValidate(invalid[i], 0));
+    }
+}
+
+static void NWTestObject(void) {
+    NWTestAssert(NWValidate("{\"aps\":{}}", 1));
+    NWTestAssert(NWValidate("  {}", 1));
+    NWTestAssert(!NWValidate("[]", 1));
+    NWTestAssert(!NWValidate("\"aps\"", 1));
+    NWTestAssert(!NWValidate("1", 1));
+}
+
+static void NWTestDepth(void) {
+    char json[2 * (NWJSONMaxDepth + 1) + 1];
+    for (size_t depth = NWJSONMaxDepth; depth <= NWJSONMaxDepth + 1; depth++) {
+        memset(json, '[', depth);
+        memset(json + depth, ']', depth);
+        json[2 * depth] = '\0';
+        NWTestEqual(NWValidate(json, 0), depth <= NWJSONMaxDepth);
+    }
+}
+
+static void NWTestLongStrings(void) {
+    // a special character at every offset around the 16-byte vector width, to cover both string paths
+    for (size_t length = 0; length < 48; length++) {
+        for (size_t at = 0; at <= length; at++) {
+            char json[64];
+            json[0] = '"';
+            memset(json + 1, 'x', length);
+            json[1 + length] = '"';
+            json[2 + length] = '\0';
+            NWTestAssert(NWValidate(json, 0));
+            if (at == length) continue;
+            json[1 + at] = '\n';
+            NWTestAssert(!NWValidate(json, 0));
+            json[1 + at] = '"';
+            NWTestAssert(!NWValidate(json, 0));
+            json[1 + at] = (char)0xC3;
+            NWTestAssert(NWValidate(json, 0));
+        }
+    }
+}
+
+int main(void) {
+    NWTestValid();
+    NWTestInvalid();
+    NWTestObject();
+    NWTestDepth();
+    NWTestLongStrings();
+    return NWTestFinish("NWJSONScannerTests");
+}
@@ -0,0 +1,191 @@
+//
+//  NWJournalTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Reopens journals after closing, corrupting and wrapping them around, and checks the frames and watermarks that
+//  come back.
+//
+
+#import "NWJournal.h"
+#include "NWTest.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+static NSUInteger const NWTestHeaderSize = 4096;
+static NSUInteger const NWTestEntrySize = 16;
+
+static NSString *NWTestPath(const char *name)
+{
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSString stringWithFormat:@"NWJournalTests-%s-%d", name, getpid()]];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+    return path;
+}
+
+static NSData *NWTestFrame(uint32_t identifier, NSUInteger length)
+{
+    NSMutableData *frame = [NSMutableData dataWithLength:length];
+    memset(frame.mutableBytes, (int)(identifier & 0xFF), length);
+    return frame;
+}
+
+static NSArray *NWTestIdentifiers(NWJournal *journal, NSUInteger length)
+{
+    NSMutableArray *identifiers = @[].mutableCopy;
+    [journal enumerateUnacknowledgedFramesUsingBlock:^(NSData *frame, NSUInteger identifier, BOOL *stop) {
+        NWTestAssert([frame isEqualToData:NWTestFrame((uint32_t)identifier, length)]);
+        [identifiers addObject:@(identifier)];
+    }];
+    return identifiers;
+}
+
+// frames survive closing, and a journal that is not one is started over with the capacity asked for
+static void NWTestReopen(void)
+{
+    NSString *path = NWTestPath("reopen");
+    NWJournal *journal = [NWJournal journalWithPath:path capacity:100000 error:nil];
+    NWTestAssert(journal);
+    for (uint32_t i = 1; i <= 10; i++) NWTestAssert([journal appendFrame:NWTestFrame(i, 100) identifier:i error:nil]);
+    NWTestAssert([journal flush]);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:200000 error:nil];
+    NWTestEqual(journal.capacity, 100000);
+    NWTestEqual(journal.count, 10);
+    NWTestEqual(journal.writtenIdentifier, 10);
+    NWTestEqual(journal.acknowledgedIdentifier, 0);
+    NSArray *identifiers = NWTestIdentifiers(journal, 100);
+    NWTestEqual(identifiers.count, 10);
+    NWTestEqual([identifiers.firstObject unsignedIntegerValue], 1);
+    NWTestEqual([identifiers.lastObject unsignedIntegerValue], 10);
+    [journal close];
+
+    int fd = open(path.fileSystemRepresentation, O_RDWR);
+    NWTestEqual(pwrite(fd, "NWJRNL00", 8, 0), 8);
+    close(fd);
+    journal = [NWJournal journalWithPath:path capacity:200000 error:nil];
+    NWTestEqual(journal.capacity, 200000);
+    NWTestEqual(journal.count, 0);
+    NWTestEqual(journal.writtenIdentifier, 0);
+    NWTestEqual(NWTestIdentifiers(journal, 100).count, 0);
+    [journal close];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+}
+
+// an entry torn by a crash ends the journal, the frames before it are kept and appending continues in its place
+static void NWTestTorn(void)
+{
+    NSString *path = NWTestPath("torn");
+    NWJournal *journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    for (uint32_t i = 1; i <= 10; i++) NWTestAssert([journal appendFrame:NWTestFrame(i, 100) identifier:i error:nil]);
+    [journal close];
+
+    uint32_t length = 200;
+    int fd = open(path.fileSystemRepresentation, O_RDWR);
+    NWTestEqual(pwrite(fd, &length, sizeof(length), NWTestHeaderSize + 9 * (NWTestEntrySize + 104)), sizeof(length));
+    close(fd);
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NWTestEqual(journal.count, 9);
+    NWTestEqual(journal.writtenIdentifier, 9);
+    NWTestEqual(NWTestIdentifiers(journal, 100).count, 9);
+    NWTestAssert([journal appendFrame:NWTestFrame(10, 100) identifier:10 error:nil]);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NSArray *identifiers = NWTestIdentifiers(journal, 100);
+    NWTestEqual(identifiers.count, 10);
+    NWTestEqual([identifiers.lastObject unsignedIntegerValue], 10);
+    [journal close];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+}
+
+// fills the ring, confirms part of it and appends past its end, with identifiers that wrap around 32 bits on the way
+static void NWTestWraparound(void)
+{
+    NSString *path = NWTestPath("wrap");
+    NWJournal *journal = [NWJournal journalWithPath:path capacity:64 * 1024 error:nil];
+    NWTestEqual(journal.capacity, 64 * 1024);
+    uint32_t start = UINT32_MAX - 40, identifier = start;
+    NSUInteger appended = 0;
+    NSError *error = nil;
+    while ([journal appendFrame:NWTestFrame(identifier + 1, 1000) identifier:identifier + 1 error:&error]) {
+        identifier++;
+        appended++;
+    }
+    NWTestEqual(error.code, kNWErrorJournalFull);
+    NWTestEqual(appended, 64 * 1024 / (NWTestEntrySize + 1000));
+    NWTestEqual(journal.writtenIdentifier, 23);
+
+    NWTestEqual([journal acknowledgeThroughIdentifier:start + 10], 10);
+    NWTestEqual(journal.acknowledgedIdentifier, start + 10);
+    for (NSUInteger i = 0; i < 10; i++) {
+        identifier++;
+        NWTestAssert([journal appendFrame:NWTestFrame(identifier, 1000) identifier:identifier error:nil]);
+    }
+    NWTestAssert(![journal appendFrame:NWTestFrame(identifier + 1, 1000) identifier:identifier + 1 error:nil]);
+    NWTestAssert([journal flush]);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NWTestEqual(journal.count, appended);
+    NWTestEqual(journal.writtenIdentifier, identifier);
+    NWTestEqual(journal.acknowledgedIdentifier, start + 10);
+    NSArray *identifiers = NWTestIdentifiers(journal, 1000);
+    NWTestEqual(identifiers.count, appended);
+    for (NSUInteger i = 0; i < identifiers.count; i++) NWTestEqual([identifiers[i] unsignedIntegerValue], (uint32_t)(start + 11 + i));
+
+    NWTestEqual([journal acknowledgeThroughIdentifier:5], 36);
+    NWTestEqual(journal.count, appended - 36);
+    NWTestEqual([NWTestIdentifiers(journal, 1000).firstObject unsignedIntegerValue], 6);
+    [journal close];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+}
+
+// both watermarks and the time of each frame are kept in the file, replayed frames restart their error window
+static void NWTestWatermarks(void)
+{
+    NSString *path = NWTestPath("watermarks");
+    NWJournal *journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    for (uint32_t i = 1; i <= 10; i++) NWTestAssert([journal appendFrame:NWTestFrame(i, 50) identifier:i error:nil]);
+    NWTestEqual([journal acknowledgeThroughIdentifier:4], 4);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NWTestEqual(journal.acknowledgedIdentifier, 4);
+    NWTestEqual(journal.writtenIdentifier, 10);
+    NWTestEqual(journal.count, 6);
+    NWTestEqual([NWTestIdentifiers(journal, 50).firstObject unsignedIntegerValue], 5);
+    NWTestEqual([journal acknowledgeThroughIdentifier:4], 0);
+
+    usleep(200000);
+    NWTestEqual([journal renewFramesThroughIdentifier:7], 3);
+    NWTestAssert([journal synchronize]);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NWTestEqual([journal acknowledgeFramesOlderThan:0.1], 0);
+    usleep(200000);
+    NWTestEqual([journal acknowledgeFramesOlderThan:0.1], 6);
+    NWTestEqual(journal.acknowledgedIdentifier, 10);
+    NWTestEqual(journal.count, 0);
+    [journal close];
+
+    journal = [NWJournal journalWithPath:path capacity:0 error:nil];
+    NWTestEqual(journal.count, 0);
+    NWTestEqual(journal.acknowledgedIdentifier, 10);
+    [journal close];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestReopen();
+        NWTestTorn();
+        NWTestWraparound();
+        NWTestWatermarks();
+    }
+    return NWTestFinish("NWJournalTests");
+}
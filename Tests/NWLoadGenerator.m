@@ -0,0 +1,259 @@
+//
+//  NWLoadGenerator.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Pushes notifications through NWHub (one hub per connection, using NWPusherPool) to a server that behaves like
+//  the APNs gateway, usually NWStandIn on localhost, and reports throughput, push latency, reconnects and bytes on
+//  the wire:
+//
+//    build/NWStandIn -c build/standin.pem -r 10000:8 &
+//    build/NWLoadGenerator -n 1000000 -c 4
+//
+//  With -2 it pushes through NWHTTP2Pusher to a stand-in for the HTTP/2 provider API instead, and reports
+//  throughput and the latency of every request. Holding back a response shows whether it holds up the others:
+//
+//    build/NWStandIn -m h2 -c build/standin.pem -r 10000:8 -s 100:500 &
+//    build/NWLoadGenerator -2 -n 1000000 -r 1000
+//
+
+#import "NWPusherPool.h"
+#import "NWHTTP2Pusher.h"
+#import "NWHub.h"
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWSSLConnection.h"
+#import "NWSecTools.h"
+#include "NWMetrics.h"
+#include "NWTest.h"
+#include <stdatomic.h>
+#include <unistd.h>
+
+@interface NWLoadDelegate : NSObject <NWHubDelegate>
+@property (nonatomic, readonly) NSUInteger failed;
+@end
+
+@implementation NWLoadDelegate {
+    _Atomic(NSUInteger) _failed;
+}
+
+- (void)notification:(NWNotification *)notification didFailWithError:(NSError *)error
+{
+    atomic_fetch_add_explicit(&_failed, 1, memory_order_relaxed);
+}
+
+- (NSUInteger)failed
+{
+    return atomic_load_explicit(&_failed, memory_order_relaxed);
+}
+
+@end
+
+static int NWLoadUsage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [-2] [-h host] [-p port] [-n count] [-b batch] [-c connections] [-r requests] [-s bytes] [-a anchor.der] [-i identity.p12] [-w password]\n"
+        "  -2  push over the HTTP/2 provider API\n"
+        "  -h  host of the gateway, defaults to localhost\n"
+        "  -p  port of the gateway, defaults to 2195, or 2197 with -2\n"
+        "  -n  number of notifications, defaults to 100000\n"
+        "  -b  notifications per push call, defaults to 100\n"
+        "  -c  number of connections, defaults to 1\n"
+        "  -r  with -2, requests in flight per connection, defaults to 1000\n"
+        "  -s  payload size in bytes (20-2048), defaults to 100\n"
+        "  -a  DER certificate to trust as root, defaults to build/standin.der\n"
+        "  -i  PKCS12 file with the client identity, defaults to build/client.p12\n"
+        "  -w  password of the PKCS12 file, defaults to standin\n", name);
+    return 2;
+}
+
+static void NWLoadReportHistogram(const char *name, NWHistogram histogram)
+{
+    NWHistogramSnapshot snapshot;
+    NWHistogramGetSnapshot(histogram, &snapshot);
+    printf("%-20s %8llu  p50 %9.3f ms  p99 %9.3f ms  max %9.3f ms\n", name, (unsigned long long)snapshot.count,
+        NWHistogramPercentile(&snapshot, 50) * 1e-6, NWHistogramPercentile(&snapshot, 99) * 1e-6, snapshot.max * 1e-6);
+}
+
+static int NWCompareDoubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void NWLoadReportLatencies(const char *name, double *latencies, NSUInteger count, const char *unit)
+{
+    qsort(latencies, count, sizeof(double), NWCompareDoubles);
+    printf("%-20s %8lu  p50 %9.3f ms  p99 %9.3f ms  max %9.3f ms%s\n", name, (unsigned long)count,
+        latencies[count / 2] * 1e3, latencies[MIN(count - 1, count * 99 / 100)] * 1e3, latencies[count - 1] * 1e3, unit);
+}
+
+static NSArray *NWLoadTokens(NSUInteger count)
+{
+    NSMutableArray *tokens = [[NSMutableArray alloc] initWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        uint8_t bytes[32];
+        for (NSUInteger j = 0; j < sizeof(bytes); j++) bytes[j] = (uint8_t)arc4random();
+        [tokens addObject:[NSData dataWithBytes:bytes length:sizeof(bytes)]];
+    }
+    return tokens;
+}
+
+// Pushes count notifications over connections HTTP/2 connections, with up to requests in flight on each.
+static int NWLoadHTTP2(NSString *host, NSUInteger port, NWIdentityRef identity, NWCertificateRef certificate, NSData *payload, NSUInteger count, NSUInteger connections, NSUInteger requests)
+{
+    NWLoadDelegate *delegate = [[NWLoadDelegate alloc] init];
+    NSMutableArray *pushers = [[NSMutableArray alloc] initWithCapacity:connections];
+    NSError *error = nil;
+    for (NSUInteger i = 0; i < connections; i++) {
+        NWHTTP2Pusher *pusher = [[NWHTTP2Pusher alloc] initWithDelegate:delegate];
+        pusher.anchorCertificates = @[certificate];
+        pusher.maxConcurrentRequests = requests;
+        if (![pusher connectWithIdentity:identity host:host port:port error:&error]) {
+            fprintf(stderr, "unable to connect to %s:%lu: %s\n", host.UTF8String, (unsigned long)port, error.localizedDescription.UTF8String);
+            return 1;
+        }
+        [pushers addObject:pusher];
+    }
+    NSArray *tokens = NWLoadTokens(1000);
+    double *latencies = calloc(count, sizeof(double));
+    double start = NWTestSeconds();
+    for (NSUInteger i = 0; i < count; i++) {
+        @autoreleasepool {
+            NWNotification *notification = [[NWNotification alloc] initWithPayloadData:payload tokenData:tokens[i % tokens.count] identifier:0 expirationStamp:0 addExpiration:NO priority:0];
+            double before = NWTestSeconds();
+            [pushers[i % connections] pushNotification:notification completion:^(NSError *e) {
+                latencies[i] = NWTestSeconds() - before;
+            }];
+        }
+    }
+    BOOL completed = YES;
+    for (NWHTTP2Pusher *pusher in pushers) {
+        completed = [pusher waitWithTimeout:60] && completed;
+    }
+    double elapsed = NWTestSeconds() - start;
+    if (!completed) {
+        fprintf(stderr, "timed out waiting for responses\n");
+    }
+    for (NWHTTP2Pusher *pusher in pushers) {
+        [pusher disconnect];
+    }
+    printf("notifications        %8lu  in %.3f s  %.0f/s\n", (unsigned long)count, elapsed, count / elapsed);
+    NWLoadReportLatencies("request latency", latencies, count, "");
+    printf("failed               %8lu\n", (unsigned long)delegate.failed);
+    free(latencies);
+    return completed ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "localhost", *anchor = "build/standin.der", *identityPath = "build/client.p12", *password = "standin";
+    NSUInteger port = 0, count = 100000, batch = 100, connections = 1, requests = 1000, size = 100;
+    BOOL h2 = NO;
+    int option;
+    while ((option = getopt(argc, argv, "2h:p:n:b:c:r:s:a:i:w:")) != -1) {
+        switch (option) {
+            case '2': h2 = YES; break;
+            case 'h': host = optarg; break;
+            case 'p': port = strtoul(optarg, NULL, 10); break;
+            case 'n': count = strtoul(optarg, NULL, 10); break;
+            case 'b': batch = strtoul(optarg, NULL, 10); break;
+            case 'c': connections = strtoul(optarg, NULL, 10); break;
+            case 'r': requests = strtoul(optarg, NULL, 10); break;
+            case 's': size = strtoul(optarg, NULL, 10); break;
+            case 'a': anchor = optarg; break;
+            case 'i': identityPath = optarg; break;
+            case 'w': password = optarg; break;
+            default: return NWLoadUsage(argv[0]);
+        }
+    }
+    if (!count || !batch || !connections || !requests || size < 20 || size > 2048) {
+        return NWLoadUsage(argv[0]);
+    }
+    if (!port) port = h2 ? 2197 : 2195;
+    @autoreleasepool {
+        NSError *error = nil;
+        NSData *pkcs12 = [NSData dataWithContentsOfFile:@(identityPath)];
+        NWIdentityRef identity = pkcs12 ? [NWSecTools identityWithPKCS12Data:pkcs12 password:@(password) error:&error] : nil;
+        if (!identity) {
+            fprintf(stderr, "unable to load identity %s: %s\n", identityPath, error.localizedDescription.UTF8String ?: "no such file");
+            return 1;
+        }
+        NSData *anchorData = [NSData dataWithContentsOfFile:@(anchor)];
+        NWCertificateRef certificate = anchorData ? [NWSecTools certificateWithData:anchorData] : nil;
+        if (!certificate) {
+            fprintf(stderr, "unable to load anchor certificate %s\n", anchor);
+            return 1;
+        }
+        NSString *alert = [@"" stringByPaddingToLength:size - 20 withString:@"x" startingIndex:0];
+        NSData *payload = [[NSString stringWithFormat:@"{\"aps\":{\"alert\":\"%@\"}}", alert] dataUsingEncoding:NSUTF8StringEncoding];
+        if (h2) {
+            return NWLoadHTTP2(@(host), port, identity, certificate, payload, count, connections, requests);
+        }
+
+        NWLoadDelegate *delegate = [[NWLoadDelegate alloc] init];
+        NWPusherPool *pool = [[NWPusherPool alloc] initWithSize:connections delegate:delegate];
+        double start = NWTestSeconds();
+        for (NSUInteger i = 0; i < connections; i++) {
+            NWSSLConnection *connection = [[NWSSLConnection alloc] initWithHost:@(host) port:port identity:identity];
+            connection.anchorCertificates = @[certificate];
+            connection.addressOffset = i;
+            if (![connection connectWithError:&error]) {
+                fprintf(stderr, "unable to connect to %s:%lu: %s\n", host, (unsigned long)port, error.localizedDescription.UTF8String);
+                return 1;
+            }
+            ((NWHub *)pool.hubs[i]).pusher.connection = connection;
+        }
+        printf("connected %lu in %.3f s\n", (unsigned long)connections, NWTestSeconds() - start);
+        // from here on handshakes are reconnects
+        NWMetricsReset();
+        [pool startReading];
+
+        NSArray *tokens = NWLoadTokens(batch);
+
+        NSUInteger batches = (count + batch - 1) / batch, fails = 0;
+        double *latencies = calloc(batches, sizeof(double));
+        start = NWTestSeconds();
+        for (NSUInteger b = 0, pushed = 0; b < batches; b++) {
+            @autoreleasepool {
+                NSUInteger n = MIN(batch, count - pushed);
+                NSMutableArray *notifications = [[NSMutableArray alloc] initWithCapacity:n];
+                for (NSUInteger i = 0; i < n; i++) {
+                    [notifications addObject:[[NWNotification alloc] initWithPayloadData:payload tokenData:tokens[i] identifier:0 expirationStamp:0 addExpiration:NO priority:0]];
+                }
+                double before = NWTestSeconds();
+                fails += [pool pushNotifications:notifications];
+                latencies[b] = NWTestSeconds() - before;
+                pushed += n;
+            }
+        }
+        double elapsed = NWTestSeconds() - start;
+        // give the server time to report errors on the last notifications
+        usleep(500000);
+        [pool stopReading];
+        [pool readFailed];
+
+        NSUInteger full = 0, resumed = 0;
+        for (NWHub *hub in pool.hubs) {
+            NSDictionary *statistics = hub.pusher.connection.handshakeStatistics;
+            full += [statistics[@"full"] unsignedIntegerValue];
+            resumed += [statistics[@"resumed"] unsignedIntegerValue];
+        }
+        printf("notifications        %8lu  in %.3f s  %.0f/s\n", (unsigned long)count, elapsed, count / elapsed);
+        char unit[32];
+        snprintf(unit, sizeof(unit), "  (per call of %lu)", (unsigned long)batch);
+        NWLoadReportLatencies("push latency", latencies, batches, unit);
+        NWLoadReportHistogram("write", kNWHistogramWrite);
+        NWLoadReportHistogram("error response", kNWHistogramErrorResponse);
+        NWLoadReportHistogram("reconnect handshake", kNWHistogramHandshake);
+        printf("reconnects           %8lld  (%lu full, %lu resumed handshakes in total)\n", (long long)NWMetricsValue(kNWMetricReconnects),
+            (unsigned long)full, (unsigned long)resumed);
+        printf("bytes written        %8lld  %.1f bytes/notification  %lld writes\n", (long long)NWMetricsValue(kNWMetricWriteBytes),
+            (double)NWMetricsValue(kNWMetricWriteBytes) / count, (long long)NWMetricsValue(kNWMetricWrites));
+        printf("failed               %8lu  (%lu reported to the delegate)\n", (unsigned long)fails, (unsigned long)delegate.failed);
+        free(latencies);
+        [pool disconnect];
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+//
+//  NWLoggingBenchmark.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Per-call cost of NWLCore log statements: disabled statements with the per-statement filter cache, the filter
+//  lookup they did before it, and enabled statements printed synchronously, asynchronously and rate-limited.
+//
+
+#define DEBUG 1
+#include "NWLCore.h"
+#include "NWTest.h"
+#include <string.h>
+
+static const long NWBenchmarkCalls = 10000000;
+static const long NWBenchmarkPrinted = 200000;
+
+static long NWBenchmarkLines = 0;
+
+static void NWBenchmarkPrinter(NWLContext context, CFStringRef message, void *info) {
+    __atomic_add_fetch(&NWBenchmarkLines, 1, __ATOMIC_RELAXED);
+}
+
+static void NWReport(const char *name, double seconds, long calls) {
+    printf("%-28s %8.2f ns/call %10ld calls\n", name, seconds * 1e9 / calls, calls);
+}
+
+int main(void) {
+    NWLRemoveAllPrinters();
+    NWLAddPrinter("benchmark", NWBenchmarkPrinter, NULL);
+    NWLRemoveAllFilters();
+
+    double start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkCalls; i++) {
+        NWLogDbug("disabled %ld", i);
+    }
+    NWReport("disabled, cached", NWTestSeconds() - start, NWBenchmarkCalls);
+
+    // what every disabled statement did before the cache: take the time and match the filters
+    NWLAddFilter("info", "other", NULL, NULL, kNWLAction_print);
+    NWLAddFilter("warn", NULL, "other.c", NULL, kNWLAction_print);
+    long matched = 0;
+    start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkCalls; i++) {
+        NWLContext context = {"dbug", NULL, _NWL_FILE_, __LINE__, __PRETTY_FUNCTION__, NWLTime()};
+        matched += NWLMatchingActionForContext(context) != kNWLAction_none;
+    }
+    NWReport("disabled, filter lookup", NWTestSeconds() - start, NWBenchmarkCalls);
+    NWTestEqual(matched, 0);
+
+    start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkCalls; i++) {
+        NWLogDbug("disabled with filters %ld", i);
+    }
+    NWReport("disabled with filters, cached", NWTestSeconds() - start, NWBenchmarkCalls);
+    NWTestEqual(NWBenchmarkLines, 0);
+
+    NWLAddFilter("info", NULL, NULL, NULL, kNWLAction_print);
+    start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkPrinted; i++) {
+        NWLogInfo("printed %ld", i);
+    }
+    NWReport("printed", NWTestSeconds() - start, NWBenchmarkPrinted);
+    NWTestEqual(NWBenchmarkLines, NWBenchmarkPrinted);
+
+    NWLSetAsync(1);
+    start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkPrinted; i++) {
+        NWLogInfo("queued %ld", i);
+    }
+    NWReport("printed, async", NWTestSeconds() - start, NWBenchmarkPrinted);
+    NWLSetAsync(0);
+    NWTestAssert(NWBenchmarkLines > NWBenchmarkPrinted);
+
+    long lines = NWBenchmarkLines;
+    start = NWTestSeconds();
+    for (long i = 0; i < NWBenchmarkCalls; i++) {
+        NWLogInfoEvery(1000, "sampled %ld", i);
+    }
+    NWReport("printed every 1000th", NWTestSeconds() - start, NWBenchmarkCalls);
+    NWTestEqual(NWBenchmarkLines - lines, NWBenchmarkCalls / 1000);
+
+    NWLRestore();
+    return NWTestFinish("NWLoggingBenchmark");
+}
@@ -0,0 +1,96 @@
+//
+//  NWMetricsTests.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWTest.h"
+#include "NWMetrics.h"
+#include <pthread.h>
+#include <string.h>
+
+#define NWTestThreads 8
+#define NWTestAdds 100000
+
+
+static void *NWTestAddFromThread(void *arg) {
+    for (int i = 0; i < NWTestAdds; i++) {
+        NWMetricsAdd(kNWMetricWrites, 1);
+        NWMetricsAdd(kNWMetricInFlight, i % 2 ? -1 : 1);
+        NWHistogramRecord(kNWHistogramWrite, (uint64_t)i);
+    }
+    return arg;
+}
+
+static void NWTestCountersFromThreads(void) {
+    NWMetricsReset();
+    pthread_t threads[NWTestThreads];
+    for (int t = 0; t < NWTestThreads; t++) pthread_create(&threads[t], NULL, NWTestAddFromThread, NULL);
+    for (int t = 0; t < NWTestThreads; t++) pthread_join(threads[t], NULL);
+    NWTestEqual(NWMetricsValue(kNWMetricWrites), NWTestThreads * NWTestAdds);
+    NWTestEqual(NWMetricsValue(kNWMetricInFlight), 0);
+    NWHistogramSnapshot snapshot;
+    NWHistogramGetSnapshot(kNWHistogramWrite, &snapshot);
+    NWTestEqual(snapshot.count, NWTestThreads * NWTestAdds);
+    NWTestEqual(snapshot.sum, (uint64_t)NWTestThreads * NWTestAdds * (NWTestAdds - 1) / 2);
+    NWTestEqual(snapshot.max, NWTestAdds - 1);
+}
+
+static void NWTestBuckets(void) {
+    // every bucket starts where the previous ends, and values within 12.5% share a bucket
+    for (size_t i = 1; i < NWHistogramBucketCount; i++) {
+        NWTestAssert(NWHistogramBucketValue(i) > NWHistogramBucketValue(i - 1));
+    }
+    for (uint64_t value = 1; value < (1ULL << 40); value = value * 3 + 1) {
+        NWMetricsReset();
+        NWHistogramRecord(kNWHistogramWriteSize, value);
+        NWHistogramSnapshot snapshot;
+        NWHistogramGetSnapshot(kNWHistogramWriteSize, &snapshot);
+        size_t bucket = 0;
+        while (!snapshot.buckets[bucket]) bucket++;
+        NWTestAssert(NWHistogramBucketValue(bucket) <= value);
+        NWTestAssert(bucket + 1 == NWHistogramBucketCount || NWHistogramBucketValue(bucket + 1) > value);
+        NWTestAssert(value - NWHistogramBucketValue(bucket) <= value / 8);
+    }
+}
+
+static void NWTestPercentiles(void) {
+    NWMetricsReset();
+    for (uint64_t value = 1; value <= 1000; value++) NWHistogramRecord(kNWHistogramHandshake, value * 1000);
+    NWHistogramSnapshot snapshot;
+    NWHistogramGetSnapshot(kNWHistogramHandshake, &snapshot);
+    uint64_t p50 = NWHistogramPercentile(&snapshot, 50), p99 = NWHistogramPercentile(&snapshot, 99);
+    NWTestAssert(p50 >= 500000 && p50 <= 500000 + 500000 / 8);
+    NWTestAssert(p99 >= 990000 && p99 <= 1000000);
+    NWTestEqual(NWHistogramPercentile(&snapshot, 100), 1000000);
+    NWHistogramGetSnapshot(kNWHistogramSerialize, &snapshot);
+    NWTestEqual(NWHistogramPercentile(&snapshot, 50), 0);
+}
+
+static void NWTestReconnectsAndExport(void) {
+    NWMetricsReset();
+    NWMetricsAddReconnect(-208);
+    NWMetricsAddReconnect(-208);
+    NWMetricsAddReconnect(-100000);
+    NWTestEqual(NWMetricsValue(kNWMetricReconnects), 3);
+    NWTestEqual(NWMetricsReconnectsWithCode(-208), 2);
+    NWTestEqual(NWMetricsReconnectsWithCode(-100000), 1);
+    char small[16];
+    size_t length = NWMetricsExport(small, sizeof(small));
+    NWTestAssert(length > sizeof(small));
+    NWTestEqual(strlen(small), sizeof(small) - 1);
+    char buffer[16384];
+    NWTestEqual(NWMetricsExport(buffer, sizeof(buffer)), length);
+    NWTestAssert(strstr(buffer, "nwpusher_reconnects_total 3\n"));
+    NWTestAssert(strstr(buffer, "nwpusher_reconnects_total{code=\"-208\"} 2\n"));
+    NWTestAssert(strstr(buffer, "nwpusher_handshake_ns_count 0\n"));
+}
+
+int main(void) {
+    NWTestCountersFromThreads();
+    NWTestBuckets();
+    NWTestPercentiles();
+    NWTestReconnectsAndExport();
+    return NWTestFinish("NWMetricsTests");
+}
@@ -0,0 +1,166 @@
+//
+//  NWPacerTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Reports writes to a pacer with a stub connection that claims a send buffer size and a number of unsent bytes, and
+//  checks the batch size grows and shrinks within its limits, and that waiting drains the buffer below highOccupancy.
+//
+
+#import "NWPacer.h"
+#import "NWSSLConnection.h"
+#include "NWTest.h"
+#include <unistd.h>
+
+static NSInteger const NWTestBufferSize = 100000;
+
+/** A connection without socket, with the send buffer in the state the test sets. Every wait drains `drain` bytes. */
+@interface NWPacerTestConnection : NWSSLConnection
+@property (nonatomic, assign) NSInteger unsent;
+@property (nonatomic, assign) NSInteger size;
+@property (nonatomic, assign) NSInteger drain;
+@property (nonatomic, readonly) NSUInteger waits;
+@end
+
+@implementation NWPacerTestConnection {
+    NSUInteger _watermark;
+}
+
+- (NSInteger)unsentLength
+{
+    return _unsent;
+}
+
+- (NSInteger)sendBufferSize
+{
+    return _size;
+}
+
+- (NSUInteger)sendLowWatermark
+{
+    return _watermark;
+}
+
+- (void)setSendLowWatermark:(NSUInteger)sendLowWatermark
+{
+    _watermark = sendLowWatermark;
+}
+
+- (BOOL)waitForWriteWithTimeout:(NSTimeInterval)timeout
+{
+    _waits++;
+    if (!_drain) {
+        usleep((useconds_t)(timeout * 1000000));
+        return NO;
+    }
+    _unsent = MAX(_unsent - _drain, 0);
+    return YES;
+}
+
+@end
+
+static NWPacerTestConnection *NWTestConnection(NSInteger unsent)
+{
+    NWPacerTestConnection *connection = [[NWPacerTestConnection alloc] init];
+    connection.size = NWTestBufferSize;
+    connection.unsent = unsent;
+    return connection;
+}
+
+// an empty buffer grows the batch by minBatchSize up to maxBatchSize, a full one or partial write halves it down to minBatchSize
+static void NWTestLimits(void)
+{
+    NWPacer *pacer = [[NWPacer alloc] init];
+    NWTestEqual(pacer.batchSize, 16 * 1024);
+    NWTestEqual(pacer.minBatchSize, 2 * 1024);
+    NWTestEqual(pacer.maxBatchSize, 64 * 1024);
+
+    NWPacerTestConnection *connection = NWTestConnection(0);
+    for (NSUInteger i = 0; i < 100; i++) {
+        NSUInteger before = pacer.batchSize;
+        [pacer connection:connection didWriteLength:before ofLength:before];
+        NWTestEqual(pacer.batchSize, MIN(before + pacer.minBatchSize, pacer.maxBatchSize));
+    }
+    NWTestEqual(pacer.batchSize, pacer.maxBatchSize);
+
+    connection.unsent = NWTestBufferSize / 2;
+    [pacer connection:connection didWriteLength:100 ofLength:100];
+    NWTestEqual(pacer.batchSize, pacer.maxBatchSize);
+
+    connection.unsent = NWTestBufferSize * 9 / 10;
+    for (NSUInteger i = 0; i < 100; i++) {
+        NSUInteger before = pacer.batchSize;
+        [pacer connection:connection didWriteLength:100 ofLength:100];
+        NWTestEqual(pacer.batchSize, MAX(before / 2, pacer.minBatchSize));
+    }
+    NWTestEqual(pacer.batchSize, pacer.minBatchSize);
+    NWTestEqual([pacer.statistics[@"writes"] unsignedIntegerValue], 201);
+    NWTestEqual([pacer.statistics[@"decreases"] unsignedIntegerValue], 100);
+
+    connection.unsent = 0;
+    [pacer connection:connection didWriteLength:100 ofLength:100];
+    NWTestEqual(pacer.batchSize, 2 * pacer.minBatchSize);
+    [pacer connection:connection didWriteLength:99 ofLength:100];
+    NWTestEqual(pacer.batchSize, pacer.minBatchSize);
+    [pacer connection:connection didWriteLength:100 ofLength:100];
+    [pacer didReceiveErrorResponse];
+    NWTestEqual(pacer.batchSize, pacer.minBatchSize);
+
+    // other limits, a start above the maximum, and a connection that cannot tell its unsent bytes
+    pacer = [[NWPacer alloc] initWithBatchSize:10000];
+    pacer.minBatchSize = 1000;
+    pacer.maxBatchSize = 5000;
+    connection.size = 0;
+    [pacer connection:connection didWriteLength:100 ofLength:100];
+    NWTestEqual(pacer.batchSize, 5000);
+    [pacer connection:connection didWriteLength:100 ofLength:100];
+    NWTestEqual(pacer.batchSize, 5000);
+    [pacer connection:connection didWriteLength:0 ofLength:100];
+    NWTestEqual(pacer.batchSize, 2500);
+    [pacer connection:connection didWriteLength:0 ofLength:100];
+    [pacer connection:connection didWriteLength:0 ofLength:100];
+    NWTestEqual(pacer.batchSize, 1000);
+    NWTestEqual([pacer.statistics[@"occupancy"] doubleValue], 0);
+}
+
+// waiting returns at once below highOccupancy, and otherwise once the buffer drained below it or the timeout passed
+static void NWTestWait(void)
+{
+    NWPacer *pacer = [[NWPacer alloc] init];
+    NWPacerTestConnection *connection = NWTestConnection(NWTestBufferSize * 3 / 4);
+    connection.drain = 5000;
+    [pacer waitForConnection:connection];
+    NWTestEqual(connection.waits, 0);
+    NWTestEqual(connection.sendLowWatermark, 0);
+
+    connection.unsent = NWTestBufferSize * 9 / 10;
+    [pacer waitForConnection:connection];
+    NWTestEqual(connection.waits, 3);
+    NWTestEqual(connection.unsent, NWTestBufferSize * 3 / 4);
+    NWTestEqual(connection.sendLowWatermark, NWTestBufferSize / 4);
+
+    connection.size = 0;
+    connection.unsent = NWTestBufferSize;
+    [pacer waitForConnection:connection];
+    NWTestEqual(connection.waits, 3);
+
+    connection.size = NWTestBufferSize;
+    connection.drain = 0;
+    connection.timeout = 0.2;
+    double start = NWTestSeconds();
+    [pacer waitForConnection:connection];
+    double waited = NWTestSeconds() - start;
+    NWTestAssert(waited >= 0.19 && waited < 2);
+    NWTestEqual(connection.unsent, NWTestBufferSize);
+    NWTestAssert([pacer.statistics[@"waited"] doubleValue] >= 0.19);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestLimits();
+        NWTestWait();
+    }
+    return NWTestFinish("NWPacerTests");
+}
@@ -0,0 +1,112 @@
+//
+//  NWPushFeedbackTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Feeds feedback tuples split over many small reads and followed by a truncated tail, and checks every complete
+//  tuple is delivered once before the fragment is reported.
+//
+
+#import "NWPushFeedback.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+
+static NSUInteger const NWTestTupleSize = 38;
+
+static NSData *NWTestTuples(NSUInteger count, uint16_t tokenLength)
+{
+    NSMutableData *data = [[NSMutableData alloc] init];
+    for (NSUInteger i = 0; i < count; i++) {
+        uint8_t tuple[NWTestTupleSize] = {0, 0x10, 0, (uint8_t)i, (uint8_t)(tokenLength >> 8), (uint8_t)tokenLength};
+        for (NSUInteger t = 0; t < 32; t++) tuple[6 + t] = (uint8_t)(i * 32 + t);
+        [data appendBytes:tuple length:sizeof(tuple)];
+    }
+    return data;
+}
+
+static void NWTestCheckTuple(const NWFeedbackTuple *tuple, NSUInteger i)
+{
+    NWTestEqual(tuple->timestamp, 0x100000 + i);
+    for (NSUInteger t = 0; t < 32; t++) {
+        NWTestEqual(tuple->token[t], (uint8_t)(i * 32 + t));
+        if (tuple->token[t] != (uint8_t)(i * 32 + t)) break;
+    }
+}
+
+static NWPushFeedback *NWTestFeedback(NSData *response, NSUInteger readLength)
+{
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    sink.response = response;
+    sink.readLength = readLength;
+    sink.closesAfterResponse = YES;
+    NWPushFeedback *feedback = [[NWPushFeedback alloc] init];
+    feedback.connection = sink;
+    return feedback;
+}
+
+// tuples that arrive in pieces, with reads that end inside the header, the token and at tuple boundaries
+static void NWTestSplit(void)
+{
+    for (NSUInteger readLength = 1; readLength <= 2 * NWTestTupleSize + 1; readLength += 6) {
+        NWPushFeedback *feedback = NWTestFeedback(NWTestTuples(10, 32), readLength);
+        __block NSUInteger total = 0;
+        NSError *error = nil;
+        BOOL read = [feedback readTuplesWithMax:100 handler:^(const NWFeedbackTuple *tuples, NSUInteger count) {
+            for (NSUInteger i = 0; i < count; i++) NWTestCheckTuple(&tuples[i], total + i);
+            total += count;
+        } error:&error];
+        NWTestAssert(read);
+        NWTestAssert(!error);
+        NWTestEqual(total, 10);
+    }
+
+    NWPushFeedback *feedback = NWTestFeedback(NWTestTuples(3, 32), 7);
+    NSUInteger tokens = 0;
+    NSError *error = nil;
+    for (NSUInteger i = 0; i < 1000 && !error; i++) {
+        NSData *token = nil;
+        NSDate *date = nil;
+        if (![feedback readTokenData:&token date:&date error:&error] || !token) continue;
+        NWTestEqual(date.timeIntervalSince1970, 0x100000 + tokens);
+        NWTestEqual(((const uint8_t *)token.bytes)[0], (uint8_t)(tokens * 32));
+        tokens++;
+    }
+    NWTestEqual(tokens, 3);
+    NWTestEqual(error.code, kNWErrorReadClosedGraceful);
+}
+
+// a tail shorter than a tuple is reported after the tuples before it were delivered
+static void NWTestTruncated(void)
+{
+    for (NSUInteger readLength = 5; readLength <= 1000; readLength *= 5) {
+        NSMutableData *response = NWTestTuples(4, 32).mutableCopy;
+        [response appendData:[NWTestTuples(1, 32) subdataWithRange:NSMakeRange(0, 20)]];
+        NWPushFeedback *feedback = NWTestFeedback(response, readLength);
+        __block NSUInteger total = 0;
+        NSError *error = nil;
+        BOOL read = [feedback readTuplesWithMax:100 handler:^(const NWFeedbackTuple *tuples, NSUInteger count) {
+            for (NSUInteger i = 0; i < count; i++) NWTestCheckTuple(&tuples[i], total + i);
+            total += count;
+        } error:&error];
+        NWTestAssert(!read);
+        NWTestEqual(total, 4);
+        NWTestEqual(error.code, kNWErrorFeedbackLength);
+    }
+
+    NWPushFeedback *feedback = NWTestFeedback(NWTestTuples(2, 16), 1000);
+    NSError *error = nil;
+    NWTestAssert(![feedback readTuplesWithMax:100 handler:^(const NWFeedbackTuple *tuples, NSUInteger count) {
+        NWTestAssert(NO);
+    } error:&error]);
+    NWTestEqual(error.code, kNWErrorFeedbackTokenLength);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestSplit();
+        NWTestTruncated();
+    }
+    return NWTestFinish("NWPushFeedbackTests");
+}
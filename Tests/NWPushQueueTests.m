@@ -0,0 +1,97 @@
+//
+//  NWPushQueueTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Submits notifications from 8 producer threads, while also pushing through the hub directly, and checks every
+//  notification reaches the connection once, with a unique identifier and in the order of its producer.
+//
+
+#import "NWPushQueue.h"
+#import "NWHub.h"
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+#include <unistd.h>
+
+#define NWTestProducers 8
+static NSUInteger const NWTestPerProducer = 20000;
+static NSUInteger const NWTestDirect = 1000;
+
+static NWNotification *NWTestNotification(NSData *payload, NSUInteger producer, NSUInteger sequence)
+{
+    uint8_t token[32] = {(uint8_t)producer, (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16), (uint8_t)(sequence >> 8), (uint8_t)sequence};
+    NSData *tokenData = [NSData dataWithBytes:token length:sizeof(token)];
+    return [[NWNotification alloc] initWithPayloadData:payload tokenData:tokenData identifier:0 expirationStamp:0 addExpiration:NO priority:0];
+}
+
+static uint32_t NWTestRead32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NSData *payload = [@"{\"aps\":{\"alert\":\"queue\"}}" dataUsingEncoding:NSUTF8StringEncoding];
+        NWHub *hub = [[NWHub alloc] init];
+        NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+        sink.keepsData = YES;
+        hub.pusher.connection = sink;
+        NWPushQueue *queue = [[NWPushQueue alloc] initWithHub:hub capacity:1024];
+
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger p = 0; p < NWTestProducers; p++) {
+            dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+                for (NSUInteger i = 0; i < NWTestPerProducer; i++) {
+                    @autoreleasepool {
+                        NWNotification *notification = NWTestNotification(payload, p, i);
+                        while (![queue pushNotification:notification error:nil]) usleep(50);
+                    }
+                }
+            });
+        }
+        // identifiers taken by the hub itself must not collide with those of the queue
+        for (NSUInteger i = 0; i < NWTestDirect; i++) {
+            NWTestAssert([hub pushNotification:NWTestNotification(payload, NWTestProducers, i) autoReconnect:NO error:nil]);
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+        NSUInteger frame = [NWTestNotification(payload, 0, 0) lengthWithType:kNWNotificationType2];
+        NSUInteger total = NWTestProducers * NWTestPerProducer + NWTestDirect;
+        double deadline = NWTestSeconds() + 10;
+        while (sink.bytes < total * frame && NWTestSeconds() < deadline) usleep(1000);
+        NWTestEqual(sink.bytes, total * frame);
+        NWTestEqual(queue.count, 0);
+
+        NSMutableIndexSet *identifiers = [[NSMutableIndexSet alloc] init];
+        NSUInteger next[NWTestProducers + 1] = {0};
+        const uint8_t *bytes = sink.data.bytes;
+        for (NSUInteger offset = 0; offset + frame <= sink.data.length; offset += frame) {
+            const uint8_t *p = bytes + offset;
+            NWTestEqual(p[0], 2);
+            uint32_t identifier = 0;
+            NSUInteger producer = NWTestProducers + 1, sequence = 0;
+            for (const uint8_t *item = p + 5; item < p + 5 + NWTestRead32(p + 1); item += 3 + (item[1] << 8 | item[2])) {
+                if (item[0] == 1) {
+                    producer = item[3];
+                    sequence = NWTestRead32(item + 4);
+                }
+                if (item[0] == 3) identifier = NWTestRead32(item + 3);
+            }
+            NWTestAssert(identifier && ![identifiers containsIndex:identifier]);
+            [identifiers addIndex:identifier];
+            NWTestAssert(producer <= NWTestProducers);
+            if (producer <= NWTestProducers) {
+                NWTestEqual(sequence, next[producer]);
+                next[producer] = sequence + 1;
+            }
+        }
+        NWTestEqual(identifiers.count, total);
+        for (NSUInteger p = 0; p < NWTestProducers; p++) NWTestEqual(next[p], NWTestPerProducer);
+        NWTestEqual(next[NWTestProducers], NWTestDirect);
+    }
+    return NWTestFinish("NWPushQueueTests");
+}
@@ -0,0 +1,163 @@
+//
+//  NWPushSchedulerTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Queues a broadcast and urgent notifications at once and checks the order they reach the connection follows
+//  highWeight, then queues notifications of which some have expired and checks those are reported and not sent.
+//
+
+#import "NWPushScheduler.h"
+#import "NWHub.h"
+#import "NWNotification.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+#include <unistd.h>
+
+static NSUInteger const NWTestBatchSize = 256;
+
+@interface NWSchedulerTestDelegate : NSObject <NWHubDelegate>
+@property (nonatomic, readonly) NSArray *failed;
+@end
+
+@implementation NWSchedulerTestDelegate {
+    NSMutableArray *_failed;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _failed = @[].mutableCopy;
+    }
+    return self;
+}
+
+- (void)notification:(NWNotification *)notification didFailWithError:(NSError *)error
+{
+    @synchronized (self) {
+        [_failed addObject:@[notification, @(error.code)]];
+    }
+}
+
+- (NSArray *)failed
+{
+    @synchronized (self) {
+        return _failed.copy;
+    }
+}
+
+@end
+
+static NWNotification *NWTestNotification(NSUInteger priority, NSUInteger sequence, NSUInteger expiration)
+{
+    NSData *payload = [@"{\"aps\":{\"alert\":\"scheduler\"}}" dataUsingEncoding:NSUTF8StringEncoding];
+    uint8_t token[32] = {(uint8_t)priority, (uint8_t)(sequence >> 8), (uint8_t)sequence};
+    NSData *tokenData = [NSData dataWithBytes:token length:sizeof(token)];
+    return [[NWNotification alloc] initWithPayloadData:payload tokenData:tokenData identifier:0 expirationStamp:expiration addExpiration:YES priority:priority];
+}
+
+// The length of a frame as written by the hub, with an identifier.
+static NSUInteger NWTestFrameLength(NSUInteger expiration)
+{
+    NWNotification *notification = NWTestNotification(10, 0, expiration);
+    notification.identifier = 1;
+    return [notification lengthWithType:kNWNotificationType2];
+}
+
+// The priority stored in the token of every frame written, in order.
+static NSArray *NWTestPriorities(NSData *data, NSUInteger frame)
+{
+    NSMutableArray *priorities = @[].mutableCopy;
+    const uint8_t *bytes = data.bytes;
+    for (NSUInteger offset = 0; offset + frame <= data.length; offset += frame) {
+        const uint8_t *p = bytes + offset;
+        NWTestEqual(p[5], 1);
+        [priorities addObject:@(p[8])];
+    }
+    return priorities;
+}
+
+static BOOL NWTestWait(NWPushScheduler *scheduler, NWSinkConnection *sink, NSUInteger bytes)
+{
+    double deadline = NWTestSeconds() + 10;
+    while ((sink.bytes < bytes || [scheduler countWithLane:NWPushLaneHigh] || [scheduler countWithLane:NWPushLaneLow]) && NWTestSeconds() < deadline) usleep(1000);
+    usleep(10000);
+    return sink.bytes == bytes;
+}
+
+// with both lanes full, every round takes highWeight batches of urgent notifications and one of the broadcast
+static void NWTestWeight(void)
+{
+    NWHub *hub = [[NWHub alloc] init];
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    sink.keepsData = YES;
+    hub.pusher.connection = sink;
+    NWPushScheduler *scheduler = [[NWPushScheduler alloc] initWithHub:hub];
+    NWTestEqual(scheduler.highWeight, 4);
+    scheduler.highWeight = 3;
+
+    NSUInteger expiration = (NSUInteger)NSDate.date.timeIntervalSince1970 + 3600;
+    NSUInteger lows = 4 * NWTestBatchSize, highs = 5 * NWTestBatchSize;
+    NSMutableArray *notifications = @[].mutableCopy;
+    for (NSUInteger i = 0; i < lows; i++) [notifications addObject:NWTestNotification(5, i, expiration)];
+    for (NSUInteger i = 0; i < highs; i++) [notifications addObject:NWTestNotification(10, i, expiration)];
+    [scheduler pushNotifications:notifications];
+
+    NSUInteger frame = NWTestFrameLength(expiration);
+    NWTestAssert(NWTestWait(scheduler, sink, (lows + highs) * frame));
+    NSArray *priorities = NWTestPriorities(sink.data, frame);
+    NWTestEqual(priorities.count, lows + highs);
+    // 3 high and 1 low, then the last 2 high and 1 low, then the rest of the low lane
+    NSUInteger expected[] = {10, 10, 10, 5, 10, 10, 5, 5, 5};
+    for (NSUInteger i = 0; i < priorities.count; i++) {
+        NWTestEqual([priorities[i] unsignedIntegerValue], expected[i / NWTestBatchSize]);
+        if ([priorities[i] unsignedIntegerValue] != expected[i / NWTestBatchSize]) break;
+    }
+    NWTestEqual([[scheduler statisticsWithLane:NWPushLaneHigh][@"pushed"] unsignedIntegerValue], highs);
+    NWTestEqual([[scheduler statisticsWithLane:NWPushLaneLow][@"pushed"] unsignedIntegerValue], lows);
+}
+
+// notifications that expired while queued are reported with kNWErrorPushExpired and never written
+static void NWTestExpired(void)
+{
+    NWSchedulerTestDelegate *delegate = [[NWSchedulerTestDelegate alloc] init];
+    NWHub *hub = [[NWHub alloc] initWithDelegate:delegate];
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    hub.pusher.connection = sink;
+    NWPushScheduler *scheduler = [[NWPushScheduler alloc] initWithHub:hub];
+
+    NSUInteger now = (NSUInteger)NSDate.date.timeIntervalSince1970;
+    NSMutableArray *notifications = @[].mutableCopy;
+    NSMutableSet *expired = [[NSMutableSet alloc] init];
+    for (NSUInteger i = 0; i < 1000; i++) {
+        NWNotification *notification = NWTestNotification(i % 2 ? 5 : 10, i, i % 3 ? now + 3600 : now - 60);
+        if (!(i % 3)) [expired addObject:notification];
+        [notifications addObject:notification];
+    }
+    [scheduler pushNotifications:notifications];
+
+    NSUInteger frame = NWTestFrameLength(now);
+    NWTestAssert(NWTestWait(scheduler, sink, (notifications.count - expired.count) * frame));
+    NSArray *failed = delegate.failed;
+    NWTestEqual(failed.count, expired.count);
+    for (NSArray *pair in failed) {
+        NWTestAssert([expired containsObject:pair[0]]);
+        NWTestEqual([pair[1] integerValue], kNWErrorPushExpired);
+        NWTestEqual([pair[0] identifier], 0);
+    }
+    NSUInteger expiredHigh = [[scheduler statisticsWithLane:NWPushLaneHigh][@"expired"] unsignedIntegerValue];
+    NSUInteger expiredLow = [[scheduler statisticsWithLane:NWPushLaneLow][@"expired"] unsignedIntegerValue];
+    NWTestEqual(expiredHigh + expiredLow, expired.count);
+    NWTestEqual(expiredHigh, 167);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestWeight();
+        NWTestExpired();
+    }
+    return NWTestFinish("NWPushSchedulerTests");
+}
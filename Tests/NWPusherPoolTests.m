@@ -0,0 +1,171 @@
+//
+//  NWPusherPoolTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Pushes through a pool of TLS connections to the stand-in server on the loopback, which fails one
+//  notification once, and checks the failure is reported by the connection it was pushed on, that this
+//  connection resumes its TLS session and replays the rest, and that the pool keeps pushing afterwards.
+//
+
+#import "NWPusherPool.h"
+#import "NWHub.h"
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWSSLConnection.h"
+#import "NWSecTools.h"
+#include "NWTest.h"
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static NSUInteger const NWTestConnections = 4;
+static NSUInteger const NWTestPerConnection = 100;
+static uint32_t const NWTestFailingIdentifier = 7;
+
+@interface NWPoolTestDelegate : NSObject <NWHubDelegate>
+@property (nonatomic, readonly) NSArray *failed;
+@end
+
+@implementation NWPoolTestDelegate {
+    NSMutableArray *_failed;
+}
+
+- (instancetype)init
+{
+    self = [super init];
+    if (self) {
+        _failed = @[].mutableCopy;
+    }
+    return self;
+}
+
+- (void)notification:(NWNotification *)notification didFailWithError:(NSError *)error
+{
+    @synchronized (self) {
+        [_failed addObject:@[notification ?: NSNull.null, @(error.code)]];
+    }
+}
+
+- (NSArray *)failed
+{
+    @synchronized (self) {
+        return _failed.copy;
+    }
+}
+
+@end
+
+// Starts the stand-in gateway on any free port, returns its process and sets the port it listens on.
+static pid_t NWTestStartStandIn(int *port)
+{
+    int fds[2];
+    if (pipe(fds)) return -1;
+    char rule[32];
+    snprintf(rule, sizeof(rule), "%u:8", NWTestFailingIdentifier);
+    pid_t pid = fork();
+    if (!pid) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        execl("build/NWStandIn", "build/NWStandIn", "-q", "-p", "0", "-c", "build/standin.pem", "-e", rule, (char *)NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    char line[128] = "";
+    FILE *output = fdopen(fds[0], "r");
+    if (output && fgets(line, sizeof(line), output)) {
+        char *space = strrchr(line, ' ');
+        *port = space ? atoi(space + 1) : 0;
+    }
+    if (output) fclose(output);
+    return pid;
+}
+
+static NSArray *NWTestNotifications(NSData *payload, NSUInteger round)
+{
+    NSMutableArray *notifications = @[].mutableCopy;
+    for (NSUInteger i = 0; i < NWTestConnections * NWTestPerConnection; i++) {
+        uint8_t token[32] = {(uint8_t)round, (uint8_t)(i >> 8), (uint8_t)i};
+        NSData *tokenData = [NSData dataWithBytes:token length:sizeof(token)];
+        [notifications addObject:[[NWNotification alloc] initWithPayloadData:payload tokenData:tokenData identifier:0 expirationStamp:0 addExpiration:NO priority:0]];
+    }
+    return notifications;
+}
+
+static void NWTestWaitForFailures(NWPoolTestDelegate *delegate, NSUInteger count)
+{
+    double deadline = NWTestSeconds() + 5;
+    while (delegate.failed.count < count && NWTestSeconds() < deadline) usleep(10000);
+    // leave time for reports that should not come
+    usleep(200000);
+}
+
+int main(void)
+{
+    signal(SIGPIPE, SIG_IGN);
+    int port = 0;
+    pid_t server = NWTestStartStandIn(&port);
+    NWTestAssert(port > 0);
+    @autoreleasepool {
+        NSData *pkcs12 = [NSData dataWithContentsOfFile:@"build/client.p12"];
+        NWIdentityRef identity = pkcs12 ? [NWSecTools identityWithPKCS12Data:pkcs12 password:@"standin" error:nil] : nil;
+        NSData *anchorData = [NSData dataWithContentsOfFile:@"build/standin.der"];
+        NWCertificateRef anchor = anchorData ? [NWSecTools certificateWithData:anchorData] : nil;
+        NWTestAssert(identity && anchor);
+
+        NWPoolTestDelegate *delegate = [[NWPoolTestDelegate alloc] init];
+        NWPusherPool *pool = [[NWPusherPool alloc] initWithSize:NWTestConnections delegate:delegate];
+        NSMutableArray *connections = @[].mutableCopy;
+        for (NSUInteger i = 0; i < NWTestConnections && port > 0 && identity && anchor; i++) {
+            NWSSLConnection *connection = [[NWSSLConnection alloc] initWithHost:@"localhost" port:port identity:identity];
+            connection.anchorCertificates = @[anchor];
+            NSError *error = nil;
+            NWTestAssert([connection connectWithError:&error]);
+            if (error) fprintf(stderr, "connect: %s\n", error.localizedDescription.UTF8String);
+            NWHub *hub = pool.hubs[i];
+            hub.replay = YES;
+            hub.pusher.connection = connection;
+            [connections addObject:connection];
+        }
+        if (connections.count == NWTestConnections) {
+            NSData *payload = [@"{\"aps\":{\"alert\":\"pool\"}}" dataUsingEncoding:NSUTF8StringEncoding];
+            [pool startReading];
+
+            // every connection numbers its own notifications, the stand-in fails the first one it sees with this identifier
+            NWTestEqual([pool pushNotifications:NWTestNotifications(payload, 0)], 0);
+            NWTestWaitForFailures(delegate, 1);
+            NSArray *failed = delegate.failed;
+            NWTestEqual(failed.count, 1);
+            NWNotification *notification = failed.firstObject[0];
+            NWTestAssert([notification isKindOfClass:NWNotification.class]);
+            if ([notification isKindOfClass:NWNotification.class]) {
+                const uint8_t *token = notification.tokenData.bytes;
+                NWTestEqual(notification.identifier, NWTestFailingIdentifier);
+                NWTestEqual((token[1] << 8 | token[2]) % NWTestPerConnection, NWTestFailingIdentifier - 1);
+            }
+            NWTestEqual([failed.firstObject[1] integerValue], kNWErrorAPNInvalidTokenContent);
+
+            // the failing connection reconnected once, resuming its session, the others kept their first
+            NSUInteger full = 0, resumed = 0;
+            for (NWSSLConnection *connection in connections) {
+                full += [connection.handshakeStatistics[@"full"] unsignedIntegerValue];
+                resumed += [connection.handshakeStatistics[@"resumed"] unsignedIntegerValue];
+            }
+            NWTestEqual(full, NWTestConnections);
+            NWTestEqual(resumed, 1);
+
+            NWTestEqual([pool pushNotifications:NWTestNotifications(payload, 1)], 0);
+            NWTestWaitForFailures(delegate, 1);
+            NWTestEqual(delegate.failed.count, 1);
+            NWTestEqual([pool.statistics[@"failed"] unsignedIntegerValue], 1);
+            [pool stopReading];
+        }
+        [pool disconnect];
+    }
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    return NWTestFinish("NWPusherPoolTests");
+}
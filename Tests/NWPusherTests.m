@@ -0,0 +1,131 @@
+//
+//  NWPusherTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Pushes notifications of varying sizes in several writes, decodes the frames that reach the connection, and checks
+//  the bytes accepted per notification after the connection drops in the middle of a frame, and resuming from them.
+//
+
+#import "NWPusher.h"
+#import "NWNotification.h"
+#import "NWSinkConnection.h"
+#include "NWTest.h"
+
+static NSUInteger const NWTestCount = 100;
+static NSUInteger const NWTestWriteBufferSize = 1000;
+
+static uint32_t NWTestRead32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static NSArray *NWTestNotifications(void)
+{
+    NSMutableArray *notifications = @[].mutableCopy;
+    for (NSUInteger i = 0; i < NWTestCount; i++) {
+        NSString *alert = [@"" stringByPaddingToLength:i * 7 % 200 withString:@"abcdefg" startingAtIndex:0];
+        NSData *payload = [[NSString stringWithFormat:@"{\"aps\":{\"alert\":\"%@\"}}", alert] dataUsingEncoding:NSUTF8StringEncoding];
+        uint8_t token[32] = {(uint8_t)i, 0xAB};
+        NSData *tokenData = [NSData dataWithBytes:token length:sizeof(token)];
+        [notifications addObject:[[NWNotification alloc] initWithPayloadData:payload tokenData:tokenData identifier:i + 1 expirationStamp:1000000 + i addExpiration:i % 2 priority:i % 3 ? 10 : 5]];
+    }
+    return notifications;
+}
+
+// Decodes the frames in data and checks each holds the items of its notification, in order.
+static void NWTestDecode(NSData *data, NSArray *notifications)
+{
+    const uint8_t *bytes = data.bytes;
+    NSUInteger offset = 0, index = 0;
+    for (; offset + 5 <= data.length && index < notifications.count; index++) {
+        NWNotification *notification = notifications[index];
+        const uint8_t *p = bytes + offset;
+        NWTestEqual(p[0], 2);
+        const uint8_t *end = p + 5 + NWTestRead32(p + 1);
+        NWTestAssert(end <= bytes + data.length);
+        if (end > bytes + data.length) break;
+        NSUInteger seen = 0;
+        for (const uint8_t *item = p + 5; item + 3 <= end; item += 3 + (item[1] << 8 | item[2])) {
+            NSUInteger length = item[1] << 8 | item[2];
+            NSData *value = [NSData dataWithBytes:item + 3 length:length];
+            seen |= 1 << item[0];
+            switch (item[0]) {
+                case 1: NWTestAssert([value isEqualToData:notification.tokenData]); break;
+                case 2: NWTestAssert([value isEqualToData:notification.payloadData]); break;
+                case 3: NWTestEqual(NWTestRead32(item + 3), notification.identifier); break;
+                case 4: NWTestEqual(NWTestRead32(item + 3), notification.expirationStamp); break;
+                case 5: NWTestEqual(item[3], notification.priority); break;
+                default: NWTestAssert(NO); break;
+            }
+        }
+        NWTestEqual(seen, 1 << 1 | 1 << 2 | 1 << 3 | 1 << 5 | (notification.addExpiration ? 1 << 4 : 0));
+        NWTestEqual(end - p, [notification lengthWithType:kNWNotificationType2]);
+        offset = end - bytes;
+    }
+    NWTestEqual(index, notifications.count);
+    NWTestEqual(offset, data.length);
+}
+
+// all frames are packed back to back over several writes
+static void NWTestPack(void)
+{
+    NSArray *notifications = NWTestNotifications();
+    NWPusher *pusher = [[NWPusher alloc] init];
+    pusher.writeBufferSize = NWTestWriteBufferSize;
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    sink.keepsData = YES;
+    pusher.connection = sink;
+    NSUInteger accepted[NWTestCount] = {0};
+    NSError *error = nil;
+    NWTestAssert([pusher pushNotifications:notifications type:kNWNotificationType2 accepted:accepted error:&error]);
+    NWTestAssert(!error);
+    NWTestAssert(sink.writes > 1);
+    for (NSUInteger i = 0; i < NWTestCount; i++) NWTestEqual(accepted[i], [notifications[i] lengthWithType:kNWNotificationType2]);
+    NWTestDecode(sink.data, notifications);
+}
+
+// a drop in the middle of a frame leaves the bytes accepted of that frame, from which the next call resumes
+static void NWTestResume(void)
+{
+    NSArray *notifications = NWTestNotifications();
+    NSUInteger cut = 0;
+    for (NSUInteger i = 0; i < NWTestCount / 2; i++) cut += [notifications[i] lengthWithType:kNWNotificationType2];
+    cut += 17;
+
+    NWPusher *pusher = [[NWPusher alloc] init];
+    pusher.writeBufferSize = NWTestWriteBufferSize;
+    NWSinkConnection *sink = [[NWSinkConnection alloc] init];
+    sink.keepsData = YES;
+    sink.writeLimit = cut;
+    pusher.connection = sink;
+    NSUInteger accepted[NWTestCount] = {0};
+    NSError *error = nil;
+    NWTestAssert(![pusher pushNotifications:notifications type:kNWNotificationType2 accepted:accepted error:&error]);
+    NWTestEqual(error.code, kNWErrorWriteDroppedByServer);
+    NWTestEqual(sink.bytes, cut);
+    for (NSUInteger i = 0; i < NWTestCount / 2; i++) NWTestEqual(accepted[i], [notifications[i] lengthWithType:kNWNotificationType2]);
+    NWTestEqual(accepted[NWTestCount / 2], 17);
+    for (NSUInteger i = NWTestCount / 2 + 1; i < NWTestCount; i++) NWTestEqual(accepted[i], 0);
+
+    NWSinkConnection *next = [[NWSinkConnection alloc] init];
+    next.keepsData = YES;
+    pusher.connection = next;
+    error = nil;
+    NWTestAssert([pusher pushNotifications:notifications type:kNWNotificationType2 accepted:accepted error:&error]);
+    NWTestAssert(!error);
+    for (NSUInteger i = 0; i < NWTestCount; i++) NWTestEqual(accepted[i], [notifications[i] lengthWithType:kNWNotificationType2]);
+    NSMutableData *data = sink.data.mutableCopy;
+    [data appendData:next.data];
+    NWTestDecode(data, notifications);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestPack();
+        NWTestResume();
+    }
+    return NWTestFinish("NWPusherTests");
+}
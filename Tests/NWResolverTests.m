@@ -0,0 +1,105 @@
+//
+//  NWResolverTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Resolves loopback names and checks the addresses come in the order of getaddrinfo with the port filled in, are
+//  served from cache until the TTL passes, and are looked up again after removing them.
+//
+
+#import "NWResolver.h"
+#include "NWTest.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+static NSUInteger const NWTestPort = 2195;
+
+static NSArray *NWTestLookup(const char *host, NSUInteger port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *info = NULL;
+    if (getaddrinfo(host, [NSString stringWithFormat:@"%lu", (unsigned long)port].UTF8String, &hints, &info)) {
+        return nil;
+    }
+    NSMutableArray *addresses = @[].mutableCopy;
+    for (struct addrinfo *i = info; i; i = i->ai_next) {
+        [addresses addObject:[NSData dataWithBytes:i->ai_addr length:i->ai_addrlen]];
+    }
+    freeaddrinfo(info);
+    return addresses;
+}
+
+static NSUInteger NWTestPortOfAddress(NSData *address)
+{
+    const struct sockaddr *addr = address.bytes;
+    if (addr->sa_family == AF_INET6) return ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+    if (addr->sa_family == AF_INET) return ntohs(((const struct sockaddr_in *)addr)->sin_port);
+    return 0;
+}
+
+// addresses keep the order getaddrinfo gives, which connections try in turn starting at their addressOffset
+static void NWTestOrder(void)
+{
+    NWResolver *resolver = [[NWResolver alloc] init];
+    for (NSString *host in @[@"localhost", @"127.0.0.1", @"::1"]) {
+        NSError *error = nil;
+        NSArray *addresses = [resolver addressesForHost:host port:NWTestPort error:&error];
+        NSArray *expected = NWTestLookup(host.UTF8String, NWTestPort);
+        NWTestAssert(addresses.count);
+        NWTestAssert(!error);
+        NWTestAssert([addresses isEqualToArray:expected]);
+        for (NSData *address in addresses) NWTestEqual(NWTestPortOfAddress(address), NWTestPort);
+    }
+    NWTestAssert([[NWResolver descriptionWithAddress:[resolver addressesForHost:@"127.0.0.1" port:NWTestPort error:nil].firstObject] isEqualToString:@"127.0.0.1:2195"]);
+    NWTestAssert([[NWResolver descriptionWithAddress:[resolver addressesForHost:@"::1" port:NWTestPort error:nil].firstObject] isEqualToString:@"[::1]:2195"]);
+
+    NSError *error = nil;
+    NWTestAssert(![resolver addressesForHost:@"nonexistent.invalid" port:NWTestPort error:&error]);
+    NWTestEqual(error.code, kNWErrorSocketResolveHostName);
+}
+
+// a cached lookup returns the same array, a new lookup a new one
+static void NWTestTTL(void)
+{
+    NWResolver *resolver = [[NWResolver alloc] init];
+    NWTestEqual(resolver.ttl, 60);
+    resolver.ttl = 0.2;
+    NSArray *first = [resolver addressesForHost:@"localhost" port:NWTestPort error:nil];
+    NWTestAssert(first.count);
+    NWTestAssert([resolver addressesForHost:@"localhost" port:NWTestPort error:nil] == first);
+
+    NSArray *other = [resolver addressesForHost:@"localhost" port:NWTestPort + 1 error:nil];
+    NWTestAssert(other != first);
+    for (NSData *address in other) NWTestEqual(NWTestPortOfAddress(address), NWTestPort + 1);
+
+    usleep(300000);
+    NSArray *expired = [resolver addressesForHost:@"localhost" port:NWTestPort error:nil];
+    NWTestAssert(expired != first);
+    NWTestAssert([expired isEqualToArray:first]);
+    NWTestAssert([resolver addressesForHost:@"localhost" port:NWTestPort error:nil] == expired);
+
+    resolver.ttl = 60;
+    [resolver removeAddressesForHost:@"localhost" port:NWTestPort];
+    NSArray *removed = [resolver addressesForHost:@"localhost" port:NWTestPort error:nil];
+    NWTestAssert(removed != expired);
+    NWTestAssert([resolver addressesForHost:@"localhost" port:NWTestPort error:nil] == removed);
+
+    NSArray *kept = [resolver addressesForHost:@"localhost" port:NWTestPort + 1 error:nil];
+    [resolver removeAllAddresses];
+    NWTestAssert([resolver addressesForHost:@"localhost" port:NWTestPort error:nil] != removed);
+    NWTestAssert([resolver addressesForHost:@"localhost" port:NWTestPort + 1 error:nil] != kept);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestOrder();
+        NWTestTTL();
+    }
+    return NWTestFinish("NWResolverTests");
+}
@@ -0,0 +1,142 @@
+//
+//  NWSecToolsTests.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Fills the identity and certificate caches past their limit of 64 entries, with and without expired entries among
+//  them, and checks what is kept. Also reads the stand-in client identity twice and checks it is decoded once.
+//
+
+#import "NWSecTools.h"
+#include "NWTest.h"
+
+static NSUInteger const NWTestLimit = 64;
+
+// The caching methods are private, the tests reach the caches through them.
+@interface NWSecTools (NWTestCaching)
++ (NSMutableDictionary *)identityCache;
++ (NSMapTable *)certificateCache;
++ (NSArray *)cachedIdentitiesWithDigest:(NSData *)digest;
++ (void)cacheIdentities:(NSArray *)identities digest:(NSData *)digest;
++ (id)cachedValueWithCertificate:(NWCertificateRef)certificate key:(NSString *)key create:(id(^)(void))create;
+@end
+
+static NSData *NWTestDigest(NSUInteger i)
+{
+    return [[NSString stringWithFormat:@"digest %lu", (unsigned long)i] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+static void NWTestAddExpiredIdentities(NSUInteger from, NSUInteger to)
+{
+    for (NSUInteger i = from; i < to; i++) {
+        NWSecTools.identityCache[NWTestDigest(i)] = @{@"identities": [NSMutableArray array], @"expiration": [NSDate dateWithTimeIntervalSinceNow:-1]};
+    }
+}
+
+// a full cache is cleared before adding, unless dropping the expired entries makes room
+static void NWTestIdentityLimit(void)
+{
+    [NWSecTools removeAllCachedIdentities];
+    NSMutableArray *identities = @[].mutableCopy;
+    for (NSUInteger i = 0; i < NWTestLimit; i++) {
+        [identities addObject:[NSMutableArray array]];
+        [NWSecTools cacheIdentities:identities[i] digest:NWTestDigest(i)];
+    }
+    NWTestEqual(NWSecTools.identityCache.count, NWTestLimit);
+    for (NSUInteger i = 0; i < NWTestLimit; i++) NWTestAssert([NWSecTools cachedIdentitiesWithDigest:NWTestDigest(i)] == identities[i]);
+    NSArray *last = [NSMutableArray array];
+    [NWSecTools cacheIdentities:last digest:NWTestDigest(NWTestLimit)];
+    NWTestEqual(NWSecTools.identityCache.count, 1);
+    NWTestAssert(![NWSecTools cachedIdentitiesWithDigest:NWTestDigest(0)]);
+    NWTestAssert([NWSecTools cachedIdentitiesWithDigest:NWTestDigest(NWTestLimit)] == last);
+
+    [NWSecTools removeAllCachedIdentities];
+    for (NSUInteger i = 0; i < NWTestLimit - 4; i++) [NWSecTools cacheIdentities:identities[i] digest:NWTestDigest(i)];
+    NWTestAddExpiredIdentities(NWTestLimit - 4, NWTestLimit);
+    NWTestEqual(NWSecTools.identityCache.count, NWTestLimit);
+    [NWSecTools cacheIdentities:last digest:NWTestDigest(NWTestLimit)];
+    NWTestEqual(NWSecTools.identityCache.count, NWTestLimit - 3);
+    for (NSUInteger i = 0; i < NWTestLimit - 4; i++) NWTestAssert([NWSecTools cachedIdentitiesWithDigest:NWTestDigest(i)] == identities[i]);
+    NWTestAssert([NWSecTools cachedIdentitiesWithDigest:NWTestDigest(NWTestLimit)] == last);
+    NWTestAssert(![NWSecTools cachedIdentitiesWithDigest:NWTestDigest(NWTestLimit - 1)]);
+}
+
+// expired identities are dropped on lookup and by removeExpiredCachedIdentities, others are kept
+static void NWTestIdentityExpiry(void)
+{
+    [NWSecTools removeAllCachedIdentities];
+    NSArray *fresh = [NSMutableArray array];
+    NWSecTools.identityCache[NWTestDigest(0)] = @{@"identities": fresh, @"expiration": [NSDate dateWithTimeIntervalSinceNow:3600]};
+    NWTestAddExpiredIdentities(1, 3);
+    NWTestEqual(NWSecTools.identityCache.count, 3);
+    NWTestAssert(![NWSecTools cachedIdentitiesWithDigest:NWTestDigest(1)]);
+    NWTestEqual(NWSecTools.identityCache.count, 2);
+    [NWSecTools removeExpiredCachedIdentities];
+    NWTestEqual(NWSecTools.identityCache.count, 1);
+    NWTestAssert([NWSecTools cachedIdentitiesWithDigest:NWTestDigest(0)] == fresh);
+}
+
+// certificate details follow the same limit, and their expiration is what expires them; any object serves as key
+static void NWTestCertificates(void)
+{
+    [NWSecTools removeAllCachedIdentities];
+    __block NSUInteger created = 0;
+    id(^create)(void) = ^id{
+        created++;
+        return @(created);
+    };
+    NSMutableArray *certificates = @[].mutableCopy;
+    for (NSUInteger i = 0; i < NWTestLimit; i++) {
+        [certificates addObject:[[NSObject alloc] init]];
+        NWTestEqual([[NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)certificates[i] key:@"summary" create:create] unsignedIntegerValue], i + 1);
+    }
+    for (NSUInteger i = 0; i < NWTestLimit; i++) [NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)certificates[i] key:@"summary" create:create];
+    NWTestEqual(created, NWTestLimit);
+    NWTestEqual(NWSecTools.certificateCache.count, NWTestLimit);
+    id extra = [[NSObject alloc] init];
+    [NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)extra key:@"summary" create:create];
+    NWTestEqual(NWSecTools.certificateCache.count, 1);
+    [NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)certificates[0] key:@"summary" create:create];
+    NWTestEqual(created, NWTestLimit + 2);
+
+    [NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)extra key:@"expiration" create:^id{
+        return [NSDate dateWithTimeIntervalSinceNow:-1];
+    }];
+    [NWSecTools cachedValueWithCertificate:(__bridge NWCertificateRef)certificates[0] key:@"expiration" create:^id{
+        return [NSDate dateWithTimeIntervalSinceNow:3600];
+    }];
+    [NWSecTools removeExpiredCachedIdentities];
+    NWTestEqual(NWSecTools.certificateCache.count, 1);
+    NWTestAssert([NWSecTools.certificateCache objectForKey:certificates[0]]);
+    NWTestAssert(![NWSecTools.certificateCache objectForKey:extra]);
+}
+
+// identities read from the same PKCS #12 data and password are decoded once
+static void NWTestPKCS12(void)
+{
+    NSData *pkcs12 = [NSData dataWithContentsOfFile:@"build/client.p12"];
+    if (!pkcs12) {
+        return;
+    }
+    [NWSecTools removeAllCachedIdentities];
+    NSError *error = nil;
+    NSArray *identities = [NWSecTools identitiesWithPKCS12Data:pkcs12 password:@"standin" error:&error];
+    NWTestEqual(identities.count, 1);
+    NWTestAssert([NWSecTools identitiesWithPKCS12Data:pkcs12 password:@"standin" error:nil] == identities);
+    NWTestAssert(![NWSecTools identitiesWithPKCS12Data:pkcs12 password:@"other" error:&error]);
+    [NWSecTools removeCachedIdentityWithPKCS12Data:pkcs12 password:@"standin"];
+    NSArray *again = [NWSecTools identitiesWithPKCS12Data:pkcs12 password:@"standin" error:nil];
+    NWTestAssert(again && again != identities);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NWTestIdentityLimit();
+        NWTestIdentityExpiry();
+        NWTestCertificates();
+        NWTestPKCS12();
+    }
+    return NWTestFinish("NWSecToolsTests");
+}
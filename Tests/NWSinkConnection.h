@@ -0,0 +1,40 @@
+//
+//  NWSinkConnection.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWSSLConnection.h"
+
+/** A connection that accepts every write without sending it anywhere, to measure the cost of pushing without network or TLS. */
+@interface NWSinkConnection : NWSSLConnection
+
+/** Number of calls to write. */
+@property (nonatomic, readonly) NSUInteger writes;
+
+/** Number of bytes written. */
+@property (nonatomic, readonly) NSUInteger bytes;
+
+/** Keep the bytes written in `data`, to check what was pushed. Defaults to `NO`. */
+@property (nonatomic, assign) BOOL keepsData;
+
+/** The bytes written if `keepsData` is set. */
+@property (nonatomic, readonly) NSData *data;
+
+/** Number of calls to connect, including reconnects. */
+@property (nonatomic, readonly) NSUInteger connects;
+
+/** Number of bytes accepted before a write fails with `kNWErrorWriteDroppedByServer`, as if the server dropped the connection halfway. The limit is lifted once it fails. Defaults to `NSUIntegerMax`. */
+@property (nonatomic, assign) NSUInteger writeLimit;
+
+/** Bytes handed out by the next reads, as if sent by the server. Reads take them from the front. */
+@property (nonatomic, copy) NSData *response;
+
+/** Largest number of bytes handed out by one read, to split the response. Defaults to `NSUIntegerMax`. */
+@property (nonatomic, assign) NSUInteger readLength;
+
+/** Fail reads with `kNWErrorReadClosedGraceful` once the response has been read, as if the server closed the connection. */
+@property (nonatomic, assign) BOOL closesAfterResponse;
+
+@end
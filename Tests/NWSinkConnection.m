@@ -0,0 +1,74 @@
+//
+//  NWSinkConnection.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWSinkConnection.h"
+
+
+@implementation NWSinkConnection {
+    NSMutableData *_data;
+}
+
+- (instancetype)initWithHost:(NSString *)host port:(NSUInteger)port identity:(NWIdentityRef)identity
+{
+    self = [super initWithHost:host port:port identity:identity];
+    if (self) {
+        _writeLimit = NSUIntegerMax;
+        _readLength = NSUIntegerMax;
+    }
+    return self;
+}
+
+- (BOOL)connectWithError:(NSError *__autoreleasing *)error
+{
+    _connects++;
+    return YES;
+}
+
+- (void)disconnect
+{
+}
+
+- (BOOL)readBytes:(void *)bytes maxLength:(NSUInteger)max length:(NSUInteger *)length error:(NSError *__autoreleasing *)error
+{
+    if (!_response.length && _closesAfterResponse) {
+        *length = 0;
+        return [NWErrorUtil noWithErrorCode:kNWErrorReadClosedGraceful error:error];
+    }
+    *length = MIN(MIN(max, _readLength), _response.length);
+    [_response getBytes:bytes length:*length];
+    _response = [_response subdataWithRange:NSMakeRange(*length, _response.length - *length)];
+    return YES;
+}
+
+- (BOOL)write:(NSData *)data length:(NSUInteger *)length error:(NSError *__autoreleasing *)error
+{
+    _writes++;
+    *length = MIN(data.length, _writeLimit);
+    _bytes += *length;
+    if (_keepsData) {
+        _data = _data ?: [[NSMutableData alloc] init];
+        [_data appendBytes:data.bytes length:*length];
+    }
+    if (*length < data.length) {
+        _writeLimit = NSUIntegerMax;
+        return [NWErrorUtil noWithErrorCode:kNWErrorWriteDroppedByServer error:error];
+    }
+    if (_writeLimit != NSUIntegerMax) _writeLimit -= *length;
+    return YES;
+}
+
+- (BOOL)waitForReadWithTimeout:(NSTimeInterval)timeout
+{
+    return _response.length || _closesAfterResponse;
+}
+
+- (BOOL)waitForWriteWithTimeout:(NSTimeInterval)timeout
+{
+    return YES;
+}
+
+@end
@@ -0,0 +1,804 @@
+//
+//  NWStandIn.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  A local stand-in for the APNs gateway and feedback service, to test and benchmark against without
+//  hitting Apple's servers. It speaks TLS using OpenSSL and requires a client certificate, but accepts any.
+//
+//  Gateway mode parses command 0, 1 and 2 frames. Like the APNs, it replies to a bad notification, or to
+//  one picked with -e or -r, with a command 8 error response and closes the connection. With -d it drops
+//  the connection without a response after a number of notifications. Feedback mode sends synthetic
+//  tuples to every client and closes the connection.
+//
+//  HTTP/2 mode stands in for the provider API. It only accepts clients that negotiate h2, limits the
+//  streams per connection and answers every request on its own stream, without closing the connection.
+//  Header blocks are not decoded, so requests are told apart by their number on the connection: -e picks
+//  requests by that number, and the error status is sent as the matching HTTP status and reason. With -s
+//  the response to a request is held back, while the requests after it are answered.
+//
+//  Prints the port it listens on, then a line per connection closed.
+//
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NWStandInMaxRules 64
+#define NWStandInBufferSize (64 * 1024)
+#define NWStandInMaxPayload 4096
+#define NWStandInTokenSize 32
+#define NWStandInTupleSize (6 + NWStandInTokenSize)
+#define NWStandInH2FrameSize 16384
+#define NWStandInH2Window 65535
+#define NWStandInH2EndStream 0x1
+#define NWStandInH2Ack 0x1
+#define NWStandInH2EndHeaders 0x4
+#define NWStandInH2Padded 0x8
+
+typedef enum {
+    kNWStandInGateway,
+    kNWStandInFeedback,
+    kNWStandInHTTP2,
+} NWStandInMode;
+
+typedef enum {
+    kNWStandInH2Data = 0x0,
+    kNWStandInH2Headers = 0x1,
+    kNWStandInH2ResetStream = 0x3,
+    kNWStandInH2Settings = 0x4,
+    kNWStandInH2Ping = 0x6,
+    kNWStandInH2GoAway = 0x7,
+    kNWStandInH2WindowUpdate = 0x8,
+} NWStandInH2Type;
+
+// Reply to a notification with an error status, once.
+typedef struct {
+    uint32_t identifier;
+    uint8_t status;
+    _Atomic(int) fired;
+} NWStandInRule;
+
+typedef struct {
+    NWStandInMode mode;
+    int port;
+    const char *certificate;
+    const char *key;
+    int quiet;
+    NWStandInRule rules[NWStandInMaxRules];
+    size_t ruleCount;
+    uint64_t every;
+    uint8_t everyStatus;
+    uint64_t drop;
+    uint64_t tuples;
+    size_t fragment;
+    uint32_t streams;
+    uint32_t stall;
+    uint32_t stallTime;
+} NWStandInConfig;
+
+typedef struct {
+    _Atomic(uint64_t) connections;
+    _Atomic(uint64_t) resumed;
+    _Atomic(uint64_t) notifications;
+    _Atomic(uint64_t) bytes;
+    _Atomic(uint64_t) errors;
+    _Atomic(uint64_t) drops;
+    _Atomic(uint64_t) refused;
+} NWStandInTotals;
+
+typedef struct {
+    SSL *ssl;
+    int socket;
+    uint64_t number;
+    int resumed;
+    uint64_t notifications;
+    uint64_t bytes;
+    uint64_t refused;
+    const char *outcome;
+    uint8_t status;
+    uint32_t identifier;
+} NWStandInClient;
+
+typedef struct {
+    uint32_t identifier;
+    uint8_t status;
+} NWStandInFrame;
+
+// A request stream, from its headers until the response is written.
+typedef struct {
+    uint32_t stream;
+    uint32_t number;
+    size_t payload;
+    int complete;
+    double due;
+    uint8_t status;
+} NWStandInStream;
+
+typedef struct {
+    NWStandInClient *client;
+    NWStandInStream *streams;
+    size_t count;
+    uint32_t lastStream;
+    uint32_t requests;
+    int64_t window;
+    size_t consumed;
+    unsigned char *output;
+    size_t outputLength;
+} NWStandInH2;
+
+// The HTTP status and reason sent for an error status of the binary protocol.
+static const struct {
+    uint8_t status;
+    const char *code;
+    const char *reason;
+} NWStandInReasons[] = {
+    {2, "400", "MissingDeviceToken"},
+    {3, "400", "MissingTopic"},
+    {4, "400", "PayloadEmpty"},
+    {5, "400", "BadDeviceToken"},
+    {6, "400", "BadTopic"},
+    {7, "413", "PayloadTooLarge"},
+    {8, "400", "BadDeviceToken"},
+    {10, "503", "Shutdown"},
+    {0, "500", "InternalServerError"},
+};
+
+static const char NWStandInH2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static NWStandInConfig NWConfig;
+static NWStandInTotals NWTotals;
+
+
+#pragma mark - Helpers
+
+static inline uint32_t NWRead32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint16_t NWRead16(const unsigned char *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline double NWStandInNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void NWWrite32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+static int NWStandInWriteAll(SSL *ssl, const unsigned char *bytes, size_t length) {
+    while (length) {
+        int n = SSL_write(ssl, bytes, (int)(length < INT32_MAX ? length : INT32_MAX));
+        if (n <= 0) return 0;
+        bytes += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+
+
+#pragma mark - Gateway
+
+// Returns the APNs status for a notification with these item lengths, 0 if it is fine.
+static uint8_t NWStandInCheck(size_t token, size_t payload) {
+    if (!token) return 2;
+    if (token != NWStandInTokenSize) return 5;
+    if (!payload) return 4;
+    if (payload > NWStandInMaxPayload) return 7;
+    return 0;
+}
+
+// Parses the frame at the start of bytes. Returns its length, 0 if incomplete or -1 if it cannot be parsed at all. Sets the status of a bad notification.
+static long NWStandInParseFrame(const unsigned char *p, size_t n, NWStandInFrame *frame) {
+    frame->identifier = 0;
+    frame->status = 0;
+    if (!n) return 0;
+    if (p[0] == 0 || p[0] == 1) {
+        size_t header = p[0] ? 9 : 1;
+        if (n < header + 2) return 0;
+        if (p[0]) frame->identifier = NWRead32(p + 1);
+        size_t token = NWRead16(p + header);
+        if (n < header + 4 + token) return 0;
+        size_t payload = NWRead16(p + header + 2 + token);
+        if (n < header + 4 + token + payload) return 0;
+        frame->status = NWStandInCheck(token, payload);
+        return (long)(header + 4 + token + payload);
+    }
+    if (p[0] == 2) {
+        if (n < 5) return 0;
+        size_t length = 5 + (size_t)NWRead32(p + 1);
+        if (length > NWStandInBufferSize) {
+            frame->status = 1;
+            return -1;
+        }
+        if (n < length) return 0;
+        size_t token = 0, payload = 0;
+        for (size_t i = 5; i < length;) {
+            if (length - i < 3 || NWRead16(p + i + 1) > length - i - 3) {
+                frame->status = 1;
+                return -1;
+            }
+            size_t size = NWRead16(p + i + 1);
+            if (p[i] == 1) token = size;
+            if (p[i] == 2) payload = size;
+            if (p[i] == 3 && size == 4) frame->identifier = NWRead32(p + i + 3);
+            i += 3 + size;
+        }
+        frame->status = NWStandInCheck(token, payload);
+        return (long)length;
+    }
+    frame->status = 1;
+    return -1;
+}
+
+// Returns the status to reply to a correct notification with, 0 for none.
+static uint8_t NWStandInRuleStatus(uint32_t identifier, uint64_t number) {
+    for (size_t i = 0; i < NWConfig.ruleCount; i++) {
+        NWStandInRule *rule = &NWConfig.rules[i];
+        if (rule->identifier == identifier && !atomic_exchange(&rule->fired, 1)) {
+            return rule->status;
+        }
+    }
+    return NWConfig.every && number % NWConfig.every == 0 ? NWConfig.everyStatus : 0;
+}
+
+static void NWStandInReply(NWStandInClient *client, uint8_t status, uint32_t identifier) {
+    unsigned char response[6] = {8, status};
+    NWWrite32(response + 2, identifier);
+    NWStandInWriteAll(client->ssl, response, sizeof(response));
+    SSL_shutdown(client->ssl);
+    client->outcome = "error response";
+    client->status = status;
+    client->identifier = identifier;
+    atomic_fetch_add(&NWTotals.errors, 1);
+}
+
+static void NWStandInDrop(NWStandInClient *client) {
+    // reset instead of a TLS close, like a connection dropped by the server
+    struct linger linger = {1, 0};
+    setsockopt(client->socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    client->outcome = "dropped";
+    atomic_fetch_add(&NWTotals.drops, 1);
+}
+
+static void NWStandInServeGateway(NWStandInClient *client) {
+    unsigned char *buffer = malloc(NWStandInBufferSize);
+    size_t buffered = 0;
+    client->outcome = "closed by client";
+    while (buffer) {
+        int n = SSL_read(client->ssl, buffer + buffered, (int)(NWStandInBufferSize - buffered));
+        if (n <= 0) break;
+        buffered += (size_t)n;
+        client->bytes += (size_t)n;
+        atomic_fetch_add(&NWTotals.bytes, (uint64_t)n);
+        size_t offset = 0;
+        for (;;) {
+            NWStandInFrame frame;
+            long length = NWStandInParseFrame(buffer + offset, buffered - offset, &frame);
+            if (length < 0) {
+                NWStandInReply(client, frame.status, frame.identifier);
+                goto done;
+            }
+            if (!length) break;
+            offset += (size_t)length;
+            client->notifications++;
+            uint64_t number = atomic_fetch_add(&NWTotals.notifications, 1) + 1;
+            uint8_t status = frame.status ? frame.status : NWStandInRuleStatus(frame.identifier, number);
+            if (status) {
+                NWStandInReply(client, status, frame.identifier);
+                goto done;
+            }
+            if (NWConfig.drop && client->notifications == NWConfig.drop) {
+                NWStandInDrop(client);
+                goto done;
+            }
+        }
+        buffered -= offset;
+        memmove(buffer, buffer + offset, buffered);
+        if (buffered == NWStandInBufferSize) {
+            NWStandInReply(client, 1, 0);
+            break;
+        }
+    }
+done:
+    free(buffer);
+}
+
+
+#pragma mark - Feedback
+
+static void NWStandInServeFeedback(NWStandInClient *client) {
+    unsigned char *buffer = malloc(NWStandInBufferSize);
+    size_t batch = NWStandInBufferSize / NWStandInTupleSize;
+    uint32_t now = (uint32_t)time(NULL);
+    client->outcome = "feedback sent";
+    for (uint64_t sent = 0; buffer && sent < NWConfig.tuples;) {
+        size_t count = 0;
+        for (; count < batch && sent < NWConfig.tuples; count++, sent++) {
+            unsigned char *p = buffer + count * NWStandInTupleSize;
+            NWWrite32(p, now - (uint32_t)sent);
+            p[4] = 0;
+            p[5] = NWStandInTokenSize;
+            // a recognizable token per tuple: its number, then a fixed pattern
+            memset(p + 6, 0xA5, NWStandInTokenSize);
+            NWWrite32(p + 6, (uint32_t)sent);
+        }
+        if (!NWStandInWriteAll(client->ssl, buffer, count * NWStandInTupleSize)) {
+            client->outcome = "closed by client";
+            free(buffer);
+            return;
+        }
+        client->notifications += count;
+        client->bytes += count * NWStandInTupleSize;
+    }
+    if (buffer && NWConfig.fragment) {
+        memset(buffer, 0, NWConfig.fragment);
+        NWStandInWriteAll(client->ssl, buffer, NWConfig.fragment);
+        client->bytes += NWConfig.fragment;
+    }
+    SSL_shutdown(client->ssl);
+    free(buffer);
+}
+
+
+#pragma mark - HTTP/2
+
+static int NWStandInH2Flush(NWStandInH2 *h2) {
+    int written = !h2->outputLength || NWStandInWriteAll(h2->client->ssl, h2->output, h2->outputLength);
+    h2->outputLength = 0;
+    return written;
+}
+
+// Adds a frame to the output, which is written once all frames read so far have been handled.
+static void NWStandInH2Queue(NWStandInH2 *h2, uint8_t type, uint8_t flags, uint32_t stream, const void *payload, size_t length) {
+    if (h2->outputLength + 9 + length > NWStandInBufferSize) NWStandInH2Flush(h2);
+    unsigned char *p = h2->output + h2->outputLength;
+    p[0] = (unsigned char)(length >> 16);
+    p[1] = (unsigned char)(length >> 8);
+    p[2] = (unsigned char)length;
+    p[3] = type;
+    p[4] = flags;
+    NWWrite32(p + 5, stream);
+    if (length) memcpy(p + 9, payload, length);
+    h2->outputLength += 9 + length;
+}
+
+static void NWStandInH2Reset(NWStandInH2 *h2, uint32_t stream, uint32_t code) {
+    unsigned char payload[4];
+    NWWrite32(payload, code);
+    NWStandInH2Queue(h2, kNWStandInH2ResetStream, 0, stream, payload, sizeof(payload));
+}
+
+static void NWStandInH2GoAway(NWStandInH2 *h2, uint32_t code) {
+    unsigned char payload[8];
+    NWWrite32(payload, h2->lastStream);
+    NWWrite32(payload + 4, code);
+    NWStandInH2Queue(h2, kNWStandInH2GoAway, 0, 0, payload, sizeof(payload));
+}
+
+static NWStandInStream *NWStandInH2Find(NWStandInH2 *h2, uint32_t stream) {
+    for (size_t i = 0; i < h2->count; i++) {
+        if (h2->streams[i].stream == stream) return &h2->streams[i];
+    }
+    return NULL;
+}
+
+// Decides the response to a request once it has been received, returns 0 to drop the connection.
+static int NWStandInH2Complete(NWStandInH2 *h2, NWStandInStream *stream) {
+    NWStandInClient *client = h2->client;
+    stream->complete = 1;
+    client->notifications++;
+    uint64_t number = atomic_fetch_add(&NWTotals.notifications, 1) + 1;
+    // the token is in the path, which is not decoded
+    stream->status = NWStandInCheck(NWStandInTokenSize, stream->payload);
+    if (!stream->status) stream->status = NWStandInRuleStatus(stream->number, number);
+    stream->due = NWStandInNow() + (stream->number == NWConfig.stall ? NWConfig.stallTime * 1e-3 : 0);
+    if (NWConfig.drop && client->notifications == NWConfig.drop) {
+        NWStandInDrop(client);
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the response to a request, returns 0 if the error body does not fit in the window of the client yet.
+static int NWStandInH2Respond(NWStandInH2 *h2, NWStandInStream *stream) {
+    if (!stream->status) {
+        // :status 200 is in the static table
+        unsigned char block[1] = {0x88};
+        NWStandInH2Queue(h2, kNWStandInH2Headers, NWStandInH2EndHeaders | NWStandInH2EndStream, stream->stream, block, sizeof(block));
+        return 1;
+    }
+    size_t reason = 0;
+    while (NWStandInReasons[reason].status && NWStandInReasons[reason].status != stream->status) reason++;
+    char body[64];
+    int length = snprintf(body, sizeof(body), "{\"reason\":\"%s\"}", NWStandInReasons[reason].reason);
+    if (length > h2->window) return 0;
+    h2->window -= length;
+    // other statuses are a literal with the name from the static table, without Huffman coding
+    const char *code = NWStandInReasons[reason].code;
+    unsigned char block[5] = {0x08, 3, (unsigned char)code[0], (unsigned char)code[1], (unsigned char)code[2]};
+    NWStandInH2Queue(h2, kNWStandInH2Headers, NWStandInH2EndHeaders, stream->stream, block, sizeof(block));
+    NWStandInH2Queue(h2, kNWStandInH2Data, NWStandInH2EndStream, stream->stream, body, (size_t)length);
+    h2->client->status = stream->status;
+    h2->client->identifier = stream->number;
+    atomic_fetch_add(&NWTotals.errors, 1);
+    return 1;
+}
+
+// Responds to the requests that are due, in the order they were received. Returns when the next one is due, 0 if none.
+static double NWStandInH2RespondDue(NWStandInH2 *h2) {
+    double now = NWStandInNow(), next = 0;
+    for (size_t i = 0; i < h2->count;) {
+        NWStandInStream *stream = &h2->streams[i];
+        if (stream->complete && stream->due <= now && NWStandInH2Respond(h2, stream)) {
+            memmove(stream, stream + 1, (h2->count - i - 1) * sizeof(NWStandInStream));
+            h2->count--;
+            continue;
+        }
+        if (stream->complete && stream->due > now && (!next || stream->due < next)) next = stream->due;
+        i++;
+    }
+    return next;
+}
+
+// Handles a frame from the client, returns 0 to close the connection.
+static int NWStandInH2Frame(NWStandInH2 *h2, uint8_t type, uint8_t flags, uint32_t id, const unsigned char *p, size_t length) {
+    NWStandInStream *stream = id ? NWStandInH2Find(h2, id) : NULL;
+    switch (type) {
+        case kNWStandInH2Settings:
+            if (!(flags & NWStandInH2Ack)) NWStandInH2Queue(h2, kNWStandInH2Settings, NWStandInH2Ack, 0, NULL, 0);
+            return 1;
+        case kNWStandInH2Ping:
+            if (!(flags & NWStandInH2Ack) && length == 8) NWStandInH2Queue(h2, kNWStandInH2Ping, NWStandInH2Ack, 0, p, length);
+            return 1;
+        case kNWStandInH2WindowUpdate:
+            if (!id && length == 4) h2->window += NWRead32(p) & 0x7FFFFFFF;
+            return 1;
+        case kNWStandInH2Headers:
+            if (!stream) {
+                if (!id || id <= h2->lastStream) return 1;
+                h2->lastStream = id;
+                // like the APNs, streams over the limit are refused instead of queued
+                if (h2->count == NWConfig.streams) {
+                    NWStandInH2Reset(h2, id, 0x7);
+                    h2->client->refused++;
+                    atomic_fetch_add(&NWTotals.refused, 1);
+                    return 1;
+                }
+                stream = &h2->streams[h2->count++];
+                memset(stream, 0, sizeof(*stream));
+                stream->stream = id;
+                stream->number = ++h2->requests;
+            }
+            return stream->complete || !(flags & NWStandInH2EndStream) || NWStandInH2Complete(h2, stream);
+        case kNWStandInH2Data: {
+            // hand the connection window back in halves, the window of a stream is larger than any payload accepted
+            h2->consumed += length;
+            if (h2->consumed >= NWStandInH2Window / 2) {
+                unsigned char increment[4];
+                NWWrite32(increment, (uint32_t)h2->consumed);
+                NWStandInH2Queue(h2, kNWStandInH2WindowUpdate, 0, 0, increment, sizeof(increment));
+                h2->consumed = 0;
+            }
+            size_t padding = flags & NWStandInH2Padded && length ? p[0] + 1u : 0;
+            if (!stream || stream->complete) return 1;
+            stream->payload += length > padding ? length - padding : 0;
+            return !(flags & NWStandInH2EndStream) || NWStandInH2Complete(h2, stream);
+        }
+        case kNWStandInH2ResetStream:
+            if (stream) {
+                memmove(stream, stream + 1, (size_t)(h2->streams + h2->count - stream - 1) * sizeof(NWStandInStream));
+                h2->count--;
+            }
+            return 1;
+        case kNWStandInH2GoAway:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void NWStandInServeHTTP2(NWStandInClient *client) {
+    const unsigned char *protocol = NULL;
+    unsigned int protocolLength = 0;
+    // the selection in the handshake does not stop clients that offer no protocol at all
+    SSL_get0_alpn_selected(client->ssl, &protocol, &protocolLength);
+    if (!protocolLength) {
+        client->outcome = "h2 not negotiated";
+        return;
+    }
+    NWStandInH2 h2 = {.client = client, .window = NWStandInH2Window};
+    h2.streams = calloc(NWConfig.streams, sizeof(NWStandInStream));
+    h2.output = malloc(NWStandInBufferSize);
+    unsigned char *buffer = malloc(NWStandInBufferSize);
+    size_t buffered = 0, preface = sizeof(NWStandInH2Preface) - 1;
+    client->outcome = "closed by client";
+    if (buffer && h2.streams && h2.output) {
+        unsigned char settings[6] = {0, 0x3};
+        NWWrite32(settings + 2, NWConfig.streams);
+        NWStandInH2Queue(&h2, kNWStandInH2Settings, 0, 0, settings, sizeof(settings));
+    }
+    while (buffer && h2.streams && h2.output) {
+        double next = NWStandInH2RespondDue(&h2);
+        if (!NWStandInH2Flush(&h2)) break;
+        if (!SSL_pending(client->ssl)) {
+            struct pollfd readable = {client->socket, POLLIN, 0};
+            int timeout = next ? (int)((next - NWStandInNow()) * 1e3) + 1 : -1;
+            if (poll(&readable, 1, timeout) <= 0) continue;
+        }
+        int n = SSL_read(client->ssl, buffer + buffered, (int)(NWStandInBufferSize - buffered));
+        if (n <= 0) break;
+        buffered += (size_t)n;
+        client->bytes += (size_t)n;
+        atomic_fetch_add(&NWTotals.bytes, (uint64_t)n);
+        size_t offset = 0;
+        if (preface) {
+            if (buffered < preface) continue;
+            if (memcmp(buffer, NWStandInH2Preface, preface)) {
+                client->outcome = "no HTTP/2 preface";
+                break;
+            }
+            offset = preface;
+            preface = 0;
+        }
+        while (buffered - offset >= 9) {
+            const unsigned char *p = buffer + offset;
+            size_t length = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+            if (length > NWStandInH2FrameSize) {
+                NWStandInH2GoAway(&h2, 0x6);
+                client->outcome = "frame too large";
+                goto done;
+            }
+            if (buffered - offset < 9 + length) break;
+            offset += 9 + length;
+            if (!NWStandInH2Frame(&h2, p[3], p[4], NWRead32(p + 5) & 0x7FFFFFFF, p + 9, length)) goto done;
+        }
+        buffered -= offset;
+        memmove(buffer, buffer + offset, buffered);
+    }
+done:
+    if (h2.output) NWStandInH2Flush(&h2);
+    free(h2.output);
+    free(h2.streams);
+    free(buffer);
+}
+
+
+#pragma mark - Serving
+
+static void *NWStandInServe(void *context) {
+    NWStandInClient *client = context;
+    if (SSL_accept(client->ssl) == 1) {
+        client->resumed = SSL_session_reused(client->ssl);
+        if (client->resumed) atomic_fetch_add(&NWTotals.resumed, 1);
+        switch (NWConfig.mode) {
+            case kNWStandInGateway: NWStandInServeGateway(client); break;
+            case kNWStandInFeedback: NWStandInServeFeedback(client); break;
+            case kNWStandInHTTP2: NWStandInServeHTTP2(client); break;
+        }
+    } else {
+        client->outcome = "handshake failed";
+    }
+    if (!NWConfig.quiet) {
+        char status[64] = "";
+        if (client->status) snprintf(status, sizeof(status), " (status %u for %u)", client->status, client->identifier);
+        if (client->refused) snprintf(status + strlen(status), sizeof(status) - strlen(status), " (%llu streams refused)", (unsigned long long)client->refused);
+        fprintf(stderr, "connection %llu %s%s: %s handshake, %llu %s, %llu bytes; total %llu connections, %llu notifications, %llu errors, %llu drops\n",
+            (unsigned long long)client->number, client->outcome, status, client->resumed ? "resumed" : "full",
+            (unsigned long long)client->notifications, NWConfig.mode == kNWStandInFeedback ? "tuples" : "notifications", (unsigned long long)client->bytes,
+            (unsigned long long)NWTotals.connections, (unsigned long long)NWTotals.notifications, (unsigned long long)NWTotals.errors, (unsigned long long)NWTotals.drops);
+    }
+    SSL_free(client->ssl);
+    close(client->socket);
+    free(client);
+    return NULL;
+}
+
+static int NWStandInVerify(int preverified, X509_STORE_CTX *context) {
+    (void)preverified;
+    (void)context;
+    return 1;
+}
+
+// Selects h2 like the provider API, which fails the handshake of clients that do not offer it.
+static int NWStandInSelectProtocol(SSL *ssl, const unsigned char **selected, unsigned char *length, const unsigned char *offered, unsigned int offeredLength, void *context) {
+    (void)ssl;
+    (void)context;
+    for (unsigned int i = 0; i < offeredLength && i + 1 + offered[i] <= offeredLength; i += 1 + offered[i]) {
+        if (offered[i] == 2 && !memcmp(offered + i + 1, "h2", 2)) {
+            *selected = offered + i + 1;
+            *length = 2;
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+    return SSL_TLSEXT_ERR_ALERT_FATAL;
+}
+
+static SSL_CTX *NWStandInContext(void) {
+    SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+    if (!context) return NULL;
+    if (SSL_CTX_use_certificate_chain_file(context, NWConfig.certificate) != 1 || SSL_CTX_use_PrivateKey_file(context, NWConfig.key, SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(context);
+        return NULL;
+    }
+    // require a client certificate like the APNs, sessions can only be resumed with an id context
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NWStandInVerify);
+    SSL_CTX_set_session_id_context(context, (const unsigned char *)"NWStandIn", 9);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+    if (NWConfig.mode == kNWStandInHTTP2) SSL_CTX_set_alpn_select_cb(context, NWStandInSelectProtocol, NULL);
+    return context;
+}
+
+static int NWStandInListen(int family, int *port) {
+    int sock = socket(family, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    int yes = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_storage address;
+    socklen_t length;
+    memset(&address, 0, sizeof(address));
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&address;
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes));
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_loopback;
+        in6->sin6_port = htons((uint16_t)*port);
+        length = sizeof(*in6);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in *)&address;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        in->sin_port = htons((uint16_t)*port);
+        length = sizeof(*in);
+    }
+    if (bind(sock, (struct sockaddr *)&address, length) || listen(sock, 128) || getsockname(sock, (struct sockaddr *)&address, &length)) {
+        close(sock);
+        return -1;
+    }
+    *port = ntohs(family == AF_INET6 ? ((struct sockaddr_in6 *)&address)->sin6_port : ((struct sockaddr_in *)&address)->sin_port);
+    return sock;
+}
+
+// Parses number:value, with a value from 1 to max.
+static int NWStandInParsePair(const char *text, uint32_t *number, uint32_t *value, unsigned long max) {
+    char *end = NULL;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (!end || *end != ':') return 0;
+    unsigned long v = strtoul(end + 1, &end, 10);
+    if (*end || !v || v > max || n > UINT32_MAX) return 0;
+    *number = (uint32_t)n;
+    *value = (uint32_t)v;
+    return 1;
+}
+
+static int NWStandInParseRule(const char *text, uint32_t *number, uint8_t *status) {
+    uint32_t value = 0;
+    if (!NWStandInParsePair(text, number, &value, 255)) return 0;
+    *status = (uint8_t)value;
+    return 1;
+}
+
+static int NWStandInUsage(const char *name) {
+    fprintf(stderr,
+        "usage: %s [-m gateway|feedback|h2] [-p port] [-c cert.pem] [-k key.pem] [-e id:status]... [-r every:status] [-d count] [-f count] [-x bytes] [-l streams] [-s number:ms] [-q]\n"
+        "  -m  gateway (default), feedback or h2 for the HTTP/2 provider API\n"
+        "  -p  port to listen on at the loopback addresses, 0 for any, defaults to 2195, 2196 or 2197\n"
+        "  -c  PEM certificate chain of the server, defaults to standin.pem\n"
+        "  -k  PEM private key, defaults to the certificate file\n"
+        "  -e  reply to the notification with this identifier, or the h2 request with this number, with an error status (1-255), once\n"
+        "  -r  reply to every n-th notification received with an error status; the gateway closes the connection after an error, h2 does not\n"
+        "  -d  drop the connection without a response after count notifications on it\n"
+        "  -f  number of feedback tuples sent to every client, defaults to 1000\n"
+        "  -x  append this many bytes of an incomplete feedback tuple\n"
+        "  -l  with h2, the maximum number of concurrent streams per connection, defaults to 1000\n"
+        "  -s  with h2, hold back the response to the request with this number on every connection for ms milliseconds\n"
+        "  -q  do not print a line per connection\n", name);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    NWConfig.port = -1;
+    NWConfig.certificate = "standin.pem";
+    NWConfig.tuples = 1000;
+    NWConfig.streams = 1000;
+    int option;
+    while ((option = getopt(argc, argv, "m:p:c:k:e:r:d:f:x:l:s:q")) != -1) {
+        uint32_t number = 0;
+        uint8_t status = 0;
+        switch (option) {
+            case 'm':
+                if (!strcmp(optarg, "gateway")) NWConfig.mode = kNWStandInGateway;
+                else if (!strcmp(optarg, "feedback")) NWConfig.mode = kNWStandInFeedback;
+                else if (!strcmp(optarg, "h2")) NWConfig.mode = kNWStandInHTTP2;
+                else return NWStandInUsage(argv[0]);
+                break;
+            case 'p': NWConfig.port = atoi(optarg); break;
+            case 'c': NWConfig.certificate = optarg; break;
+            case 'k': NWConfig.key = optarg; break;
+            case 'e':
+                if (NWConfig.ruleCount == NWStandInMaxRules || !NWStandInParseRule(optarg, &number, &status)) return NWStandInUsage(argv[0]);
+                NWConfig.rules[NWConfig.ruleCount].identifier = number;
+                NWConfig.rules[NWConfig.ruleCount++].status = status;
+                break;
+            case 'r':
+                if (!NWStandInParseRule(optarg, &number, &status) || !number) return NWStandInUsage(argv[0]);
+                NWConfig.every = number;
+                NWConfig.everyStatus = status;
+                break;
+            case 'd': NWConfig.drop = strtoull(optarg, NULL, 10); break;
+            case 'f': NWConfig.tuples = strtoull(optarg, NULL, 10); break;
+            case 'x': NWConfig.fragment = strtoul(optarg, NULL, 10) % NWStandInTupleSize; break;
+            case 'l':
+                NWConfig.streams = (uint32_t)strtoul(optarg, NULL, 10);
+                if (!NWConfig.streams) return NWStandInUsage(argv[0]);
+                break;
+            case 's':
+                if (!NWStandInParsePair(optarg, &NWConfig.stall, &NWConfig.stallTime, 60000) || !NWConfig.stall) return NWStandInUsage(argv[0]);
+                break;
+            case 'q': NWConfig.quiet = 1; break;
+            default: return NWStandInUsage(argv[0]);
+        }
+    }
+    if (!NWConfig.key) NWConfig.key = NWConfig.certificate;
+    const int ports[] = {2195, 2196, 2197};
+    if (NWConfig.port < 0) NWConfig.port = ports[NWConfig.mode];
+    signal(SIGPIPE, SIG_IGN);
+    SSL_CTX *context = NWStandInContext();
+    if (!context) {
+        fprintf(stderr, "unable to load %s and %s\n", NWConfig.certificate, NWConfig.key);
+        return 1;
+    }
+    // localhost can resolve to either address, the IPv6 listener takes the port of the IPv4 one
+    int port = NWConfig.port;
+    struct pollfd listeners[2] = {{NWStandInListen(AF_INET, &port), POLLIN, 0}, {-1, POLLIN, 0}};
+    if (listeners[0].fd < 0) {
+        perror("listen");
+        return 1;
+    }
+    listeners[1].fd = NWStandInListen(AF_INET6, &port);
+    const char *modes[] = {"gateway", "feedback", "h2"};
+    printf("%s listening on port %d\n", modes[NWConfig.mode], port);
+    fflush(stdout);
+    for (;;) {
+        if (poll(listeners, 2, -1) <= 0) continue;
+        for (int i = 0; i < 2; i++) {
+            if (!(listeners[i].revents & POLLIN)) continue;
+            int sock = accept(listeners[i].fd, NULL, NULL);
+            if (sock < 0) continue;
+            NWStandInClient *client = calloc(1, sizeof(NWStandInClient));
+            client->socket = sock;
+            client->ssl = SSL_new(context);
+            client->number = atomic_fetch_add(&NWTotals.connections, 1) + 1;
+            SSL_set_fd(client->ssl, sock);
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, NWStandInServe, client)) {
+                SSL_free(client->ssl);
+                close(sock);
+                free(client);
+                continue;
+            }
+            pthread_detach(thread);
+        }
+    }
+}
@@ -0,0 +1,467 @@
+//
+//  NWStandInTests.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+//  Runs the stand-in server and checks it behaves like the APNs gateway, feedback service and HTTP/2
+//  provider API, using an OpenSSL client with the test client certificate.
+//
+
+#include "NWTest.h"
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *NWBuild = "build";
+
+typedef struct {
+    pid_t pid;
+    int port;
+} NWServer;
+
+static NWServer NWServerStart(const char *mode, const char *const *options) {
+    NWServer server = {-1, 0};
+    int fds[2];
+    if (pipe(fds)) return server;
+    char binary[256], certificate[256];
+    snprintf(binary, sizeof(binary), "%s/NWStandIn", NWBuild);
+    snprintf(certificate, sizeof(certificate), "%s/standin.pem", NWBuild);
+    const char *argv[32] = {binary, "-q", "-p", "0", "-m", mode, "-c", certificate};
+    size_t argc = 8;
+    for (; options && *options && argc < 31; options++) argv[argc++] = *options;
+    server.pid = fork();
+    if (!server.pid) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        execv(binary, (char *const *)argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    char line[128] = "";
+    FILE *output = fdopen(fds[0], "r");
+    if (output && fgets(line, sizeof(line), output)) {
+        char *space = strrchr(line, ' ');
+        server.port = space ? atoi(space + 1) : 0;
+    }
+    if (output) fclose(output);
+    return server;
+}
+
+static void NWServerStop(NWServer server) {
+    if (server.pid > 0) {
+        kill(server.pid, SIGTERM);
+        waitpid(server.pid, NULL, 0);
+    }
+}
+
+static SSL_CTX *NWClientContext(int h2) {
+    char certificate[256], client[256];
+    snprintf(certificate, sizeof(certificate), "%s/standin.pem", NWBuild);
+    snprintf(client, sizeof(client), "%s/client.pem", NWBuild);
+    SSL_CTX *context = SSL_CTX_new(TLS_client_method());
+    // the binary protocol clients use TLS 1.2, where sessions are resumed on the handshake itself
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+    if (h2) SSL_CTX_set_alpn_protos(context, (const unsigned char *)"\x02h2", 3);
+    if (SSL_CTX_load_verify_locations(context, certificate, NULL) != 1 || SSL_CTX_use_certificate_chain_file(context, client) != 1 || SSL_CTX_use_PrivateKey_file(context, client, SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(context);
+        return NULL;
+    }
+    return context;
+}
+
+static SSL *NWConnect(SSL_CTX *context, int port, SSL_SESSION *session) {
+    struct addrinfo hints = {0}, *addresses = NULL;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo("localhost", service, &hints, &addresses)) return NULL;
+    int sock = -1;
+    for (struct addrinfo *a = addresses; a && sock < 0; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock >= 0 && connect(sock, a->ai_addr, a->ai_addrlen)) {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (sock < 0) return NULL;
+    SSL *ssl = SSL_new(context);
+    SSL_set_fd(ssl, sock);
+    SSL_set_tlsext_host_name(ssl, "localhost");
+    SSL_set1_host(ssl, "localhost");
+    if (session) SSL_set_session(ssl, session);
+    if (SSL_connect(ssl) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        close(sock);
+        return NULL;
+    }
+    return ssl;
+}
+
+static void NWClose(SSL *ssl) {
+    if (!ssl) return;
+    int sock = SSL_get_fd(ssl);
+    // without a TLS close the session is dropped from the cache and cannot be resumed
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(sock);
+}
+
+// Reads until the server closes, returns the number of bytes read and sets graceful if it sent a TLS close.
+static size_t NWReadAll(SSL *ssl, unsigned char *buffer, size_t length, int *graceful) {
+    size_t read = 0;
+    for (;;) {
+        int n = SSL_read(ssl, buffer + read, (int)(length - read));
+        if (n <= 0) {
+            if (graceful) *graceful = SSL_get_error(ssl, n) == SSL_ERROR_ZERO_RETURN;
+            return read;
+        }
+        read += (size_t)n;
+    }
+}
+
+static size_t NWFrame(unsigned char *p, uint8_t command, uint32_t identifier, size_t token, size_t payload) {
+    size_t length = 0;
+    if (command == 2) {
+        size_t items = 3 + token + 3 + payload + 3 + 4;
+        p[length++] = 2;
+        for (int i = 3; i >= 0; i--) p[length++] = (unsigned char)(items >> (i * 8));
+        p[length++] = 1; p[length++] = (unsigned char)(token >> 8); p[length++] = (unsigned char)token;
+        memset(p + length, 0xAB, token); length += token;
+        p[length++] = 2; p[length++] = (unsigned char)(payload >> 8); p[length++] = (unsigned char)payload;
+        memset(p + length, 'x', payload); length += payload;
+        p[length++] = 3; p[length++] = 0; p[length++] = 4;
+        for (int i = 3; i >= 0; i--) p[length++] = (unsigned char)(identifier >> (i * 8));
+        return length;
+    }
+    p[length++] = command;
+    if (command == 1) {
+        for (int i = 3; i >= 0; i--) p[length++] = (unsigned char)(identifier >> (i * 8));
+        memset(p + length, 0, 4); length += 4;
+    }
+    p[length++] = (unsigned char)(token >> 8); p[length++] = (unsigned char)token;
+    memset(p + length, 0xAB, token); length += token;
+    p[length++] = (unsigned char)(payload >> 8); p[length++] = (unsigned char)payload;
+    memset(p + length, 'x', payload); length += payload;
+    return length;
+}
+
+static void NWTestErrorResponse(SSL_CTX *context) {
+    const char *options[] = {"-e", "5:8", NULL};
+    NWServer server = NWServerStart("gateway", options);
+    NWTestAssert(server.port > 0);
+    unsigned char frames[4096], response[64];
+    size_t length = 0;
+    for (uint32_t i = 1; i <= 10; i++) length += NWFrame(frames + length, (uint8_t)(i % 3 ? 2 : 1), i, 32, 20);
+    SSL *ssl = NWConnect(context, server.port, NULL);
+    NWTestAssert(ssl);
+    if (ssl) {
+        NWTestEqual(SSL_write(ssl, frames, (int)length), length);
+        int graceful = 0;
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), &graceful), 6);
+        const unsigned char expected[6] = {8, 8, 0, 0, 0, 5};
+        NWTestAssert(!memcmp(response, expected, 6));
+        NWTestAssert(graceful);
+    }
+    // the error fires once, replaying the rest goes through
+    SSL_SESSION *session = ssl ? SSL_get1_session(ssl) : NULL;
+    NWClose(ssl);
+    ssl = NWConnect(context, server.port, session);
+    NWTestAssert(ssl);
+    if (ssl) {
+        NWTestAssert(SSL_session_reused(ssl));
+        NWTestEqual(SSL_write(ssl, frames, (int)length), length);
+        SSL_shutdown(ssl);
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), NULL), 0);
+    }
+    SSL_SESSION_free(session);
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+static void NWTestInvalidFrames(SSL_CTX *context) {
+    NWServer server = NWServerStart("gateway", NULL);
+    struct { size_t token; size_t payload; uint8_t status; } cases[] = {{31, 20, 5}, {0, 20, 2}, {32, 0, 4}, {32, 4097, 7}};
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        unsigned char frame[8192], response[64];
+        size_t length = NWFrame(frame, 2, 77, cases[i].token, cases[i].payload);
+        SSL *ssl = NWConnect(context, server.port, NULL);
+        NWTestAssert(ssl);
+        if (!ssl) continue;
+        NWTestEqual(SSL_write(ssl, frame, (int)length), length);
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), NULL), 6);
+        NWTestEqual(response[0], 8);
+        NWTestEqual(response[1], cases[i].status);
+        NWTestEqual(response[5], 77);
+        NWClose(ssl);
+    }
+    // a command 0 frame has no identifier
+    unsigned char frame[256], response[64];
+    size_t length = NWFrame(frame, 0, 0, 16, 20);
+    SSL *ssl = NWConnect(context, server.port, NULL);
+    if (ssl) {
+        NWTestEqual(SSL_write(ssl, frame, (int)length), length);
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), NULL), 6);
+        NWTestEqual(response[1], 5);
+        NWTestEqual(response[5], 0);
+    }
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+static void NWTestDrop(SSL_CTX *context) {
+    const char *options[] = {"-d", "3", NULL};
+    NWServer server = NWServerStart("gateway", options);
+    unsigned char frames[4096], response[64];
+    size_t length = 0;
+    for (uint32_t i = 1; i <= 3; i++) length += NWFrame(frames + length, 2, i, 32, 20);
+    SSL *ssl = NWConnect(context, server.port, NULL);
+    NWTestAssert(ssl);
+    if (ssl) {
+        NWTestEqual(SSL_write(ssl, frames, (int)length), length);
+        int graceful = 1;
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), &graceful), 0);
+        NWTestAssert(!graceful);
+    }
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+static void NWTestFeedback(SSL_CTX *context) {
+    const char *options[] = {"-f", "2000", "-x", "11", NULL};
+    NWServer server = NWServerStart("feedback", options);
+    size_t size = 2000 * 38 + 11;
+    unsigned char *tuples = malloc(size + 1);
+    SSL *ssl = NWConnect(context, server.port, NULL);
+    NWTestAssert(ssl);
+    if (ssl && tuples) {
+        int graceful = 0;
+        NWTestEqual(NWReadAll(ssl, tuples, size + 1, &graceful), size);
+        NWTestAssert(graceful);
+        for (size_t i = 0; i < 2000; i++) {
+            const unsigned char *p = tuples + i * 38;
+            NWTestEqual(p[4] << 8 | p[5], 32);
+            NWTestEqual((uint32_t)p[6] << 24 | (uint32_t)p[7] << 16 | (uint32_t)p[8] << 8 | p[9], i);
+        }
+    }
+    free(tuples);
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream;
+    size_t length;
+    unsigned char payload[16384];
+} NWH2Frame;
+
+static int NWReadFully(SSL *ssl, unsigned char *buffer, size_t length) {
+    for (size_t read = 0; read < length;) {
+        int n = SSL_read(ssl, buffer + read, (int)(length - read));
+        if (n <= 0) return 0;
+        read += (size_t)n;
+    }
+    return 1;
+}
+
+static int NWH2Read(SSL *ssl, NWH2Frame *frame) {
+    unsigned char header[9];
+    if (!NWReadFully(ssl, header, sizeof(header))) return 0;
+    frame->length = (size_t)header[0] << 16 | (size_t)header[1] << 8 | header[2];
+    frame->type = header[3];
+    frame->flags = header[4];
+    frame->stream = ((uint32_t)header[5] << 24 | (uint32_t)header[6] << 16 | (uint32_t)header[7] << 8 | header[8]) & 0x7FFFFFFF;
+    return frame->length <= sizeof(frame->payload) && NWReadFully(ssl, frame->payload, frame->length);
+}
+
+static void NWH2Write(SSL *ssl, uint8_t type, uint8_t flags, uint32_t stream, const void *payload, size_t length) {
+    unsigned char frame[9 + 8192];
+    frame[0] = (unsigned char)(length >> 16); frame[1] = (unsigned char)(length >> 8); frame[2] = (unsigned char)length;
+    frame[3] = type; frame[4] = flags;
+    for (int i = 0; i < 4; i++) frame[5 + i] = (unsigned char)(stream >> (24 - i * 8));
+    memcpy(frame + 9, payload, length);
+    NWTestEqual(SSL_write(ssl, frame, (int)(9 + length)), 9 + length);
+}
+
+// Opens a stream with a request header block, which the stand-in does not decode: :method POST, :scheme https, :path /.
+static void NWH2Request(SSL *ssl, uint32_t stream, size_t payload, int end) {
+    static const unsigned char block[] = {0x83, 0x87, 0x84};
+    unsigned char data[8192];
+    memset(data, 'x', payload);
+    NWH2Write(ssl, 1, 0x4 | (payload || !end ? 0 : 0x1), stream, block, sizeof(block));
+    if (payload || !end) NWH2Write(ssl, 0, end ? 0x1 : 0, stream, data, payload);
+}
+
+static SSL *NWH2Connect(SSL_CTX *context, int port) {
+    SSL *ssl = NWConnect(context, port, NULL);
+    if (!ssl) return NULL;
+    const unsigned char *protocol = NULL;
+    unsigned int length = 0;
+    SSL_get0_alpn_selected(ssl, &protocol, &length);
+    NWTestAssert(length == 2 && !memcmp(protocol, "h2", 2));
+    static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    NWTestEqual(SSL_write(ssl, preface, sizeof(preface) - 1), sizeof(preface) - 1);
+    NWH2Write(ssl, 4, 0, 0, NULL, 0);
+    return ssl;
+}
+
+typedef struct {
+    uint32_t stream;
+    int status;
+    char body[64];
+} NWH2Response;
+
+// Reads until count streams have ended or been reset, in that order. Returns the server's concurrent stream limit.
+static uint32_t NWH2ReadResponses(SSL *ssl, NWH2Response *responses, size_t count, int *pinged) {
+    NWH2Frame *frame = malloc(sizeof(NWH2Frame));
+    uint32_t limit = 0;
+    int statuses[64] = {0};
+    for (size_t done = 0; frame && done < count && NWH2Read(ssl, frame);) {
+        if (frame->type == 4 && !(frame->flags & 0x1)) {
+            for (size_t i = 0; i + 6 <= frame->length; i += 6) {
+                if (frame->payload[i + 1] == 3) limit = (uint32_t)frame->payload[i + 2] << 24 | (uint32_t)frame->payload[i + 3] << 16 | (uint32_t)frame->payload[i + 4] << 8 | frame->payload[i + 5];
+            }
+        }
+        if (frame->type == 6 && pinged) *pinged = (frame->flags & 0x1) && frame->length == 8 && !memcmp(frame->payload, "NWPinged", 8);
+        if (frame->stream >= 64) continue;
+        NWH2Response *response = &responses[done];
+        if (frame->type == 1) {
+            // either :status 200 from the static table, or a literal status
+            if (frame->length == 1 && frame->payload[0] == 0x88) statuses[frame->stream] = 200;
+            else if (frame->length == 5 && frame->payload[0] == 0x08 && frame->payload[1] == 3) statuses[frame->stream] = atoi((const char *)frame->payload + 2) ?: -1;
+            memset(response->body, 0, sizeof(response->body));
+        }
+        if (frame->type == 0) {
+            memset(response->body, 0, sizeof(response->body));
+            memcpy(response->body, frame->payload, frame->length < sizeof(response->body) ? frame->length : sizeof(response->body) - 1);
+        }
+        if (frame->type == 3) {
+            response->stream = frame->stream;
+            response->status = -(int)frame->payload[3];
+            done++;
+        } else if ((frame->type == 0 || frame->type == 1) && (frame->flags & 0x1)) {
+            response->stream = frame->stream;
+            response->status = statuses[frame->stream];
+            done++;
+        }
+    }
+    free(frame);
+    return limit;
+}
+
+static void NWTestHTTP2Protocol(SSL_CTX *context) {
+    // a client that does not negotiate h2 is disconnected without a response
+    NWServer server = NWServerStart("h2", NULL);
+    NWTestAssert(server.port > 0);
+    SSL *ssl = NWConnect(context, server.port, NULL);
+    NWTestAssert(ssl);
+    if (ssl) {
+        unsigned char response[64];
+        static const char request[] = "POST /3/device/ab HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        SSL_write(ssl, request, sizeof(request) - 1);
+        NWTestEqual(NWReadAll(ssl, response, sizeof(response), NULL), 0);
+    }
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+static void NWTestHTTP2Responses(SSL_CTX *context) {
+    // the response to request 2 is held back, request 4 fails
+    const char *options[] = {"-e", "4:8", "-s", "2:200", NULL};
+    NWServer server = NWServerStart("h2", options);
+    SSL *ssl = NWH2Connect(context, server.port);
+    NWTestAssert(ssl);
+    if (!ssl) {
+        NWServerStop(server);
+        return;
+    }
+    NWH2Write(ssl, 6, 0, 0, "NWPinged", 8);
+    for (uint32_t stream = 1; stream <= 11; stream += 2) NWH2Request(ssl, stream, stream == 9 ? 0 : stream == 11 ? 5000 : 20, 1);
+    NWH2Response responses[6];
+    int pinged = 0;
+    NWTestEqual(NWH2ReadResponses(ssl, responses, 6, &pinged), 1000);
+    NWTestAssert(pinged);
+    // the others are answered while the held back response waits
+    const uint32_t streams[6] = {1, 5, 7, 9, 11, 3};
+    const int statuses[6] = {200, 200, 400, 400, 413, 200};
+    const char *bodies[6] = {"", "", "{\"reason\":\"BadDeviceToken\"}", "{\"reason\":\"PayloadEmpty\"}", "{\"reason\":\"PayloadTooLarge\"}", ""};
+    for (size_t i = 0; i < 6; i++) {
+        NWTestEqual(responses[i].stream, streams[i]);
+        NWTestEqual(responses[i].status, statuses[i]);
+        NWTestAssert(!strcmp(responses[i].body, bodies[i]));
+    }
+    // the connection stays open after errors, and the rule fired once
+    NWH2Request(ssl, 13, 20, 1);
+    NWTestEqual(NWH2ReadResponses(ssl, responses, 1, NULL), 0);
+    NWTestEqual(responses[0].stream, 13);
+    NWTestEqual(responses[0].status, 200);
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+static void NWTestHTTP2Streams(SSL_CTX *context) {
+    const char *options[] = {"-l", "2", NULL};
+    NWServer server = NWServerStart("h2", options);
+    SSL *ssl = NWH2Connect(context, server.port);
+    NWTestAssert(ssl);
+    if (!ssl) {
+        NWServerStop(server);
+        return;
+    }
+    // a third open stream is refused, once the first two are answered a new one is accepted
+    NWH2Request(ssl, 1, 0, 0);
+    NWH2Request(ssl, 3, 0, 0);
+    NWH2Request(ssl, 5, 20, 1);
+    NWH2Response responses[3];
+    NWTestEqual(NWH2ReadResponses(ssl, responses, 1, NULL), 2);
+    NWTestEqual(responses[0].stream, 5);
+    NWTestEqual(responses[0].status, -7);
+    unsigned char data[20];
+    memset(data, 'x', sizeof(data));
+    NWH2Write(ssl, 0, 0x1, 1, data, sizeof(data));
+    NWH2Write(ssl, 0, 0x1, 3, data, sizeof(data));
+    NWH2Request(ssl, 7, 20, 1);
+    NWH2ReadResponses(ssl, responses, 3, NULL);
+    const uint32_t streams[3] = {1, 3, 7};
+    for (size_t i = 0; i < 3; i++) {
+        NWTestEqual(responses[i].stream, streams[i]);
+        NWTestEqual(responses[i].status, 200);
+    }
+    NWClose(ssl);
+    NWServerStop(server);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) NWBuild = argv[1];
+    signal(SIGPIPE, SIG_IGN);
+    SSL_CTX *context = NWClientContext(0);
+    NWTestAssert(context);
+    if (context) {
+        NWTestErrorResponse(context);
+        NWTestInvalidFrames(context);
+        NWTestDrop(context);
+        NWTestFeedback(context);
+        NWTestHTTP2Protocol(context);
+        SSL_CTX_free(context);
+    }
+    context = NWClientContext(1);
+    NWTestAssert(context);
+    if (context) {
+        NWTestHTTP2Responses(context);
+        NWTestHTTP2Streams(context);
+        SSL_CTX_free(context);
+    }
+    return NWTestFinish("NWStandInTests");
+}
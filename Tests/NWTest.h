@@ -0,0 +1,49 @@
+//
+//  NWTest.h
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef _NWTEST_H_
+#define _NWTEST_H_
+
+/** Number of failed checks so far, returned from main to fail the make target. */
+static int NWTestFailures = 0;
+
+/** Checks a condition, printing the expression and location if it does not hold. */
+#define NWTestAssert(_cond) do { \
+    if (!(_cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_cond); \
+        NWTestFailures++; \
+    } \
+} while (0)
+
+/** Checks two integers are equal, printing both if they are not. */
+#define NWTestEqual(_a, _b) do { \
+    long long _va = (long long)(_a), _vb = (long long)(_b); \
+    if (_va != _vb) { \
+        fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #_a, #_b, _va, _vb); \
+        NWTestFailures++; \
+    } \
+} while (0)
+
+/** Prints the outcome and returns the exit status for main. */
+static inline int NWTestFinish(const char *name) {
+    if (NWTestFailures) fprintf(stderr, "%s: %d check(s) failed\n", name, NWTestFailures);
+    else printf("%s: ok\n", name);
+    return NWTestFailures ? 1 : 0;
+}
+
+/** Monotonic time in seconds, for benchmarks. */
+static inline double NWTestSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#endif // _NWTEST_H_
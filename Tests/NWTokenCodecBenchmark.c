@@ -0,0 +1,81 @@
+//
+//  NWTokenCodecBenchmark.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWTest.h"
+#include "NWTokenCodec.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Compares NWTokenCodec with the per-byte strtol and %02X formatting of the NWNotification helpers it replaced. Those helpers also appended to an NSData or NSString per byte, which is left out here, so the speedup shown is a lower bound.
+
+static size_t const NWBenchmarkTokens = 1000000;
+
+static void NWLegacyDecode(const char *hexes, size_t count, uint8_t *tokens) {
+    char buffer[3] = {'\0', '\0', '\0'};
+    for (size_t i = 0; i < count * NWTokenSize; i++) {
+        buffer[0] = hexes[i * 2];
+        buffer[1] = hexes[i * 2 + 1];
+        tokens[i] = (uint8_t)strtol(buffer, NULL, 16);
+    }
+}
+
+static void NWLegacyEncode(const uint8_t *tokens, size_t count, char *hexes) {
+    char buffer[3];
+    for (size_t i = 0; i < count * NWTokenSize; i++) {
+        snprintf(buffer, sizeof(buffer), "%02X", tokens[i]);
+        hexes[i * 2] = buffer[0];
+        hexes[i * 2 + 1] = buffer[1];
+    }
+}
+
+static void NWReport(const char *name, double seconds, double baseline) {
+    printf("%-14s %8.1f ns/token %8.2f M tokens/s", name, seconds * 1e9 / NWBenchmarkTokens, NWBenchmarkTokens / seconds * 1e-6);
+    if (baseline > 0) printf("  %6.1fx", baseline / seconds);
+    printf("\n");
+}
+
+int main(void) {
+    size_t size = NWBenchmarkTokens * NWTokenSize;
+    uint8_t *tokens = malloc(size), *decoded = malloc(size);
+    char *hexes = malloc(size * 2), *encoded = malloc(size * 2);
+    if (!tokens || !decoded || !hexes || !encoded) return 1;
+    srand(42);
+    for (size_t i = 0; i < size; i++) tokens[i] = (uint8_t)rand();
+    NWHexEncodeTokens(tokens, NWBenchmarkTokens, hexes, 2 * NWTokenSize);
+
+    double start = NWTestSeconds();
+    NWLegacyDecode(hexes, NWBenchmarkTokens, decoded);
+    double legacyDecode = NWTestSeconds() - start;
+    NWTestAssert(!memcmp(tokens, decoded, size));
+    memset(decoded, 0, size);
+    start = NWTestSeconds();
+    size_t valid = NWHexDecodeTokens(hexes, 2 * NWTokenSize, NWBenchmarkTokens, decoded, NULL);
+    double decode = NWTestSeconds() - start;
+    NWTestEqual(valid, NWBenchmarkTokens);
+    NWTestAssert(!memcmp(tokens, decoded, size));
+
+    start = NWTestSeconds();
+    NWLegacyEncode(tokens, NWBenchmarkTokens, encoded);
+    double legacyEncode = NWTestSeconds() - start;
+    NWTestAssert(!memcmp(hexes, encoded, size * 2));
+    memset(encoded, 0, size * 2);
+    start = NWTestSeconds();
+    NWHexEncodeTokens(tokens, NWBenchmarkTokens, encoded, 2 * NWTokenSize);
+    double encode = NWTestSeconds() - start;
+    NWTestAssert(!memcmp(hexes, encoded, size * 2));
+
+    printf("%zu tokens of %d bytes\n", NWBenchmarkTokens, NWTokenSize);
+    NWReport("legacy decode", legacyDecode, 0);
+    NWReport("decode", decode, legacyDecode);
+    NWReport("legacy encode", legacyEncode, 0);
+    NWReport("encode", encode, legacyEncode);
+    free(tokens);
+    free(decoded);
+    free(hexes);
+    free(encoded);
+    return NWTestFinish("NWTokenCodecBenchmark");
+}
@@ -0,0 +1,85 @@
+//
+//  NWTokenCodecTests.c
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#include "NWTest.h"
+#include "NWTokenCodec.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void NWTestRoundTrip(void) {
+    // lengths around the 16-byte vector width, to cover both the vector and scalar paths
+    for (size_t length = 0; length <= 40; length++) {
+        uint8_t bytes[40], decoded[40];
+        char hex[80];
+        for (size_t i = 0; i < length; i++) bytes[i] = (uint8_t)rand();
+        NWHexEncode(bytes, length, hex);
+        for (size_t i = 0; i < length * 2; i++) {
+            NWTestAssert(isxdigit((unsigned char)hex[i]) && !islower((unsigned char)hex[i]));
+        }
+        NWTestAssert(NWHexDecode(hex, length, decoded));
+        NWTestAssert(!memcmp(bytes, decoded, length));
+    }
+}
+
+static void NWTestAllBytes(void) {
+    uint8_t bytes[256], decoded[256];
+    char hex[512], expected[513];
+    for (int i = 0; i < 256; i++) {
+        bytes[i] = (uint8_t)i;
+        snprintf(expected + i * 2, 3, "%02X", i);
+    }
+    NWHexEncode(bytes, 256, hex);
+    NWTestAssert(!memcmp(hex, expected, 512));
+    for (int i = 0; i < 512; i++) hex[i] = (char)tolower((unsigned char)hex[i]);
+    NWTestAssert(NWHexDecode(hex, 256, decoded));
+    NWTestAssert(!memcmp(bytes, decoded, 256));
+}
+
+static void NWTestInvalid(void) {
+    const char *bad = "g G/:@`\x80\xff";
+    char hex[2 * NWTokenSize];
+    uint8_t bytes[NWTokenSize];
+    memset(hex, 'a', sizeof(hex));
+    NWTestAssert(NWHexDecode(hex, NWTokenSize, bytes));
+    // every position, in the vector part as well as the tail
+    for (size_t i = 0; i < sizeof(hex); i++) {
+        for (const char *c = bad; *c; c++) {
+            hex[i] = *c;
+            NWTestAssert(!NWHexDecode(hex, NWTokenSize, bytes));
+            NWTestAssert(!NWHexDecode(hex, 20, bytes) || i >= 40);
+        }
+        hex[i] = 'a';
+    }
+}
+
+static void NWTestTokens(void) {
+    size_t count = 9, stride = 2 * NWTokenSize + 1;
+    uint8_t tokens[9 * NWTokenSize], decoded[9 * NWTokenSize], valid[9];
+    char hexes[9 * (2 * NWTokenSize + 1)];
+    for (size_t i = 0; i < sizeof(tokens); i++) tokens[i] = (uint8_t)rand();
+    memset(hexes, '\n', sizeof(hexes));
+    NWHexEncodeTokens(tokens, count, hexes, stride);
+    for (size_t i = 0; i < count; i++) NWTestEqual(hexes[i * stride + 2 * NWTokenSize], '\n');
+    NWTestEqual(NWHexDecodeTokens(hexes, stride, count, decoded, valid), count);
+    NWTestAssert(!memcmp(tokens, decoded, sizeof(tokens)));
+    hexes[3 * stride + 5] = 'x';
+    hexes[7 * stride + 63] = ' ';
+    NWTestEqual(NWHexDecodeTokens(hexes, stride, count, decoded, valid), count - 2);
+    for (size_t i = 0; i < count; i++) NWTestEqual(valid[i], i != 3 && i != 7);
+    NWTestEqual(NWHexDecodeTokens(hexes, stride, count, decoded, NULL), count - 2);
+}
+
+int main(void) {
+    srand(42);
+    NWTestRoundTrip();
+    NWTestAllBytes();
+    NWTestInvalid();
+    NWTestTokens();
+    return NWTestFinish("NWTokenCodecTests");
+}
@@ -0,0 +1,89 @@
+//
+//  NWTrackerBenchmark.m
+//  Pusher
+//
+//  Copyright (c) 2014 noodlewerk. All rights reserved.
+//
+
+#import "NWTracker.h"
+#import "NWNotification.h"
+#include "NWTest.h"
+#include <mach/mach.h>
+
+// Memory and latency of tracking 1M in-flight notifications, comparing NWTracker with the dictionary of boxed identifiers to @[notification, date] that NWHub used before, trimmed by scanning all keys.
+
+static NSUInteger const NWBenchmarkCount = 1000000;
+static NSUInteger const NWBenchmarkTrims = 100;
+
+static double NWResidentMegabytes(void)
+{
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    return task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) == KERN_SUCCESS ? info.phys_footprint / (1024.0 * 1024.0) : 0;
+}
+
+static void NWReport(const char *name, const char *operation, double seconds, NSUInteger count)
+{
+    printf("%-10s %-16s %10.1f ns/op\n", name, operation, seconds * 1e9 / count);
+}
+
+int main(void)
+{
+    @autoreleasepool {
+        NSData *payload = [@"{\"aps\":{\"alert\":\"x\"}}" dataUsingEncoding:NSUTF8StringEncoding];
+        NSData *token = [NSMutableData dataWithLength:32];
+        NSMutableArray *notifications = [[NSMutableArray alloc] initWithCapacity:NWBenchmarkCount];
+        for (NSUInteger i = 0; i < NWBenchmarkCount; i++) {
+            [notifications addObject:[[NWNotification alloc] initWithPayloadData:payload tokenData:token identifier:i + 1 expirationStamp:0 addExpiration:NO priority:0]];
+        }
+        uint32_t *lookups = malloc(NWBenchmarkCount * sizeof(uint32_t));
+        for (NSUInteger i = 0; i < NWBenchmarkCount; i++) lookups[i] = arc4random_uniform((uint32_t)NWBenchmarkCount) + 1;
+        double baseline = NWResidentMegabytes();
+        printf("%lu notifications in flight, %.1f MB footprint before tracking\n", (unsigned long)NWBenchmarkCount, baseline);
+
+        NWTracker *tracker = [[NWTracker alloc] init];
+        double start = NWTestSeconds();
+        for (NWNotification *notification in notifications) [tracker addNotification:notification];
+        NWReport("tracker", "add", NWTestSeconds() - start, NWBenchmarkCount);
+        NWTestEqual(tracker.count, NWBenchmarkCount);
+        NWTestEqual(tracker.evicted, 0);
+        start = NWTestSeconds();
+        NSUInteger found = 0;
+        for (NSUInteger i = 0; i < NWBenchmarkCount; i++) found += !![tracker notificationForIdentifier:lookups[i]];
+        NWReport("tracker", "lookup", NWTestSeconds() - start, NWBenchmarkCount);
+        NWTestEqual(found, NWBenchmarkCount);
+        start = NWTestSeconds();
+        for (NSUInteger i = 0; i < NWBenchmarkTrims; i++) [tracker removeNotificationsOlderThan:30];
+        NWReport("tracker", "trim (none old)", NWTestSeconds() - start, NWBenchmarkTrims);
+        double trackerMemory = NWResidentMegabytes() - baseline;
+        printf("%-10s %-16s %10.1f MB (capacity %lu)\n", "tracker", "memory", trackerMemory, (unsigned long)tracker.capacity);
+        start = NWTestSeconds();
+        [tracker removeNotificationsOlderThan:-1];
+        NWReport("tracker", "trim (all old)", NWTestSeconds() - start, NWBenchmarkCount);
+        NWTestEqual(tracker.count, 0);
+        tracker = nil;
+
+        baseline = NWResidentMegabytes();
+        NSMutableDictionary *dictionary = @{}.mutableCopy;
+        start = NWTestSeconds();
+        for (NWNotification *notification in notifications) dictionary[@(notification.identifier)] = @[notification, NSDate.date];
+        NWReport("dictionary", "add", NWTestSeconds() - start, NWBenchmarkCount);
+        start = NWTestSeconds();
+        found = 0;
+        for (NSUInteger i = 0; i < NWBenchmarkCount; i++) found += !!dictionary[@(lookups[i])];
+        NWReport("dictionary", "lookup", NWTestSeconds() - start, NWBenchmarkCount);
+        NWTestEqual(found, NWBenchmarkCount);
+        start = NWTestSeconds();
+        for (NSUInteger i = 0; i < NWBenchmarkTrims; i++) {
+            NSDate *old = [NSDate dateWithTimeIntervalSinceNow:-30];
+            NSSet *keys = [dictionary keysOfEntriesPassingTest:^BOOL(NSNumber *key, NSArray *obj, BOOL *stop) {
+                return [old compare:obj[1]] == NSOrderedDescending;
+            }];
+            [dictionary removeObjectsForKeys:keys.allObjects];
+        }
+        NWReport("dictionary", "trim (none old)", NWTestSeconds() - start, NWBenchmarkTrims);
+        printf("%-10s %-16s %10.1f MB\n", "dictionary", "memory", NWResidentMegabytes() - baseline);
+        free(lookups);
+    }
+    return NWTestFinish("NWTrackerBenchmark");
+}